@@ -0,0 +1,150 @@
+#pragma once
+// -------------------- Arena --------------------
+// Linear (bump) allocation for scratch memory that only lives for one step.
+// Allocating is an aligned pointer bump, freeing does nothing, and the whole
+// arena is dropped at once when the step ends.
+//
+// A step that needs more than the arena holds chains extra blocks from the
+// heap. The next Reset folds them into one block big enough for all of it, so
+// after the first few steps the arena stops touching the heap.
+//
+// An arena isn't thread safe. ArenaSet keeps one per thread that runs step
+// tasks: slot 0 for the thread that waits on the graph, 1 + worker index for
+// the pool's workers.
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "JobSystem.h"
+
+class LinearArena
+{
+public:
+    explicit LinearArena(size_t InitialBytes = 64 * 1024) { AddBlock(InitialBytes); }
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+    ~LinearArena()
+    {
+        for (const Block& Item : Blocks)
+            ::operator delete(Item.Data, std::align_val_t(BlockAlign));
+    }
+
+    void* Allocate(size_t Bytes, size_t Align)
+    {
+        Block& Current = Blocks.back();
+        size_t Offset = (Used + Align - 1) & ~(Align - 1);
+        if (Offset + Bytes > Current.Size)
+        {
+            AddBlock(std::max(Bytes + Align, Current.Size * 2));
+            Offset = 0;
+        }
+        Used = Offset + Bytes;
+        return Blocks.back().Data + Offset;
+    }
+
+    // Forgets everything handed out since the last reset
+    void Reset()
+    {
+        if (Blocks.size() > 1)
+        {
+            // Grown this step: replace the chain with one block that holds all of it
+            size_t Total = 0;
+            for (const Block& Item : Blocks)
+            {
+                Total += Item.Size;
+                ::operator delete(Item.Data, std::align_val_t(BlockAlign));
+            }
+            Blocks.clear();
+            AddBlock(Total);
+            Growths++;
+        }
+        Used = 0;
+    }
+
+    size_t Capacity() const { return Blocks.back().Size; }
+    // Times the arena had to grow, should stop going up once the step has warmed up
+    long long GrowthCount() const { return Growths; }
+
+private:
+    static const size_t BlockAlign = 64;
+    struct Block { unsigned char* Data; size_t Size; };
+
+    void AddBlock(size_t Bytes)
+    {
+        Bytes = (Bytes + BlockAlign - 1) & ~(BlockAlign - 1);
+        Blocks.push_back({ static_cast<unsigned char*>(::operator new(Bytes, std::align_val_t(BlockAlign))), Bytes });
+        Used = 0;
+    }
+
+    std::vector<Block> Blocks;   // the last one is being filled
+    size_t Used = 0;
+    long long Growths = 0;
+};
+
+// STL adapter. Copies share the arena, deallocate is a no-op, and nothing
+// allocated through it may outlive the arena's next Reset.
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    LinearArena* Arena = nullptr;
+
+    explicit ArenaAllocator(LinearArena& Target) : Arena(&Target) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& Other) : Arena(Other.Arena) {}
+
+    T* allocate(size_t Count) { return static_cast<T*>(Arena->Allocate(Count * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena == b.Arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.Arena != b.Arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// One arena per thread slot of a job system
+class ArenaSet
+{
+public:
+    // Call between steps, never while tasks might be allocating
+    void Resize(JobSystem* Jobs)
+    {
+        int Slots = Jobs ? Jobs->ThreadCount() : 1;
+        while ((int)Arenas.size() < Slots)
+            Arenas.emplace_back(new LinearArena());
+    }
+
+    // The calling thread's arena
+    LinearArena& Local(JobSystem* Jobs) { return *Arenas[Jobs ? Jobs->CurrentWorker() + 1 : 0]; }
+
+    void ResetAll()
+    {
+        for (std::unique_ptr<LinearArena>& Arena : Arenas)
+            Arena->Reset();
+    }
+
+    size_t Capacity() const
+    {
+        size_t Total = 0;
+        for (const std::unique_ptr<LinearArena>& Arena : Arenas)
+            Total += Arena->Capacity();
+        return Total;
+    }
+
+    long long GrowthCount() const
+    {
+        long long Total = 0;
+        for (const std::unique_ptr<LinearArena>& Arena : Arenas)
+            Total += Arena->GrowthCount();
+        return Total;
+    }
+
+private:
+    std::vector<std::unique_ptr<LinearArena>> Arenas;
+};
@@ -0,0 +1,234 @@
+#pragma once
+// -------------------- Curl Noise --------------------
+// Divergence-free turbulence: the curl of a scalar potential psi(x, y, t),
+// (dpsi/dy, -dpsi/dx). psi is Perlin's improved gradient noise with time as
+// the third coordinate, so eddies drift and change shape smoothly.
+//
+// Noise is too slow to evaluate per particle, so CurlNoiseCache keeps psi on
+// a lattice, in tiles. A tile is filled the first time a particle samples it
+// after the noise time moved on, so tiles nobody is near never get computed.
+// Filling a tile runs the noise a row at a time, four points per SSE2
+// iteration. A lookup takes the curl of the bilinear interpolant of psi,
+// which is exactly divergence-free inside a cell, and whose flow across a
+// cell edge is the same from both sides, so nothing leaks there either.
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CURL_NOISE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Perlin's permutation, doubled so corner lookups never wrap. A fixed
+// xorshift shuffle, so every build and platform gets the same field.
+inline const uint8_t* NoisePermutation()
+{
+    struct Table
+    {
+        uint8_t P[512];
+        Table()
+        {
+            for (int i = 0; i < 256; i++) P[i] = (uint8_t)i;
+            uint32_t State = 0x9E3779B9u;
+            for (int i = 255; i > 0; i--)
+            {
+                State ^= State << 13;
+                State ^= State >> 17;
+                State ^= State << 5;
+                std::swap(P[i], P[State % (uint32_t)(i + 1)]);
+            }
+            for (int i = 0; i < 256; i++) P[256 + i] = P[i];
+        }
+    };
+    static const Table Permutation;
+    return Permutation.P;
+}
+
+// The twelve cube edge directions, four of them twice to make sixteen
+const float NoiseGradients[16][3] = {
+    { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+    { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+    { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+    { 1, 1, 0 }, { 0, -1, 1 }, { -1, 1, 0 }, { 0, -1, -1 }
+};
+
+inline float NoiseFade(float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+
+// Hashes of the eight corners of the cell at (X, Y, Z), in the order
+// (0,0,0) (1,0,0) (0,1,0) (1,1,0) (0,0,1) (1,0,1) (0,1,1) (1,1,1)
+inline void NoiseCornerHashes(int X, int Y, int Z, int* Hash)
+{
+    const uint8_t* P = NoisePermutation();
+    X &= 255; Y &= 255; Z &= 255;
+    int A = P[X] + Y, AA = P[A] + Z, AB = P[A + 1] + Z;
+    int B = P[X + 1] + Y, BA = P[B] + Z, BB = P[B + 1] + Z;
+    Hash[0] = P[AA] & 15; Hash[1] = P[BA] & 15; Hash[2] = P[AB] & 15; Hash[3] = P[BB] & 15;
+    Hash[4] = P[AA + 1] & 15; Hash[5] = P[BA + 1] & 15; Hash[6] = P[AB + 1] & 15; Hash[7] = P[BB + 1] & 15;
+}
+
+// Roughly in [-1, 1], zero on every integer lattice point
+inline float GradientNoise(float x, float y, float z)
+{
+    float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    int Hash[8];
+    NoiseCornerHashes((int)fx, (int)fy, (int)fz, Hash);
+    x -= fx; y -= fy; z -= fz;
+    float Dot[8];
+    for (int c = 0; c < 8; c++)
+    {
+        const float* g = NoiseGradients[Hash[c]];
+        Dot[c] = g[0] * (x - (c & 1)) + g[1] * (y - ((c >> 1) & 1)) + g[2] * (z - (c >> 2));
+    }
+    float u = NoiseFade(x), v = NoiseFade(y), w = NoiseFade(z);
+    float x00 = Dot[0] + u * (Dot[1] - Dot[0]), x10 = Dot[2] + u * (Dot[3] - Dot[2]);
+    float x01 = Dot[4] + u * (Dot[5] - Dot[4]), x11 = Dot[6] + u * (Dot[7] - Dot[6]);
+    float y0 = x00 + v * (x10 - x00), y1 = x01 + v * (x11 - x01);
+    return y0 + w * (y1 - y0);
+}
+
+// GradientNoise at (X0 + i * Step, Y, Z) for i in [0, Count). Y and Z are
+// shared by the row, so only x varies across the lanes; the hashing and
+// gradient fetches stay scalar, the dot products and blends run four wide.
+inline void GradientNoiseRow(float X0, float Step, float Y, float Z, int Count, float* Out)
+{
+    int i = 0;
+#ifdef CURL_NOISE_SSE2
+    float fy = std::floor(Y), fz = std::floor(Z);
+    float y = Y - fy, z = Z - fz;
+    const __m128 V = _mm_set1_ps(NoiseFade(y));
+    const __m128 W = _mm_set1_ps(NoiseFade(z));
+    const __m128 One = _mm_set1_ps(1.0f);
+    const __m128 Lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    alignas(16) float Cell[4];
+    alignas(16) float G[8][3][4];
+    for (; i + 4 <= Count; i += 4)
+    {
+        __m128 X = _mm_add_ps(_mm_set1_ps(X0), _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)i), Lanes), _mm_set1_ps(Step)));
+        // floor: truncate, then step down where that rounded a negative up
+        __m128 Floor = _mm_cvtepi32_ps(_mm_cvttps_epi32(X));
+        Floor = _mm_sub_ps(Floor, _mm_and_ps(_mm_cmpgt_ps(Floor, X), One));
+        _mm_store_ps(Cell, Floor);
+        for (int Lane = 0; Lane < 4; Lane++)
+        {
+            int Hash[8];
+            NoiseCornerHashes((int)Cell[Lane], (int)fy, (int)fz, Hash);
+            for (int c = 0; c < 8; c++)
+                for (int k = 0; k < 3; k++)
+                    G[c][k][Lane] = NoiseGradients[Hash[c]][k];
+        }
+        __m128 x = _mm_sub_ps(X, Floor);
+        __m128 Dot[8];
+        for (int c = 0; c < 8; c++)
+        {
+            __m128 dx = (c & 1) ? _mm_sub_ps(x, One) : x;
+            float dy = y - ((c >> 1) & 1), dz = z - (c >> 2);
+            Dot[c] = _mm_add_ps(_mm_mul_ps(_mm_load_ps(G[c][0]), dx),
+                _mm_add_ps(_mm_mul_ps(_mm_load_ps(G[c][1]), _mm_set1_ps(dy)), _mm_mul_ps(_mm_load_ps(G[c][2]), _mm_set1_ps(dz))));
+        }
+        // fade(x) = x^3 (x (6x - 15) + 10)
+        __m128 U = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(x, x), x),
+            _mm_add_ps(_mm_mul_ps(x, _mm_sub_ps(_mm_mul_ps(x, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+        auto Lerp = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))); };
+        __m128 y0 = Lerp(Lerp(Dot[0], Dot[1], U), Lerp(Dot[2], Dot[3], U), V);
+        __m128 y1 = Lerp(Lerp(Dot[4], Dot[5], U), Lerp(Dot[6], Dot[7], U), V);
+        _mm_storeu_ps(Out + i, Lerp(y0, y1, W));
+    }
+#endif
+    for (; i < Count; i++)
+        Out[i] = GradientNoise(X0 + i * Step, Y, Z);
+}
+
+// Unit-strength curl noise over a rectangle, on a lattice of Spacing = a
+// quarter of the feature size, in tiles of TileCells x TileCells cells. Each
+// tile stores one extra row and column of psi, so lookups never leave it.
+class CurlNoiseCache
+{
+public:
+    static const int TileCells = 16;
+    static const int TileSide = TileCells + 1;
+
+    // Call between steps. Drops every tile when the area or feature size changed.
+    void Configure(float NewOriginX, float NewOriginY, float Width, float Height, float FeatureSize)
+    {
+        float NewSpacing = std::max(FeatureSize, 1.0f) * 0.25f;
+        int NewTilesX = std::max(1, (int)std::ceil(Width / (NewSpacing * TileCells)));
+        int NewTilesY = std::max(1, (int)std::ceil(Height / (NewSpacing * TileCells)));
+        if (NewOriginX == OriginX && NewOriginY == OriginY && NewSpacing == Spacing && NewTilesX == TilesX && NewTilesY == TilesY)
+            return;
+        OriginX = NewOriginX;
+        OriginY = NewOriginY;
+        Spacing = NewSpacing;
+        TilesX = NewTilesX;
+        TilesY = NewTilesY;
+        Tiles.clear();
+        Tiles.resize((size_t)TilesX * TilesY);
+        for (std::unique_ptr<Tile>& Item : Tiles)
+            Item.reset(new Tile());
+    }
+
+    // Call between steps. Tiles filled for an older Key refill on their next lookup.
+    void SetTime(long long NewKey, float NewTime)
+    {
+        Key = NewKey;
+        Time = NewTime;
+    }
+
+    // Flow at (X, Y), clamped to the covered area. Safe from any number of threads.
+    void Sample(float X, float Y, float& FlowX, float& FlowY)
+    {
+        float gx = std::min(std::max((X - OriginX) / Spacing, 0.0f), TilesX * TileCells - 0.001f);
+        float gy = std::min(std::max((Y - OriginY) / Spacing, 0.0f), TilesY * TileCells - 0.001f);
+        int cx = (int)gx, cy = (int)gy;
+        int tx = cx / TileCells, ty = cy / TileCells;
+        Tile& Item = *Tiles[(size_t)ty * TilesX + tx];
+        if (Item.Stamp.load(std::memory_order_acquire) != Key)
+            Refill(Item, tx, ty);
+        int lx = cx - tx * TileCells, ly = cy - ty * TileCells;
+        float fx = gx - cx, fy = gy - cy;
+        const float* Low = Item.Psi + ly * TileSide + lx;
+        const float* High = Low + TileSide;
+        // (dpsi/dy, -dpsi/dx) per noise unit, which peaks at about 1. The
+        // lattice step is a quarter of a noise unit.
+        const float InvStep = 4.0f;
+        FlowX = ((High[0] - Low[0]) * (1.0f - fx) + (High[1] - Low[1]) * fx) * InvStep;
+        FlowY = -((Low[1] - Low[0]) * (1.0f - fy) + (High[1] - High[0]) * fy) * InvStep;
+    }
+
+    long long Refills() const { return RefillCount.load(std::memory_order_relaxed); }
+    int TileCount() const { return (int)Tiles.size(); }
+    float LatticeSpacing() const { return Spacing; }
+
+private:
+    struct Tile
+    {
+        std::atomic<long long> Stamp{ -1 };
+        std::mutex Lock;
+        float Psi[TileSide * TileSide];   // row major
+    };
+
+    // First caller for the new time fills it, anybody else waits for that
+    void Refill(Tile& Item, int tx, int ty)
+    {
+        std::lock_guard<std::mutex> Guard(Item.Lock);
+        if (Item.Stamp.load(std::memory_order_relaxed) == Key)
+            return;
+        float InvFeature = 0.25f / Spacing;
+        float x0 = OriginX + tx * TileCells * Spacing;
+        float y0 = OriginY + ty * TileCells * Spacing;
+        for (int Row = 0; Row < TileSide; Row++)
+            GradientNoiseRow(x0 * InvFeature, 0.25f, (y0 + Row * Spacing) * InvFeature, Time, TileSide, Item.Psi + Row * TileSide);
+        RefillCount.fetch_add(1, std::memory_order_relaxed);
+        Item.Stamp.store(Key, std::memory_order_release);
+    }
+
+    float OriginX = 0.0f, OriginY = 0.0f, Spacing = 0.0f;
+    int TilesX = 0, TilesY = 0;
+    long long Key = 0;
+    float Time = 0.0f;
+    std::vector<std::unique_ptr<Tile>> Tiles;
+    std::atomic<long long> RefillCount{ 0 };
+};
@@ -0,0 +1,438 @@
+#pragma once
+// -------------------- Offscreen Frame Capture --------------------
+// Renders into a framebuffer object and reads it back through a ring of
+// pixel buffer objects. glReadPixels into a PBO only queues a copy, and each
+// PBO is mapped RingSize-1 frames later when the GPU is long done with it, so
+// the render loop never waits on the readback. Mapped frames are handed to a
+// worker thread that writes them out as a numbered PPM or PNG sequence.
+//
+// Only needs GL 2.1 + ARB/EXT_framebuffer_object, which Mesa llvmpipe has, so
+// it also works on display-less machines through GLFW's OSMesa context.
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#define GL_RENDERBUFFER 0x8D41
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#define GL_READ_ONLY 0x88B8
+#endif
+
+#ifdef _WIN32
+#define CAPTURE_APIENTRY __stdcall
+#else
+#define CAPTURE_APIENTRY
+#endif
+
+enum CaptureFormats
+{
+    CapturePPM,
+    CapturePNG
+};
+
+// GL entry points past 1.1 aren't exported by every opengl32, so load them ourselves
+struct CaptureGLFunctions
+{
+    void (CAPTURE_APIENTRY* GenFramebuffers)(GLsizei, GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* DeleteFramebuffers)(GLsizei, const GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* BindFramebuffer)(GLenum, GLuint) = nullptr;
+    void (CAPTURE_APIENTRY* FramebufferRenderbuffer)(GLenum, GLenum, GLenum, GLuint) = nullptr;
+    GLenum (CAPTURE_APIENTRY* CheckFramebufferStatus)(GLenum) = nullptr;
+    void (CAPTURE_APIENTRY* GenRenderbuffers)(GLsizei, GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* DeleteRenderbuffers)(GLsizei, const GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* BindRenderbuffer)(GLenum, GLuint) = nullptr;
+    void (CAPTURE_APIENTRY* RenderbufferStorage)(GLenum, GLenum, GLsizei, GLsizei) = nullptr;
+    void (CAPTURE_APIENTRY* BlitFramebuffer)(GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLbitfield, GLenum) = nullptr;
+    void (CAPTURE_APIENTRY* GenBuffers)(GLsizei, GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* DeleteBuffers)(GLsizei, const GLuint*) = nullptr;
+    void (CAPTURE_APIENTRY* BindBuffer)(GLenum, GLuint) = nullptr;
+    void (CAPTURE_APIENTRY* BufferData)(GLenum, std::ptrdiff_t, const void*, GLenum) = nullptr;
+    void* (CAPTURE_APIENTRY* MapBuffer)(GLenum, GLenum) = nullptr;
+    GLboolean (CAPTURE_APIENTRY* UnmapBuffer)(GLenum) = nullptr;
+
+    template <typename T>
+    static bool Load(T& Function, const char* Name)
+    {
+        // Core name first, then the EXT/ARB spelling older drivers export
+        GLFWglproc Proc = glfwGetProcAddress(Name);
+        if (!Proc) Proc = glfwGetProcAddress((std::string(Name) + "EXT").c_str());
+        if (!Proc) Proc = glfwGetProcAddress((std::string(Name) + "ARB").c_str());
+        Function = reinterpret_cast<T>(Proc);
+        return Proc != nullptr;
+    }
+
+    bool LoadAll()
+    {
+        bool Ok = true;
+        Ok &= Load(GenFramebuffers, "glGenFramebuffers");
+        Ok &= Load(DeleteFramebuffers, "glDeleteFramebuffers");
+        Ok &= Load(BindFramebuffer, "glBindFramebuffer");
+        Ok &= Load(FramebufferRenderbuffer, "glFramebufferRenderbuffer");
+        Ok &= Load(CheckFramebufferStatus, "glCheckFramebufferStatus");
+        Ok &= Load(GenRenderbuffers, "glGenRenderbuffers");
+        Ok &= Load(DeleteRenderbuffers, "glDeleteRenderbuffers");
+        Ok &= Load(BindRenderbuffer, "glBindRenderbuffer");
+        Ok &= Load(RenderbufferStorage, "glRenderbufferStorage");
+        Ok &= Load(GenBuffers, "glGenBuffers");
+        Ok &= Load(DeleteBuffers, "glDeleteBuffers");
+        Ok &= Load(BindBuffer, "glBindBuffer");
+        Ok &= Load(BufferData, "glBufferData");
+        Ok &= Load(MapBuffer, "glMapBuffer");
+        Ok &= Load(UnmapBuffer, "glUnmapBuffer");
+        Load(BlitFramebuffer, "glBlitFramebuffer"); // optional, only for showing the capture on screen
+        return Ok;
+    }
+};
+
+// -------------------- Image Writers --------------------
+// Pixels come in as bottom-up RGBA straight from glReadPixels
+
+inline bool WritePPM(const std::string& Path, const unsigned char* Pixels, int Width, int Height)
+{
+    FILE* File = std::fopen(Path.c_str(), "wb");
+    if (!File) return false;
+
+    std::fprintf(File, "P6\n%d %d\n255\n", Width, Height);
+    std::vector<unsigned char> Row(Width * 3);
+    for (int y = Height - 1; y >= 0; y--)
+    {
+        const unsigned char* Source = Pixels + (size_t)y * Width * 4;
+        for (int x = 0; x < Width; x++)
+        {
+            Row[x * 3 + 0] = Source[x * 4 + 0];
+            Row[x * 3 + 1] = Source[x * 4 + 1];
+            Row[x * 3 + 2] = Source[x * 4 + 2];
+        }
+        std::fwrite(Row.data(), 1, Row.size(), File);
+    }
+    return std::fclose(File) == 0;
+}
+
+inline uint32_t PngCrc(const unsigned char* Data, size_t Length, uint32_t Crc = 0xFFFFFFFFu)
+{
+    static uint32_t Table[256];
+    static bool TableReady = false;
+    if (!TableReady)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            Table[n] = c;
+        }
+        TableReady = true;
+    }
+    for (size_t i = 0; i < Length; i++)
+        Crc = Table[(Crc ^ Data[i]) & 0xFF] ^ (Crc >> 8);
+    return Crc;
+}
+
+// Minimal PNG: 8-bit RGB, deflate "stored" blocks so there's no zlib dependency.
+// Files are about as big as PPM but every video tool reads them.
+inline bool WritePNG(const std::string& Path, const unsigned char* Pixels, int Width, int Height)
+{
+    // Raw scanlines, each prefixed with filter type 0
+    size_t RowBytes = (size_t)Width * 3 + 1;
+    std::vector<unsigned char> Raw(RowBytes * Height);
+    for (int y = 0; y < Height; y++)
+    {
+        const unsigned char* Source = Pixels + (size_t)(Height - 1 - y) * Width * 4;
+        unsigned char* Dest = Raw.data() + y * RowBytes;
+        Dest[0] = 0;
+        for (int x = 0; x < Width; x++)
+        {
+            Dest[1 + x * 3 + 0] = Source[x * 4 + 0];
+            Dest[1 + x * 3 + 1] = Source[x * 4 + 1];
+            Dest[1 + x * 3 + 2] = Source[x * 4 + 2];
+        }
+    }
+
+    // zlib stream: header, stored blocks of up to 65535 bytes, adler32
+    std::vector<unsigned char> Zlib = { 0x78, 0x01 };
+    uint32_t AdlerA = 1, AdlerB = 0;
+    size_t Offset = 0;
+    bool Last = false;
+    while (!Last)
+    {
+        size_t Length = std::min<size_t>(65535, Raw.size() - Offset);
+        Last = Offset + Length == Raw.size();
+        Zlib.push_back(Last ? 1 : 0);
+        Zlib.push_back(Length & 0xFF);
+        Zlib.push_back((Length >> 8) & 0xFF);
+        Zlib.push_back(~Length & 0xFF);
+        Zlib.push_back((~Length >> 8) & 0xFF);
+        Zlib.insert(Zlib.end(), Raw.begin() + Offset, Raw.begin() + Offset + Length);
+        for (size_t i = Offset; i < Offset + Length; i++)
+        {
+            AdlerA = (AdlerA + Raw[i]) % 65521;
+            AdlerB = (AdlerB + AdlerA) % 65521;
+        }
+        Offset += Length;
+    }
+    uint32_t Adler = (AdlerB << 16) | AdlerA;
+    for (int Shift = 24; Shift >= 0; Shift -= 8)
+        Zlib.push_back((Adler >> Shift) & 0xFF);
+
+    FILE* File = std::fopen(Path.c_str(), "wb");
+    if (!File) return false;
+
+    auto Put32 = [&](uint32_t Value) {
+        unsigned char Bytes[4] = { (unsigned char)(Value >> 24), (unsigned char)(Value >> 16), (unsigned char)(Value >> 8), (unsigned char)Value };
+        std::fwrite(Bytes, 1, 4, File);
+    };
+    auto PutChunk = [&](const char* Type, const unsigned char* Data, size_t Length) {
+        Put32((uint32_t)Length);
+        std::fwrite(Type, 1, 4, File);
+        if (Length) std::fwrite(Data, 1, Length, File);
+        uint32_t Crc = PngCrc((const unsigned char*)Type, 4);
+        Crc = PngCrc(Data, Length, Crc);
+        Put32(Crc ^ 0xFFFFFFFFu);
+    };
+
+    static const unsigned char Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::fwrite(Signature, 1, 8, File);
+    unsigned char Header[13] = {
+        (unsigned char)(Width >> 24), (unsigned char)(Width >> 16), (unsigned char)(Width >> 8), (unsigned char)Width,
+        (unsigned char)(Height >> 24), (unsigned char)(Height >> 16), (unsigned char)(Height >> 8), (unsigned char)Height,
+        8, 2, 0, 0, 0 // 8 bit, truecolor, deflate, no filter, no interlace
+    };
+    PutChunk("IHDR", Header, sizeof(Header));
+    PutChunk("IDAT", Zlib.data(), Zlib.size());
+    PutChunk("IEND", nullptr, 0);
+    return std::fclose(File) == 0;
+}
+
+// -------------------- Capture --------------------
+class FrameCapture
+{
+public:
+    ~FrameCapture() { Shutdown(); }
+
+    bool Init(int FrameWidth, int FrameHeight, const std::string& OutputDirectory, CaptureFormats OutputFormat, int PboCount = 3)
+    {
+        if (!GL.LoadAll())
+        {
+            std::cerr << "Frame capture needs framebuffer and pixel buffer objects, which this GL doesn't have\n";
+            return false;
+        }
+
+        Width = FrameWidth;
+        Height = FrameHeight;
+        Directory = OutputDirectory;
+        Format = OutputFormat;
+        FrameBytes = (size_t)Width * Height * 4;
+
+        std::error_code Error;
+        std::filesystem::create_directories(Directory, Error);
+
+        GL.GenRenderbuffers(1, &ColorBuffer);
+        GL.BindRenderbuffer(GL_RENDERBUFFER, ColorBuffer);
+        GL.RenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height);
+        GL.GenFramebuffers(1, &Framebuffer);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+        GL.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ColorBuffer);
+        GLenum Status = GL.CheckFramebufferStatus(GL_FRAMEBUFFER);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (Status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Capture framebuffer incomplete (0x" << std::hex << Status << std::dec << ")\n";
+            Shutdown();
+            return false;
+        }
+
+        Pbos.resize(PboCount < 2 ? 2 : PboCount);
+        GL.GenBuffers((GLsizei)Pbos.size(), Pbos.data());
+        for (GLuint Pbo : Pbos)
+        {
+            GL.BindBuffer(GL_PIXEL_PACK_BUFFER, Pbo);
+            GL.BufferData(GL_PIXEL_PACK_BUFFER, (std::ptrdiff_t)FrameBytes, nullptr, GL_STREAM_READ);
+        }
+        GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        Running = true;
+        Encoder = std::thread(&FrameCapture::EncoderLoop, this);
+        Ready = true;
+        return true;
+    }
+
+    // Everything drawn between BeginFrame and EndFrame ends up in the capture
+    void BeginFrame()
+    {
+        if (!Ready) return;
+        GL.BindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+        glViewport(0, 0, Width, Height);
+    }
+
+    void EndFrame()
+    {
+        if (!Ready) return;
+
+        // Queue this frame's readback, it completes in the background
+        int Slot = (int)(FramesIssued % Pbos.size());
+        GL.BindBuffer(GL_PIXEL_PACK_BUFFER, Pbos[Slot]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        FramesIssued++;
+
+        // The oldest PBO in the ring was filled RingSize-1 frames ago
+        if (FramesIssued >= (long long)Pbos.size())
+            CollectFrame(FramesIssued - (long long)Pbos.size());
+
+        GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Show the captured frame in the window (UI can then be drawn on top without being recorded)
+    void BlitToWindow(int WindowWidth, int WindowHeight)
+    {
+        if (!Ready || !GL.BlitFramebuffer) return;
+        GL.BindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+        GL.BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        GL.BlitFramebuffer(0, 0, Width, Height, 0, 0, WindowWidth, WindowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        GL.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, WindowWidth, WindowHeight);
+    }
+
+    // Drains the PBO ring and the encoder queue, then frees the GL objects
+    void Shutdown()
+    {
+        if (Ready)
+        {
+            // Frames not yet collected by EndFrame are the last RingSize-1 issued
+            long long First = FramesIssued - (long long)Pbos.size() + 1;
+            if (First < 0) First = 0;
+            for (long long Frame = First; Frame < FramesIssued; Frame++)
+                CollectFrame(Frame);
+            GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        if (Encoder.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> Lock(QueueMutex);
+                Running = false;
+            }
+            QueueChanged.notify_all();
+            Encoder.join();
+        }
+
+        if (!Pbos.empty()) GL.DeleteBuffers((GLsizei)Pbos.size(), Pbos.data());
+        if (Framebuffer) GL.DeleteFramebuffers(1, &Framebuffer);
+        if (ColorBuffer) GL.DeleteRenderbuffers(1, &ColorBuffer);
+        Pbos.clear();
+        Framebuffer = ColorBuffer = 0;
+        Ready = false;
+    }
+
+    bool IsReady() const { return Ready; }
+    long long FramesCaptured() const { return FramesIssued; }
+    long long FramesWritten() const { return Written; }
+
+private:
+    struct EncodeJob
+    {
+        long long Frame;
+        std::vector<unsigned char> Pixels;
+    };
+
+    void CollectFrame(long long Frame)
+    {
+        GL.BindBuffer(GL_PIXEL_PACK_BUFFER, Pbos[Frame % Pbos.size()]);
+        const unsigned char* Mapped = static_cast<const unsigned char*>(GL.MapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+        if (!Mapped) return;
+
+        EncodeJob Job;
+        Job.Frame = Frame;
+        {
+            // Back-pressure: if the disk can't keep up, wait instead of growing the queue forever
+            std::unique_lock<std::mutex> Lock(QueueMutex);
+            QueueChanged.wait(Lock, [&] { return Queue.size() < MaxQueuedFrames; });
+            if (!FreeBuffers.empty())
+            {
+                Job.Pixels.swap(FreeBuffers.back());
+                FreeBuffers.pop_back();
+            }
+        }
+        Job.Pixels.assign(Mapped, Mapped + FrameBytes);
+        GL.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+        {
+            std::lock_guard<std::mutex> Lock(QueueMutex);
+            Queue.push_back(std::move(Job));
+        }
+        QueueChanged.notify_all();
+    }
+
+    void EncoderLoop()
+    {
+        while (true)
+        {
+            EncodeJob Job;
+            {
+                std::unique_lock<std::mutex> Lock(QueueMutex);
+                QueueChanged.wait(Lock, [&] { return !Queue.empty() || !Running; });
+                if (Queue.empty()) return;
+                Job = std::move(Queue.front());
+                Queue.pop_front();
+            }
+            QueueChanged.notify_all();
+
+            char Name[32];
+            std::snprintf(Name, sizeof(Name), "frame_%06lld.%s", Job.Frame, Format == CapturePNG ? "png" : "ppm");
+            std::string Path = (std::filesystem::path(Directory) / Name).string();
+            bool Ok = Format == CapturePNG ? WritePNG(Path, Job.Pixels.data(), Width, Height)
+                                           : WritePPM(Path, Job.Pixels.data(), Width, Height);
+            if (!Ok)
+                std::cerr << "Failed to write " << Path << "\n";
+            else
+                Written++;
+
+            std::lock_guard<std::mutex> Lock(QueueMutex);
+            FreeBuffers.push_back(std::move(Job.Pixels));
+        }
+    }
+
+    static constexpr size_t MaxQueuedFrames = 8;
+
+    CaptureGLFunctions GL;
+    int Width = 0, Height = 0;
+    size_t FrameBytes = 0;
+    std::string Directory;
+    CaptureFormats Format = CapturePNG;
+    bool Ready = false;
+
+    GLuint Framebuffer = 0, ColorBuffer = 0;
+    std::vector<GLuint> Pbos;
+    long long FramesIssued = 0;
+
+    std::thread Encoder;
+    std::mutex QueueMutex;
+    std::condition_variable QueueChanged;
+    std::deque<EncodeJob> Queue;
+    std::vector<std::vector<unsigned char>> FreeBuffers;
+    bool Running = false;
+    std::atomic<long long> Written{ 0 };
+};
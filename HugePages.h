@@ -0,0 +1,252 @@
+#pragma once
+// -------------------- Huge Pages --------------------
+// Page-level backing for ParticleList-scale buffers. With 4 KB pages a sweep
+// over a few hundred MB of particles touches tens of thousands of pages and
+// keeps missing the TLB. With 2 MB pages it's a few hundred.
+//
+//   Explicit:    MAP_HUGETLB from the preallocated pool (vm.nr_hugepages), or
+//                MEM_LARGE_PAGES on Windows (needs the lock pages privilege)
+//   Transparent: a 2 MB aligned mapping marked MADV_HUGEPAGE, backed with huge
+//                pages whenever the kernel manages to
+//
+// Each mode falls back to the next one down, and finally to normal pages, when
+// the OS says no. Blocks are always page aligned, so 64-byte alignment for
+// cache lines and SIMD comes for free.
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+enum HugePageModes
+{
+    HugePagesOff,
+    HugePagesTransparent,
+    HugePagesExplicit
+};
+const char* const HugePageModeNames[] = { "off", "transparent", "explicit" };
+
+const size_t HugePageBytes = (size_t)2 << 20;
+
+// Mapping length for a block of Bytes. Anything from half a huge page up is
+// rounded to whole huge pages whatever the mode, so releasing a block never
+// needs to know how it ended up backed.
+inline size_t LargeMappingBytes(size_t Bytes)
+{
+    if (Bytes >= HugePageBytes / 2)
+        return (Bytes + HugePageBytes - 1) & ~(HugePageBytes - 1);
+    return (Bytes + 4095) & ~(size_t)4095;
+}
+
+// Bytes handed out per backing, for the reports
+struct HugePageCounters
+{
+    std::atomic<long long> ExplicitBytes{ 0 };
+    std::atomic<long long> TransparentBytes{ 0 };
+    std::atomic<long long> NormalBytes{ 0 };
+};
+
+inline HugePageCounters& HugePageStats()
+{
+    static HugePageCounters Stats;
+    return Stats;
+}
+
+// Zeroed and not yet backed, so first touch still decides the NUMA node
+inline void* ReserveLarge(size_t Bytes, HugePageModes Mode)
+{
+    HugePageCounters& Stats = HugePageStats();
+    size_t Length = LargeMappingBytes(Bytes);
+    bool Large = Length % HugePageBytes == 0;
+#if defined(__linux__)
+#ifdef MAP_HUGETLB
+    if (Mode == HugePagesExplicit && Large)
+    {
+        void* Data = mmap(nullptr, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (Data != MAP_FAILED)
+        {
+            Stats.ExplicitBytes += (long long)Length;
+            return Data;
+        }
+    }
+#endif
+    if (Mode != HugePagesOff && Large)
+    {
+        // Over-map by one huge page, then trim both ends to a 2 MB aligned block
+        size_t Padded = Length + HugePageBytes;
+        void* Raw = mmap(nullptr, Padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (Raw != MAP_FAILED)
+        {
+            uintptr_t Start = ((uintptr_t)Raw + HugePageBytes - 1) & ~(uintptr_t)(HugePageBytes - 1);
+            size_t Head = Start - (uintptr_t)Raw;
+            if (Head) munmap(Raw, Head);
+            if (Padded - Head - Length) munmap((void*)(Start + Length), Padded - Head - Length);
+#ifdef MADV_HUGEPAGE
+            madvise((void*)Start, Length, MADV_HUGEPAGE);
+#endif
+            Stats.TransparentBytes += (long long)Length;
+            return (void*)Start;
+        }
+    }
+    void* Data = mmap(nullptr, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Data == MAP_FAILED) return nullptr;
+    Stats.NormalBytes += (long long)Length;
+    return Data;
+#elif defined(_WIN32)
+    if (Mode == HugePagesExplicit && Large)
+    {
+        size_t Minimum = GetLargePageMinimum();
+        if (Minimum)
+        {
+            size_t Rounded = (Length + Minimum - 1) / Minimum * Minimum;
+            void* Data = VirtualAlloc(nullptr, Rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (Data)
+            {
+                Stats.ExplicitBytes += (long long)Rounded;
+                return Data;
+            }
+        }
+    }
+    void* Data = VirtualAlloc(nullptr, Length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (Data) Stats.NormalBytes += (long long)Length;
+    return Data;
+#else
+    (void)Mode; (void)Large;
+    void* Data = ::operator new(Length, std::align_val_t(64), std::nothrow);
+    if (Data)
+    {
+        std::memset(Data, 0, Length);
+        Stats.NormalBytes += (long long)Length;
+    }
+    return Data;
+#endif
+}
+
+inline void ReleaseLarge(void* Data, size_t Bytes)
+{
+#if defined(__linux__)
+    munmap(Data, LargeMappingBytes(Bytes));
+#elif defined(_WIN32)
+    (void)Bytes;
+    VirtualFree(Data, 0, MEM_RELEASE);
+#else
+    (void)Bytes;
+    ::operator delete(Data, std::align_val_t(64));
+#endif
+}
+
+// How much of the mapping holding Data is backed by huge pages right now, in
+// bytes, from /proc/self/smaps. -1 where that can't be read.
+inline long long QueryHugeBackedBytes(const void* Data)
+{
+#if defined(__linux__)
+    std::ifstream Smaps("/proc/self/smaps");
+    if (!Smaps) return -1;
+    uintptr_t Address = (uintptr_t)Data;
+    bool Inside = false;
+    long long Backed = 0;
+    std::string Line;
+    while (std::getline(Smaps, Line))
+    {
+        uintptr_t Start = 0, End = 0;
+        char Dash = 0;
+        std::istringstream Header(Line);
+        // Range lines look like "7f12a0000000-7f12a8000000 rw-p ..."
+        if (Line.find('-') != std::string::npos && (Header >> std::hex >> Start >> Dash >> End) && Dash == '-')
+        {
+            if (Inside) break;
+            Inside = Address >= Start && Address < End;
+            continue;
+        }
+        if (!Inside) continue;
+        std::istringstream Field(Line);
+        std::string Name;
+        long long Kb = 0;
+        if (Field >> Name >> Kb && (Name == "AnonHugePages:" || Name == "Private_Hugetlb:" || Name == "Shared_Hugetlb:"))
+            Backed += Kb * 1024;
+    }
+    return Inside ? Backed : -1;
+#else
+    (void)Data;
+    return -1;
+#endif
+}
+
+// -------------------- TLB Miss Counter --------------------
+// Data TLB load misses of the calling thread, from perf_event_open. Only
+// counts user space, so it works at perf_event_paranoid 2. Open fails on
+// kernels or VMs without the counter, and on other platforms.
+class TlbMissCounter
+{
+public:
+    TlbMissCounter() = default;
+    TlbMissCounter(const TlbMissCounter&) = delete;
+    TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+    ~TlbMissCounter()
+    {
+#if defined(__linux__)
+        if (Fd >= 0) close(Fd);
+#endif
+    }
+
+    bool Open()
+    {
+#if defined(__linux__) && defined(SYS_perf_event_open)
+        perf_event_attr Attr;
+        std::memset(&Attr, 0, sizeof(Attr));
+        Attr.size = sizeof(Attr);
+        Attr.type = PERF_TYPE_HW_CACHE;
+        Attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        Attr.disabled = 1;
+        Attr.exclude_kernel = 1;
+        Attr.exclude_hv = 1;
+        Fd = (int)syscall(SYS_perf_event_open, &Attr, 0, -1, -1, 0);
+        return Fd >= 0;
+#else
+        return false;
+#endif
+    }
+
+    bool Valid() const { return Fd >= 0; }
+
+    void Start()
+    {
+#if defined(__linux__)
+        if (Fd < 0) return;
+        ioctl(Fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(Fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    // Misses since Start, -1 without a counter
+    long long Stop()
+    {
+#if defined(__linux__)
+        if (Fd < 0) return -1;
+        ioctl(Fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long Count = 0;
+        if (read(Fd, &Count, sizeof(Count)) != (ssize_t)sizeof(Count)) return -1;
+        return Count;
+#else
+        return -1;
+#endif
+    }
+
+private:
+    int Fd = -1;
+};
@@ -0,0 +1,460 @@
+#pragma once
+// -------------------- Job System --------------------
+// Work-stealing thread pool plus a small task graph on top of it.
+//
+// Every worker owns a deque: it pushes and pops its own work at the back
+// (newest first, still hot in cache) and idle workers steal from the front of
+// somebody else's. Threads that aren't workers (the main thread, sweep
+// threads...) submit through a shared injection queue and help run tasks
+// while they wait, so the pool is sized hardware threads - 1 and the caller
+// makes up the last core instead of oversubscribing.
+//
+// A TaskGraph is rebuilt every step but keeps its storage, so once it has
+// seen the largest graph it stops allocating.
+//
+// Workers can be grouped by NUMA node. A task tagged with a node goes to that
+// node's queue and only threads on that node run it, so data first-touched
+// there stays local (see Numa.h). Untagged tasks go anywhere.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class JobSystem;
+class TaskGraph;
+
+// Fixed-size callable, so building tasks never goes through the heap the way
+// std::function would. Capture by reference or pointer to stay under the size.
+class TaskFunction
+{
+public:
+    static constexpr size_t Capacity = 64;
+
+    template <typename F>
+    void Set(F&& Fn)
+    {
+        using T = typename std::decay<F>::type;
+        static_assert(sizeof(T) <= Capacity, "Task lambda captures too much, capture a pointer or reference instead");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Task lambda is over-aligned");
+        static_assert(std::is_trivially_destructible<T>::value, "Task lambdas must be trivially destructible");
+        new (Storage) T(std::forward<F>(Fn));
+        Invoke = [](void* Data) { (*static_cast<T*>(Data))(); };
+    }
+
+    void operator()() { Invoke(Storage); }
+
+private:
+    alignas(std::max_align_t) unsigned char Storage[Capacity];
+    void (*Invoke)(void*) = nullptr;
+};
+
+struct Task
+{
+    TaskFunction Fn;
+    TaskGraph* Graph = nullptr;
+    const char* Name = "";
+    int Node = -1;  // NUMA node that has to run this, -1 for any
+    std::atomic<int> PendingDeps{ 0 };
+    int DependencyCount = 0;
+    int FirstSuccessor = 0;
+    int SuccessorCount = 0;
+};
+
+typedef int TaskHandle;
+struct TaskRange { int First = 0; int Count = 0; };
+
+// -------------------- Worker Deque --------------------
+// Ring buffer behind a mutex. Only grows, so steady state doesn't allocate.
+class TaskQueue
+{
+public:
+    void PushBack(Task* Item)
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        if (Size == (int)Ring.size())
+        {
+            std::vector<Task*> Bigger(Ring.empty() ? 64 : Ring.size() * 2);
+            for (int i = 0; i < Size; i++)
+                Bigger[i] = Ring[(Head + i) % Ring.size()];
+            Ring.swap(Bigger);
+            Head = 0;
+        }
+        Ring[(Head + Size) % Ring.size()] = Item;
+        Size++;
+    }
+
+    // Owner end: newest first
+    Task* PopBack()
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        if (Size == 0) return nullptr;
+        Size--;
+        return Ring[(Head + Size) % Ring.size()];
+    }
+
+    // Thief end: oldest first, which tends to be the biggest remaining piece
+    Task* PopFront()
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        if (Size == 0) return nullptr;
+        Task* Item = Ring[Head];
+        Head = (Head + 1) % (int)Ring.size();
+        Size--;
+        return Item;
+    }
+
+private:
+    std::mutex Lock;
+    std::vector<Task*> Ring;
+    int Head = 0;
+    int Size = 0;
+};
+
+// -------------------- Pool --------------------
+class JobSystem
+{
+public:
+    // WorkerCount < 0 means one worker per hardware thread, minus the caller's.
+    // WorkerNodes gives each worker's NUMA node (empty: everyone on node 0), and
+    // OnWorkerStart runs first thing on every worker thread, e.g. to pin it.
+    explicit JobSystem(int WorkerCount = -1, std::vector<int> WorkerNodes = {}, std::function<void(int)> OnWorkerStart = {})
+        : WorkerNode(std::move(WorkerNodes)), StartHook(std::move(OnWorkerStart))
+    {
+        if (WorkerCount < 0)
+            WorkerCount = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+        WorkerNode.resize(WorkerCount, 0);
+        int NodeTotal = 1;
+        for (int Node : WorkerNode)
+            NodeTotal = std::max(NodeTotal, Node + 1);
+        NodeWorkers.assign(NodeTotal, 0);
+        for (int Node : WorkerNode)
+            NodeWorkers[Node]++;
+        NodeQueued.reset(new std::atomic<int>[NodeTotal]);
+        for (int n = 0; n < NodeTotal; n++)
+            NodeQueued[n].store(0);
+
+        // One deque per worker, the injection queue for outside threads, then one queue per node
+        Queues.reserve(WorkerCount + 1 + NodeTotal);
+        for (int i = 0; i < WorkerCount + 1 + NodeTotal; i++)
+            Queues.emplace_back(new TaskQueue());
+
+        for (int i = 0; i < WorkerCount; i++)
+            Workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> Guard(SleepLock);
+            Quit = true;
+        }
+        WakeUp.notify_all();
+        for (std::thread& Worker : Workers)
+            Worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    int WorkerCount() const { return (int)Workers.size(); }
+    // Threads that run tasks while a graph is being waited on
+    int ThreadCount() const { return (int)Workers.size() + 1; }
+
+    // Index of the calling thread among this pool's workers, -1 for outside threads
+    int CurrentWorker() const { return CurrentPool() == this ? CurrentWorkerIndex() : -1; }
+
+    int NodeCount() const { return (int)NodeWorkers.size(); }
+    // NUMA node of the calling thread: the worker's node, or whatever an outside
+    // thread declared with SetCurrentThreadNode, -1 if unknown
+    int CurrentNode() const
+    {
+        int Worker = CurrentWorker();
+        return Worker >= 0 ? WorkerNode[Worker] : OutsideNode();
+    }
+    // For outside threads that pinned themselves, so they prefer their node's tasks
+    static void SetCurrentThreadNode(int Node) { OutsideNode() = Node; }
+
+    void Submit(Task* Item)
+    {
+        int Worker = CurrentWorker();
+        bool Tagged = Item->Node >= 0 && Item->Node < NodeCount();
+        if (Tagged)
+        {
+            Queues[NodeQueue(Item->Node)]->PushBack(Item);
+            NodeQueued[Item->Node].fetch_add(1);
+        }
+        else
+        {
+            Queues[Worker >= 0 ? Worker : (int)Workers.size()]->PushBack(Item);
+            Queued.fetch_add(1);
+        }
+        if (Sleepers.load() > 0)
+        {
+            // Taking the lock orders us after a sleeper's predicate check, so the wake isn't lost
+            { std::lock_guard<std::mutex> Guard(SleepLock); }
+            // A single wake could land on a worker from the wrong node
+            if (Tagged) WakeUp.notify_all();
+            else WakeUp.notify_one();
+        }
+    }
+
+    // Runs one queued task if there is any. Returns false if everything was empty.
+    bool RunOne()
+    {
+        Task* Item = FindTask(CurrentWorker());
+        if (!Item) return false;
+        Execute(Item);
+        return true;
+    }
+
+    // Helps out until Remaining hits zero
+    void WaitUntilZero(const std::atomic<int>& Remaining)
+    {
+        while (Remaining.load() > 0)
+        {
+            if (!RunOne())
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    static JobSystem*& CurrentPool() { static thread_local JobSystem* Pool = nullptr; return Pool; }
+    static int& CurrentWorkerIndex() { static thread_local int Index = -1; return Index; }
+    static int& OutsideNode() { static thread_local int Node = -1; return Node; }
+
+    int NodeQueue(int Node) const { return (int)Workers.size() + 1 + Node; }
+
+    Task* FindTask(int Worker)
+    {
+        Task* Item = nullptr;
+        int WorkerQueues = (int)Workers.size();
+        int Node = Worker >= 0 ? WorkerNode[Worker] : OutsideNode();
+
+        // Own work first, then our node's tasks, then the injection queue
+        if (Worker >= 0) Item = Queues[Worker]->PopBack();
+        if (!Item && Node >= 0 && Node < NodeCount()) Item = Queues[NodeQueue(Node)]->PopFront();
+        if (!Item) Item = Queues[WorkerQueues]->PopFront();
+
+        // Outside threads also cover nodes that have no workers, so tagged work
+        // can't get stranded
+        for (int n = 0; !Item && Worker < 0 && n < NodeCount(); n++)
+            if (n != Node && (Node < 0 || NodeWorkers[n] == 0))
+                Item = Queues[NodeQueue(n)]->PopFront();
+
+        // Then steal round-robin, same node first. Deques only ever hold untagged
+        // tasks, so taking from another node is always allowed.
+        int FirstVictim = Worker >= 0 ? Worker + 1 : 0;
+        for (int Pass = 0; Pass < 2 && !Item; Pass++)
+            for (int i = 0; !Item && i < WorkerQueues; i++)
+            {
+                int Victim = (FirstVictim + i) % WorkerQueues;
+                bool SameNode = WorkerNode[Victim] == Node;
+                if (Victim != Worker && SameNode == (Pass == 0))
+                    Item = Queues[Victim]->PopFront();
+            }
+
+        if (Item)
+        {
+            if (Item->Node >= 0 && Item->Node < NodeCount()) NodeQueued[Item->Node].fetch_sub(1);
+            else Queued.fetch_sub(1);
+        }
+        return Item;
+    }
+
+    void Execute(Task* Item);
+
+    void WorkerLoop(int Index)
+    {
+        CurrentPool() = this;
+        CurrentWorkerIndex() = Index;
+        if (StartHook)
+            StartHook(Index);
+
+        while (true)
+        {
+            if (RunOne())
+                continue;
+
+            std::unique_lock<std::mutex> Guard(SleepLock);
+            Sleepers.fetch_add(1);
+            int Node = WorkerNode[Index];
+            WakeUp.wait(Guard, [&] { return Quit || Queued.load() > 0 || NodeQueued[Node].load() > 0; });
+            Sleepers.fetch_sub(1);
+            if (Quit) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<TaskQueue>> Queues;
+    std::vector<std::thread> Workers;
+    std::vector<int> WorkerNode;    // node of each worker
+    std::vector<int> NodeWorkers;   // workers on each node
+    std::function<void(int)> StartHook;
+    std::atomic<int> Queued{ 0 };                    // untagged tasks
+    std::unique_ptr<std::atomic<int>[]> NodeQueued;  // tagged tasks per node
+    std::atomic<int> Sleepers{ 0 };
+    std::mutex SleepLock;
+    std::condition_variable WakeUp;
+    bool Quit = false;
+};
+
+// -------------------- Task Graph --------------------
+class TaskGraph
+{
+public:
+    // Drops all tasks but keeps the storage for the next build
+    void Reset(JobSystem& Jobs)
+    {
+        Pool = &Jobs;
+        TaskCount = 0;
+        Edges.clear();
+    }
+
+    // Makes room for Count tasks up front, for graphs that grow over many builds
+    void Reserve(int Count)
+    {
+        while ((int)Tasks.size() < Count)
+            Tasks.emplace_back(new Task());
+        SuccessorOffsets.reserve(Count + 1);
+        Fill.reserve(Count);
+    }
+
+    template <typename F>
+    TaskHandle Add(const char* Name, F&& Fn)
+    {
+        if (TaskCount == (int)Tasks.size())
+            Tasks.emplace_back(new Task());
+        Task& Item = *Tasks[TaskCount];
+        Item.Fn.Set(std::forward<F>(Fn));
+        Item.Graph = this;
+        Item.Name = Name;
+        Item.Node = -1;
+        Item.DependencyCount = 0;
+        return TaskCount++;
+    }
+
+    // Splits [0, Count) into chunks of ChunkSize and adds one Fn(Begin, End) task per chunk
+    template <typename F>
+    TaskRange AddChunks(const char* Name, int Count, int ChunkSize, const F& Fn)
+    {
+        return AddChunkRange(Name, 0, Count, ChunkSize, Fn);
+    }
+
+    // Same over [First, Last), every chunk pinned to Node (-1 for any)
+    template <typename F>
+    TaskRange AddChunkRange(const char* Name, int First, int Last, int ChunkSize, const F& Fn, int Node = -1)
+    {
+        TaskRange Range;
+        Range.First = TaskCount;
+        ChunkSize = std::max(1, ChunkSize);
+        for (int Begin = First; Begin < Last; Begin += ChunkSize)
+        {
+            int End = std::min(Last, Begin + ChunkSize);
+            SetNode(Add(Name, [Fn, Begin, End]() { Fn(Begin, End); }), Node);
+            Range.Count++;
+        }
+        return Range;
+    }
+
+    // Only threads on Node will run this task
+    void SetNode(TaskHandle Handle, int Node) { Tasks[Handle]->Node = Node; }
+
+    // After can't start until Before has finished
+    void Precede(TaskHandle Before, TaskHandle After) { Edges.push_back({ Before, After }); }
+    void Precede(TaskRange Before, TaskHandle After) { for (int i = 0; i < Before.Count; i++) Precede(Before.First + i, After); }
+    void Precede(TaskHandle Before, TaskRange After) { for (int i = 0; i < After.Count; i++) Precede(Before, After.First + i); }
+    // Chunk i of Before gates chunk i of After, nothing else
+    void PrecedeEach(TaskRange Before, TaskRange After)
+    {
+        for (int i = 0; i < std::min(Before.Count, After.Count); i++)
+            Precede(Before.First + i, After.First + i);
+    }
+
+    // Queues every task without dependencies and returns immediately
+    void Start()
+    {
+        // Flatten the edge list into per-task successor ranges
+        SuccessorOffsets.assign(TaskCount + 1, 0);
+        for (const Edge& Link : Edges)
+        {
+            SuccessorOffsets[Link.Before + 1]++;
+            Tasks[Link.After]->DependencyCount++;
+        }
+        for (int i = 0; i < TaskCount; i++)
+            SuccessorOffsets[i + 1] += SuccessorOffsets[i];
+        Successors.resize(Edges.size());
+        Fill.assign(SuccessorOffsets.begin(), SuccessorOffsets.end() - 1);
+        for (const Edge& Link : Edges)
+            Successors[Fill[Link.Before]++] = Tasks[Link.After].get();
+
+        for (int i = 0; i < TaskCount; i++)
+        {
+            Task& Item = *Tasks[i];
+            Item.FirstSuccessor = SuccessorOffsets[i];
+            Item.SuccessorCount = SuccessorOffsets[i + 1] - SuccessorOffsets[i];
+            Item.PendingDeps.store(Item.DependencyCount);
+        }
+
+        Remaining.store(TaskCount);
+        for (int i = 0; i < TaskCount; i++)
+            if (Tasks[i]->DependencyCount == 0)
+                Pool->Submit(Tasks[i].get());
+    }
+
+    // Runs tasks on the calling thread until the whole graph is done
+    void Wait() { Pool->WaitUntilZero(Remaining); }
+
+    void Run() { Start(); Wait(); }
+
+    int Size() const { return TaskCount; }
+
+private:
+    friend class JobSystem;
+    struct Edge { int Before, After; };
+
+    JobSystem* Pool = nullptr;
+    std::vector<std::unique_ptr<Task>> Tasks;
+    int TaskCount = 0;
+    std::vector<Edge> Edges;
+    std::vector<int> SuccessorOffsets;
+    std::vector<int> Fill;
+    std::vector<Task*> Successors;
+    std::atomic<int> Remaining{ 0 };
+};
+
+inline void JobSystem::Execute(Task* Item)
+{
+    Item->Fn();
+
+    // Release successors before counting ourselves done: once Remaining hits
+    // zero the waiter may reset the graph under us
+    TaskGraph* Graph = Item->Graph;
+    for (int i = 0; i < Item->SuccessorCount; i++)
+    {
+        Task* Next = Graph->Successors[Item->FirstSuccessor + i];
+        if (Next->PendingDeps.fetch_sub(1) == 1)
+            Submit(Next);
+    }
+    Graph->Remaining.fetch_sub(1);
+}
+
+// Convenience for one-off data-parallel loops: Fn(Begin, End) over [0, Count)
+template <typename F>
+inline void ParallelFor(JobSystem* Jobs, TaskGraph& Graph, int Count, int ChunkSize, const F& Fn)
+{
+    if (!Jobs || Count <= ChunkSize)
+    {
+        Fn(0, Count);
+        return;
+    }
+    Graph.Reset(*Jobs);
+    Graph.AddChunks("ParallelFor", Count, ChunkSize, Fn);
+    Graph.Run();
+}
@@ -0,0 +1,326 @@
+#pragma once
+// -------------------- NUMA --------------------
+// Topology, thread pinning and first-touch placement for multi-socket machines.
+//
+// The OS puts a page on the node of the thread that first writes to it. So
+// particle storage is allocated untouched, and each node's slice gets its
+// first write from a worker pinned to that node. After that the step graph
+// hands the slice's chunks back to the same node (see the node queues in
+// JobSystem.h), so the hot loops stream local memory instead of pulling it
+// across the interconnect.
+//
+// On a single node, or when the topology can't be read, all of this
+// collapses to one node. A one-node placement still hands out page-backed
+// blocks, which is how particle storage gets huge pages without NUMA.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include "HugePages.h"
+#include "JobSystem.h"
+
+const int NumaMaxNodes = 8;
+
+struct NumaTopology
+{
+    std::vector<std::vector<int>> NodeCpus;   // CPUs of every node that has any
+    std::vector<int> OsNode;                  // OS node id behind each entry, for page queries
+    bool Emulated = false;
+
+    int NodeCount() const { return (int)NodeCpus.size(); }
+};
+
+// "0-3,8-11" -> { 0, 1, 2, 3, 8, 9, 10, 11 }
+inline std::vector<int> ParseCpuList(const std::string& List)
+{
+    std::vector<int> Cpus;
+    std::stringstream Parts(List);
+    std::string Part;
+    while (std::getline(Parts, Part, ','))
+    {
+        int First = 0, Last = 0;
+        char Dash = 0;
+        std::stringstream Range(Part);
+        if (!(Range >> First)) continue;
+        Last = First;
+        if (Range >> Dash >> Last && Dash != '-') Last = First;
+        for (int Cpu = First; Cpu <= Last; Cpu++)
+            Cpus.push_back(Cpu);
+    }
+    return Cpus;
+}
+
+// EmulateNodes > 1 splits the CPUs into that many fake nodes when the machine
+// has fewer, to exercise the partitioning on a single-socket box
+inline NumaTopology DetectNumaTopology(int EmulateNodes = 0)
+{
+    NumaTopology Topology;
+#if defined(__linux__)
+    for (int Node = 0; Node < 1024 && Topology.NodeCount() < NumaMaxNodes; Node++)
+    {
+        std::ifstream File("/sys/devices/system/node/node" + std::to_string(Node) + "/cpulist");
+        if (!File)
+        {
+            if (Node > 0 && Topology.NodeCount() > 0) break;
+            continue;
+        }
+        std::string List;
+        std::getline(File, List);
+        std::vector<int> Cpus = ParseCpuList(List);
+        if (Cpus.empty()) continue;     // memory-only node
+        Topology.NodeCpus.push_back(Cpus);
+        Topology.OsNode.push_back(Node);
+    }
+#elif defined(_WIN32)
+    ULONG Highest = 0;
+    if (GetNumaHighestNodeNumber(&Highest))
+        for (ULONG Node = 0; Node <= Highest && Topology.NodeCount() < NumaMaxNodes; Node++)
+        {
+            ULONGLONG Mask = 0;
+            if (!GetNumaNodeProcessorMask((UCHAR)Node, &Mask) || !Mask) continue;
+            std::vector<int> Cpus;
+            for (int Cpu = 0; Cpu < 64; Cpu++)
+                if (Mask & (1ull << Cpu)) Cpus.push_back(Cpu);
+            Topology.NodeCpus.push_back(Cpus);
+            Topology.OsNode.push_back((int)Node);
+        }
+#endif
+
+    if (Topology.NodeCpus.empty())
+    {
+        std::vector<int> Cpus;
+        for (int Cpu = 0; Cpu < (int)std::max(1u, std::thread::hardware_concurrency()); Cpu++)
+            Cpus.push_back(Cpu);
+        Topology.NodeCpus.push_back(Cpus);
+        Topology.OsNode.push_back(0);
+    }
+
+    EmulateNodes = std::min(EmulateNodes, NumaMaxNodes);
+    if (EmulateNodes > Topology.NodeCount())
+    {
+        std::vector<int> Cpus;
+        for (const std::vector<int>& Node : Topology.NodeCpus)
+            Cpus.insert(Cpus.end(), Node.begin(), Node.end());
+        Topology.NodeCpus.assign(EmulateNodes, {});
+        Topology.OsNode.assign(EmulateNodes, 0);
+        for (int n = 0; n < EmulateNodes; n++)
+        {
+            // Every fake node gets at least one CPU, even if that means sharing
+            size_t First = Cpus.size() * n / EmulateNodes;
+            size_t Last = std::max(First + 1, Cpus.size() * (n + 1) / EmulateNodes);
+            for (size_t i = First; i < Last; i++)
+                Topology.NodeCpus[n].push_back(Cpus[i % Cpus.size()]);
+        }
+        Topology.Emulated = true;
+    }
+    return Topology;
+}
+
+// One node with CPU 0, for a placement that's only there for its page mode
+inline NumaTopology SingleNodeTopology()
+{
+    NumaTopology Topology;
+    Topology.NodeCpus.push_back({ 0 });
+    Topology.OsNode.push_back(0);
+    return Topology;
+}
+
+// Restricts the calling thread to Cpus. Returns false where that isn't supported.
+inline bool PinCurrentThread(const std::vector<int>& Cpus)
+{
+#if defined(__linux__)
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    for (int Cpu : Cpus)
+        if (Cpu >= 0 && Cpu < CPU_SETSIZE) CPU_SET(Cpu, &Set);
+    return sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR Mask = 0;
+    for (int Cpu : Cpus)
+        if (Cpu >= 0 && Cpu < (int)(sizeof(DWORD_PTR) * 8)) Mask |= (DWORD_PTR)1 << Cpu;
+    return Mask && SetThreadAffinityMask(GetCurrentThread(), Mask) != 0;
+#else
+    (void)Cpus;
+    return false;
+#endif
+}
+
+// Spreads WorkerCount workers over the nodes in proportion to their CPUs, and
+// leaves a CPU on node 0 for the calling thread, which helps out while it waits
+inline std::vector<int> AssignWorkerNodes(const NumaTopology& Topology, int WorkerCount)
+{
+    std::vector<int> Slots;
+    size_t Longest = 0;
+    for (const std::vector<int>& Cpus : Topology.NodeCpus)
+        Longest = std::max(Longest, Cpus.size());
+    // Round-robin over the nodes' CPU lists, skipping the caller's slot
+    for (size_t i = 0; i < Longest; i++)
+        for (int n = 0; n < Topology.NodeCount(); n++)
+            if (i < Topology.NodeCpus[n].size() && !(n == 0 && i == 0))
+                Slots.push_back(n);
+
+    std::vector<int> WorkerNodes(WorkerCount, 0);
+    for (int i = 0; i < WorkerCount; i++)
+        WorkerNodes[i] = Slots.empty() ? 0 : Slots[i % Slots.size()];
+    return WorkerNodes;
+}
+
+// -------------------- Untouched Pages --------------------
+inline size_t NumaPageSize()
+{
+#if defined(__linux__)
+    return (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+}
+
+// Page-aligned, zeroed and not yet backed, so whoever writes first decides
+// the node. Big blocks can ask for huge pages, see HugePages.h.
+inline void* NumaReserve(size_t Bytes, HugePageModes HugePages = HugePagesOff)
+{
+    return ReserveLarge(Bytes, HugePages);
+}
+
+inline void NumaRelease(void* Data, size_t Bytes)
+{
+    ReleaseLarge(Data, Bytes);
+}
+
+// OS node of every page in [Data, Data + Bytes), negative where the page isn't
+// resident. Returns false where the query isn't supported.
+inline bool QueryPageNodes(const void* Data, size_t Bytes, std::vector<int>& Nodes)
+{
+    Nodes.clear();
+#if defined(__linux__) && defined(SYS_move_pages)
+    size_t Page = NumaPageSize();
+    uintptr_t First = (uintptr_t)Data & ~(uintptr_t)(Page - 1);
+    uintptr_t Last = (uintptr_t)Data + Bytes;
+    std::vector<void*> Pages;
+    for (uintptr_t Address = First; Address < Last; Address += Page)
+        Pages.push_back((void*)Address);
+    Nodes.assign(Pages.size(), -1);
+    // move_pages with no target nodes only reports where each page lives
+    return Pages.empty() || syscall(SYS_move_pages, 0, (unsigned long)Pages.size(), Pages.data(), nullptr, Nodes.data(), 0) == 0;
+#else
+    (void)Data; (void)Bytes;
+    return false;
+#endif
+}
+
+// -------------------- Placement --------------------
+// Splits element arrays into one contiguous slice per node and first-touches
+// each slice from that node. Needs the job system that owns the pinned workers.
+class NumaPlacement
+{
+public:
+    NumaPlacement(const NumaTopology& Layout, JobSystem* Pool, HugePageModes PageMode = HugePagesOff)
+        : Topology(Layout), Jobs(Pool), HugePages(PageMode) {}
+
+    int NodeCount() const { return Topology.NodeCount(); }
+    const NumaTopology& Layout() const { return Topology; }
+    // Without more than one node (and threads to touch with) there's nothing to place
+    bool Active() const { return Jobs && NodeCount() > 1; }
+    // Pages the allocator asks for. A one-node placement is just huge pages.
+    HugePageModes PageMode() const { return HugePages; }
+
+    // Node n owns elements [SliceBegin(Count, n), SliceBegin(Count, n + 1))
+    int SliceBegin(int Count, int Node) const { return (int)((long long)Count * Node / NodeCount()); }
+    int NodeOf(int Count, int Index) const
+    {
+        int Node = (int)((long long)Index * NodeCount() / std::max(1, Count));
+        while (Node + 1 < NodeCount() && Index >= SliceBegin(Count, Node + 1)) Node++;
+        while (Node > 0 && Index < SliceBegin(Count, Node)) Node--;
+        return Node;
+    }
+
+    // Writes every page of a fresh NumaReserve block from the node that owns the
+    // elements on it. Called by the allocator, so storage is placed before the
+    // container constructs anything in it.
+    void FirstTouch(void* Data, size_t Bytes, size_t ElementSize)
+    {
+        if (!Active() || Bytes == 0) return;
+        int Count = (int)(Bytes / ElementSize);
+        size_t Page = NumaPageSize();
+        unsigned char* Base = static_cast<unsigned char*>(Data);
+
+        // A page goes to the node owning the element its first byte belongs to
+        TouchGraph.Reset(*Jobs);
+        for (int n = 0; n < NodeCount(); n++)
+        {
+            size_t Begin = (size_t)SliceBegin(Count, n) * ElementSize;
+            size_t End = n + 1 == NodeCount() ? Bytes : (size_t)SliceBegin(Count, n + 1) * ElementSize;
+            Begin = (Begin + Page - 1) / Page * Page;
+            if (n == 0) Begin = 0;
+            TaskHandle Touch = TouchGraph.Add("FirstTouch", [Base, Begin, End, Page]() {
+                for (size_t Offset = Begin; Offset < End; Offset += Page)
+                    *(volatile unsigned char*)(Base + Offset) = 0;
+            });
+            TouchGraph.SetNode(Touch, n);
+        }
+        TouchGraph.Run();
+    }
+
+private:
+    NumaTopology Topology;
+    JobSystem* Jobs;
+    HugePageModes HugePages;
+    TaskGraph TouchGraph;
+};
+
+// std::allocator stand-in that places its blocks with a NumaPlacement. Without
+// one it's plain operator new. Moving a container moves its placement along,
+// so a container can be rebound by assigning it a fresh, empty one.
+template <typename T>
+struct NumaAllocator
+{
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    NumaPlacement* Placement = nullptr;
+
+    NumaAllocator() = default;
+    explicit NumaAllocator(NumaPlacement* Target) : Placement(Target) {}
+    template <typename U>
+    NumaAllocator(const NumaAllocator<U>& Other) : Placement(Other.Placement) {}
+
+    T* allocate(size_t Count)
+    {
+        size_t Bytes = Count * sizeof(T);
+        if (!Placement)
+            return static_cast<T*>(::operator new(Bytes));
+        void* Data = NumaReserve(Bytes, Placement->PageMode());
+        if (!Data) throw std::bad_alloc();
+        Placement->FirstTouch(Data, Bytes, sizeof(T));
+        return static_cast<T*>(Data);
+    }
+
+    // Doesn't look at the placement, which may already be gone at exit
+    void deallocate(T* Data, size_t Count)
+    {
+        if (!Placement)
+            ::operator delete(Data);
+        else
+            NumaRelease(Data, Count * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const NumaAllocator<T>& a, const NumaAllocator<U>& b) { return a.Placement == b.Placement; }
+template <typename T, typename U>
+bool operator!=(const NumaAllocator<T>& a, const NumaAllocator<U>& b) { return a.Placement != b.Placement; }
@@ -0,0 +1,104 @@
+#pragma once
+// -------------------- Precision --------------------
+// Scalar policies for the particle kernels. A policy names the type particle
+// state is stored in and the type the kernels compute in:
+//
+//   FloatPolicy   float storage,  float math     8 bytes per position pair
+//   DoublePolicy  double storage, double math   16 bytes per position pair
+//   HalfPolicy    half storage,   float math     4 bytes per position pair
+//
+// The kernels are templated on the policy, so every policy gets its own
+// instantiation with no per-value branches. Halves go through Quantize.h.
+// Near the right edge of a 1400 px window a half only resolves whole
+// pixels, so a slow wind can't move a particle at all there. Finding
+// limits like that is what the half policy is for.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+#include "Quantize.h"
+
+enum PrecisionModes
+{
+    SinglePrecision,
+    DoublePrecision,
+    HalfStoragePrecision
+};
+const char* const PrecisionModeNames[] = { "float", "double", "half" };
+
+struct FloatPolicy
+{
+    typedef float Storage;
+    typedef float Real;
+    static Real Load(Storage Value) { return Value; }
+    static Storage Store(Real Value) { return Value; }
+};
+
+struct DoublePolicy
+{
+    typedef double Storage;
+    typedef double Real;
+    static Real Load(Storage Value) { return Value; }
+    static Storage Store(Real Value) { return Value; }
+};
+
+struct HalfPolicy
+{
+    typedef uint16_t Storage;
+    typedef float Real;
+    static Real Load(Storage Value) { return HalfToFloat(Value); }
+    static Storage Store(Real Value) { return FloatToHalf(Value); }
+};
+
+// Positions and velocities of every particle, one array per field
+template <typename Policy>
+struct PrecisionStore
+{
+    typedef typename Policy::Storage Storage;
+    std::vector<Storage> X, Y, VelocityX, VelocityY;
+
+    size_t Size() const { return X.size(); }
+
+    void Resize(size_t Count)
+    {
+        X.resize(Count);
+        Y.resize(Count);
+        VelocityX.resize(Count);
+        VelocityY.resize(Count);
+    }
+
+    void CopyRange(const PrecisionStore& From, size_t Begin, size_t End)
+    {
+        for (std::vector<Storage> PrecisionStore::* Field : { &PrecisionStore::X, &PrecisionStore::Y, &PrecisionStore::VelocityX, &PrecisionStore::VelocityY })
+            std::copy((From.*Field).begin() + Begin, (From.*Field).begin() + End, (this->*Field).begin() + Begin);
+    }
+
+    // Element i becomes old element Order[i]
+    void Permute(const std::vector<uint32_t>& Order, PrecisionStore& Scratch)
+    {
+        Scratch.Resize(Size());
+        for (size_t i = 0; i < Order.size(); i++)
+        {
+            Scratch.X[i] = X[Order[i]];
+            Scratch.Y[i] = Y[Order[i]];
+            Scratch.VelocityX[i] = VelocityX[Order[i]];
+            Scratch.VelocityY[i] = VelocityY[Order[i]];
+        }
+        X.swap(Scratch.X);
+        Y.swap(Scratch.Y);
+        VelocityX.swap(Scratch.VelocityX);
+        VelocityY.swap(Scratch.VelocityY);
+    }
+
+    static size_t BytesPerParticle() { return 4 * sizeof(Storage); }
+};
+
+// What a context keeps per policy: the live store, the collision snapshot,
+// and the Morton sort count the live store was last put in order for
+template <typename Policy>
+struct PrecisionState
+{
+    PrecisionStore<Policy> Live, Snapshot;
+    long long Sorts = 0;
+};
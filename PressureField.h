@@ -0,0 +1,298 @@
+#pragma once
+// -------------------- Pressure Field --------------------
+// A 2D pressure map from a file, kept only as its gradient. The file is read
+// one row at a time through a three-row window, and each row's central
+// differences are written into the gradient grid as soon as the row below it
+// has arrived. The map itself is never in memory, so a map as large as the
+// gradient grid can take is fine.
+//
+//   PGM  binary P5, 8 or 16 bit, scaled so maxval is Range
+//   PFM  grayscale Pf, either byte order, values times Range
+//   raw  32-bit floats in host order, top row first, size given by the caller
+//
+// The map is stretched over the screen. Row 0 of the grid is the bottom of
+// the screen, so images (stored top row first) come in flipped and PFMs
+// (bottom row first) don't. Gradients come out in pressure per screen pixel.
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PRESSURE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// (dPdx, dPdy) per cell, interleaved so a lookup touches one cache line per
+// row. Rows start on a cache line.
+class PressureGradient
+{
+public:
+    int Width = 0, Height = 0;
+    int Pitch = 0;                  // floats per row, a multiple of 16
+    float CellWidth = 1.0f;         // screen pixels per cell
+    float CellHeight = 1.0f;
+
+    PressureGradient() = default;
+    PressureGradient(const PressureGradient&) = delete;
+    PressureGradient& operator=(const PressureGradient&) = delete;
+    PressureGradient(PressureGradient&& Other) noexcept { *this = std::move(Other); }
+    PressureGradient& operator=(PressureGradient&& Other) noexcept
+    {
+        std::swap(Width, Other.Width);
+        std::swap(Height, Other.Height);
+        std::swap(Pitch, Other.Pitch);
+        std::swap(CellWidth, Other.CellWidth);
+        std::swap(CellHeight, Other.CellHeight);
+        std::swap(Cells, Other.Cells);
+        return *this;
+    }
+    ~PressureGradient() { Release(); }
+
+    bool Allocate(int NewWidth, int NewHeight)
+    {
+        Release();
+        Pitch = (2 * NewWidth + 15) & ~15;
+        Cells = static_cast<float*>(::operator new((size_t)Pitch * NewHeight * sizeof(float), std::align_val_t(64), std::nothrow));
+        if (!Cells) return false;
+        Width = NewWidth;
+        Height = NewHeight;
+        return true;
+    }
+
+    bool Empty() const { return !Cells; }
+    float* Row(int y) { return Cells + (size_t)y * Pitch; }
+    const float* Row(int y) const { return Cells + (size_t)y * Pitch; }
+    size_t Bytes() const { return (size_t)Pitch * Height * sizeof(float); }
+
+private:
+    void Release()
+    {
+        if (Cells) ::operator delete(Cells, std::align_val_t(64));
+        Cells = nullptr;
+        Width = Height = Pitch = 0;
+    }
+
+    float* Cells = nullptr;
+};
+
+// One row of central differences into Out as (dPdx, dPdy) pairs. Up and Down
+// are the rows above and below on screen. Columns past the ends clamp to the
+// edge, so edge cells get half a one-sided difference.
+inline void CentralDifferenceRow(const float* Up, const float* Row, const float* Down, int Width, float InvTwoDx, float InvTwoDy, float* Out)
+{
+    auto Cell = [&](int x) {
+        float Left = Row[x > 0 ? x - 1 : 0];
+        float Right = Row[x + 1 < Width ? x + 1 : Width - 1];
+        Out[2 * x] = (Right - Left) * InvTwoDx;
+        Out[2 * x + 1] = (Up[x] - Down[x]) * InvTwoDy;
+    };
+    if (Width <= 0) return;
+    Cell(0);
+    int x = 1;
+#ifdef PRESSURE_SSE2
+    const __m128 Dx = _mm_set1_ps(InvTwoDx);
+    const __m128 Dy = _mm_set1_ps(InvTwoDy);
+    for (; x + 5 <= Width; x += 4)
+    {
+        __m128 Gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(Row + x + 1), _mm_loadu_ps(Row + x - 1)), Dx);
+        __m128 Gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(Up + x), _mm_loadu_ps(Down + x)), Dy);
+        _mm_storeu_ps(Out + 2 * x, _mm_unpacklo_ps(Gx, Gy));
+        _mm_storeu_ps(Out + 2 * x + 4, _mm_unpackhi_ps(Gx, Gy));
+    }
+#endif
+    for (; x < Width; x++)
+        Cell(x);
+}
+
+// Bilinear between cell centres, clamped to the edge cells. X and Y in screen pixels.
+inline void SamplePressureGradient(const PressureGradient& Field, float X, float Y, float& dPdx, float& dPdy)
+{
+    float fx = X / Field.CellWidth - 0.5f;
+    float fy = Y / Field.CellHeight - 0.5f;
+    fx = std::min(std::max(fx, 0.0f), (float)(Field.Width - 1));
+    fy = std::min(std::max(fy, 0.0f), (float)(Field.Height - 1));
+    int x0 = (int)fx, y0 = (int)fy;
+    int x1 = std::min(x0 + 1, Field.Width - 1), y1 = std::min(y0 + 1, Field.Height - 1);
+    float tx = fx - x0, ty = fy - y0;
+    const float* Low = Field.Row(y0);
+    const float* High = Field.Row(y1);
+    float BottomX = Low[2 * x0] + (Low[2 * x1] - Low[2 * x0]) * tx;
+    float BottomY = Low[2 * x0 + 1] + (Low[2 * x1 + 1] - Low[2 * x0 + 1]) * tx;
+    float TopX = High[2 * x0] + (High[2 * x1] - High[2 * x0]) * tx;
+    float TopY = High[2 * x0 + 1] + (High[2 * x1 + 1] - High[2 * x0 + 1]) * tx;
+    dPdx = BottomX + (TopX - BottomX) * ty;
+    dPdy = BottomY + (TopY - BottomY) * ty;
+}
+
+// Header token, skipping whitespace and # comments
+inline bool ReadPnmToken(std::istream& In, std::string& Token)
+{
+    Token.clear();
+    int c = In.get();
+    while (c != EOF && (std::isspace(c) || c == '#'))
+    {
+        if (c == '#')
+            while (c != EOF && c != '\n') c = In.get();
+        c = In.get();
+    }
+    while (c != EOF && !std::isspace(c))
+    {
+        Token += (char)c;
+        c = In.get();
+    }
+    // The one whitespace after the last header token is gone too, binary data starts here
+    return !Token.empty();
+}
+
+// Reads Path into Out. ScreenWidth x ScreenHeight is what the map gets
+// stretched over. RawWidth and RawHeight are only used for raw files.
+// On failure Error says why and Out is left empty.
+inline bool LoadPressureGradient(const std::string& Path, int RawWidth, int RawHeight, float Range, float ScreenWidth, float ScreenHeight,
+    PressureGradient& Out, std::string& Error)
+{
+    std::ifstream In(Path, std::ios::binary);
+    if (!In)
+    {
+        Error = "can't open " + Path;
+        return false;
+    }
+
+    const uint16_t Probe = 1;
+    unsigned char HostLittle;
+    std::memcpy(&HostLittle, &Probe, 1);
+
+    enum { Gray8, Gray16, FloatLittle, FloatBig } Sample;
+    int Width = 0, Height = 0;
+    float Scale = Range;
+    bool TopDown = true;
+    char Magic[2] = {};
+    In.read(Magic, 2);
+    if (In && Magic[0] == 'P' && (Magic[1] == '5' || Magic[1] == 'f'))
+    {
+        std::string W, H, Last;
+        if (!ReadPnmToken(In, W) || !ReadPnmToken(In, H) || !ReadPnmToken(In, Last))
+        {
+            Error = "truncated header in " + Path;
+            return false;
+        }
+        Width = std::atoi(W.c_str());
+        Height = std::atoi(H.c_str());
+        if (Magic[1] == '5')
+        {
+            int Max = std::atoi(Last.c_str());
+            if (Max <= 0 || Max > 65535)
+            {
+                Error = "bad maxval in " + Path;
+                return false;
+            }
+            Sample = Max < 256 ? Gray8 : Gray16;
+            Scale = Range / Max;
+        }
+        else
+        {
+            // The sign of the scale is the byte order, PFM rows go bottom up
+            Sample = std::atof(Last.c_str()) < 0 ? FloatLittle : FloatBig;
+            TopDown = false;
+        }
+    }
+    else
+    {
+        In.clear();
+        In.seekg(0);
+        Width = RawWidth;
+        Height = RawHeight;
+        Sample = HostLittle ? FloatLittle : FloatBig;
+        if (Width <= 0 || Height <= 0)
+        {
+            Error = Path + " isn't a PGM or PFM, and raw floats need a size";
+            return false;
+        }
+    }
+    if (Width <= 0 || Height <= 0)
+    {
+        Error = "bad size in " + Path;
+        return false;
+    }
+    if (!Out.Allocate(Width, Height))
+    {
+        Error = "no memory for a " + std::to_string(Width) + " x " + std::to_string(Height) + " gradient";
+        return false;
+    }
+    Out.CellWidth = ScreenWidth / Width;
+    Out.CellHeight = ScreenHeight / Height;
+
+    size_t SampleBytes = Sample == Gray8 ? 1 : Sample == Gray16 ? 2 : 4;
+    std::vector<unsigned char> Bytes((size_t)Width * SampleBytes);
+    bool Swap = (Sample == FloatLittle && !HostLittle) || (Sample == FloatBig && HostLittle);
+    auto ReadRow = [&](float* Row) {
+        if (!In.read((char*)Bytes.data(), (std::streamsize)Bytes.size()))
+            return false;
+        const unsigned char* p = Bytes.data();
+        for (int x = 0; x < Width; x++, p += SampleBytes)
+        {
+            if (Sample == Gray8)
+                Row[x] = p[0] * Scale;
+            else if (Sample == Gray16)
+                Row[x] = (float)((p[0] << 8) | p[1]) * Scale;   // PGM is big endian
+            else
+            {
+                unsigned char Word[4] = { p[0], p[1], p[2], p[3] };
+                if (Swap)
+                {
+                    std::swap(Word[0], Word[3]);
+                    std::swap(Word[1], Word[2]);
+                }
+                float Value;
+                std::memcpy(&Value, Word, 4);
+                Row[x] = Value * Scale;
+            }
+        }
+        return true;
+    };
+
+    // File rows r - 1, r and r + 1, clamped at the first and last row
+    std::vector<float> Window[3];
+    for (std::vector<float>& Row : Window)
+        Row.resize(Width);
+    float* Before = Window[0].data();
+    float* Current = Window[1].data();
+    float* After = Window[2].data();
+    if (!ReadRow(Current))
+    {
+        Out = PressureGradient();
+        Error = Path + " ends early";
+        return false;
+    }
+    std::copy(Current, Current + Width, Before);
+    float InvTwoDx = 0.5f / Out.CellWidth;
+    float InvTwoDy = 0.5f / Out.CellHeight;
+    for (int r = 0; r < Height; r++)
+    {
+        if (r + 1 < Height)
+        {
+            if (!ReadRow(After))
+            {
+                Out = PressureGradient();
+                Error = Path + " ends early";
+                return false;
+            }
+        }
+        else
+            std::copy(Current, Current + Width, After);
+
+        int Screen = TopDown ? Height - 1 - r : r;
+        const float* Up = TopDown ? Before : After;
+        const float* Down = TopDown ? After : Before;
+        CentralDifferenceRow(Up, Current, Down, Width, InvTwoDx, InvTwoDy, Out.Row(Screen));
+        std::swap(Before, Current);
+        std::swap(Current, After);
+    }
+    return true;
+}
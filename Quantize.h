@@ -0,0 +1,197 @@
+#pragma once
+// -------------------- Quantize --------------------
+// Float <-> 16-bit conversion kernels for compact particle storage: unsigned
+// fixed point over a known range, and IEEE half precision.
+//
+// The float side is strided so the kernels can read and write fields of an
+// array of structs directly (Stride in floats, 1 for a plain array). Both run
+// four values per SSE2 iteration. Halves use F16C when the CPU has it, checked
+// once at runtime so the binary still runs on machines without it. Everything
+// has a scalar path for other targets and for the tail.
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUANTIZE_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define QUANTIZE_F16C
+#else
+#define QUANTIZE_F16C __attribute__((target("f16c")))
+#endif
+#endif
+
+// Round to nearest even, overflow goes to infinity, NaN stays NaN
+inline uint16_t FloatToHalf(float Value)
+{
+    uint32_t Bits;
+    std::memcpy(&Bits, &Value, sizeof(Bits));
+    uint32_t Sign = (Bits >> 16) & 0x8000;
+    uint32_t Magnitude = Bits & 0x7FFFFFFF;
+
+    if (Magnitude >= 0x7F800000)   // inf or NaN
+        return (uint16_t)(Sign | 0x7C00 | (Magnitude > 0x7F800000 ? 0x200 : 0));
+    if (Magnitude >= 0x477FF000)   // rounds past the largest half
+        return (uint16_t)(Sign | 0x7C00);
+    if (Magnitude < 0x38800000)    // subnormal half, or zero
+    {
+        if (Magnitude < 0x33000000) return (uint16_t)Sign;
+        uint32_t Mantissa = (Magnitude & 0x007FFFFF) | 0x00800000;
+        int Shift = 126 - (int)(Magnitude >> 23);   // 14..24, in units of the smallest half
+        uint32_t Half = Mantissa >> Shift;
+        uint32_t Rest = Mantissa & ((1u << Shift) - 1);
+        uint32_t Midpoint = 1u << (Shift - 1);
+        if (Rest > Midpoint || (Rest == Midpoint && (Half & 1))) Half++;
+        return (uint16_t)(Sign | Half);
+    }
+    uint32_t Half = ((Magnitude - 0x38000000) >> 13);
+    uint32_t Rest = Magnitude & 0x1FFF;
+    if (Rest > 0x1000 || (Rest == 0x1000 && (Half & 1))) Half++;
+    return (uint16_t)(Sign | Half);
+}
+
+inline float HalfToFloat(uint16_t Half)
+{
+    uint32_t Sign = (uint32_t)(Half & 0x8000) << 16;
+    uint32_t Exponent = (Half >> 10) & 0x1F;
+    uint32_t Mantissa = Half & 0x3FF;
+    uint32_t Bits;
+    if (Exponent == 0x1F)
+        Bits = Sign | 0x7F800000 | (Mantissa << 13);
+    else if (Exponent != 0)
+        Bits = Sign | ((Exponent + 112) << 23) | (Mantissa << 13);
+    else if (Mantissa == 0)
+        Bits = Sign;
+    else
+    {
+        float Value = std::ldexp((float)Mantissa, -24);
+        std::memcpy(&Bits, &Value, sizeof(Bits));
+        Bits |= Sign;
+    }
+    float Value;
+    std::memcpy(&Value, &Bits, sizeof(Value));
+    return Value;
+}
+
+inline bool CpuHasF16C()
+{
+#if defined(QUANTIZE_SSE2) && defined(_MSC_VER) && !defined(__clang__)
+    int Info[4];
+    __cpuid(Info, 1);
+    static const bool Has = (Info[2] & (1 << 29)) != 0;
+    return Has;
+#elif defined(QUANTIZE_SSE2)
+    static const bool Has = __builtin_cpu_supports("f16c");
+    return Has;
+#else
+    return false;
+#endif
+}
+
+#ifdef QUANTIZE_SSE2
+QUANTIZE_F16C inline void FloatsToHalvesF16C(const float* In, size_t Stride, uint16_t* Out, size_t Count)
+{
+    size_t i = 0;
+    for (; i + 4 <= Count; i += 4)
+    {
+        const float* p = In + i * Stride;
+        __m128 Values = _mm_set_ps(p[3 * Stride], p[2 * Stride], p[Stride], p[0]);
+        _mm_storel_epi64((__m128i*)(Out + i), _mm_cvtps_ph(Values, _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < Count; i++)
+        Out[i] = FloatToHalf(In[i * Stride]);
+}
+
+QUANTIZE_F16C inline void HalvesToFloatsF16C(const uint16_t* In, float* Out, size_t Stride, size_t Count)
+{
+    size_t i = 0;
+    alignas(16) float Lanes[4];
+    for (; i + 4 <= Count; i += 4)
+    {
+        _mm_store_ps(Lanes, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(In + i))));
+        float* p = Out + i * Stride;
+        p[0] = Lanes[0]; p[Stride] = Lanes[1]; p[2 * Stride] = Lanes[2]; p[3 * Stride] = Lanes[3];
+    }
+    for (; i < Count; i++)
+        Out[i * Stride] = HalfToFloat(In[i]);
+}
+#endif
+
+inline void FloatsToHalves(const float* In, size_t Stride, uint16_t* Out, size_t Count)
+{
+#ifdef QUANTIZE_SSE2
+    if (CpuHasF16C())
+    {
+        FloatsToHalvesF16C(In, Stride, Out, Count);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < Count; i++)
+        Out[i] = FloatToHalf(In[i * Stride]);
+}
+
+inline void HalvesToFloats(const uint16_t* In, float* Out, size_t Stride, size_t Count)
+{
+#ifdef QUANTIZE_SSE2
+    if (CpuHasF16C())
+    {
+        HalvesToFloatsF16C(In, Out, Stride, Count);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < Count; i++)
+        Out[i * Stride] = HalfToFloat(In[i]);
+}
+
+// Value -> round((Value - Origin) / Step), clamped to [0, 65535]
+inline void QuantizeFixed16(const float* In, size_t Stride, uint16_t* Out, size_t Count, float Origin, float Step)
+{
+    float InvStep = 1.0f / Step;
+    size_t i = 0;
+#ifdef QUANTIZE_SSE2
+    const __m128 VOrigin = _mm_set1_ps(Origin);
+    const __m128 VInvStep = _mm_set1_ps(InvStep);
+    const __m128 VHalf = _mm_set1_ps(0.5f);
+    const __m128 VMax = _mm_set1_ps(65535.0f);
+    const __m128i VBias = _mm_set1_epi32(32768);
+    const __m128i VFlip = _mm_set1_epi16((short)0x8000);
+    for (; i + 4 <= Count; i += 4)
+    {
+        const float* p = In + i * Stride;
+        __m128 Values = _mm_set_ps(p[3 * Stride], p[2 * Stride], p[Stride], p[0]);
+        Values = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(Values, VOrigin), VInvStep), VHalf);
+        Values = _mm_min_ps(_mm_max_ps(Values, _mm_setzero_ps()), VMax);
+        // SSE2 only packs signed, so shift into int16 range and flip the sign bit back
+        __m128i Ints = _mm_sub_epi32(_mm_cvttps_epi32(Values), VBias);
+        _mm_storel_epi64((__m128i*)(Out + i), _mm_xor_si128(_mm_packs_epi32(Ints, Ints), VFlip));
+    }
+#endif
+    for (; i < Count; i++)
+    {
+        float Value = (In[i * Stride] - Origin) * InvStep + 0.5f;
+        Value = Value < 0.0f ? 0.0f : (Value > 65535.0f ? 65535.0f : Value);
+        Out[i] = (uint16_t)Value;
+    }
+}
+
+// Code -> Origin + Code * Step
+inline void DequantizeFixed16(const uint16_t* In, float* Out, size_t Stride, size_t Count, float Origin, float Step)
+{
+    size_t i = 0;
+#ifdef QUANTIZE_SSE2
+    const __m128 VOrigin = _mm_set1_ps(Origin);
+    const __m128 VStep = _mm_set1_ps(Step);
+    alignas(16) float Lanes[4];
+    for (; i + 4 <= Count; i += 4)
+    {
+        __m128i Codes = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(In + i)), _mm_setzero_si128());
+        _mm_store_ps(Lanes, _mm_add_ps(VOrigin, _mm_mul_ps(_mm_cvtepi32_ps(Codes), VStep)));
+        float* p = Out + i * Stride;
+        p[0] = Lanes[0]; p[Stride] = Lanes[1]; p[2 * Stride] = Lanes[2]; p[3 * Stride] = Lanes[3];
+    }
+#endif
+    for (; i < Count; i++)
+        Out[i * Stride] = Origin + In[i] * Step;
+}
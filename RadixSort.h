@@ -0,0 +1,111 @@
+#pragma once
+// -------------------- Radix Sort --------------------
+// LSD radix sort of 32-bit keys carrying a 32-bit payload (usually an index),
+// 8 bits per pass. With a job system every pass is split over chunks: each
+// chunk counts its digits, one scan turns the counts into per-chunk offsets,
+// then each chunk scatters its own elements. Chunks own consecutive slots per
+// digit in chunk order, so the sort is stable.
+//
+// Passes where every key has the same digit are skipped. For Morton codes of a
+// window a few hundred cells wide that's usually the top byte or two.
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "JobSystem.h"
+
+// Interleaves the low 16 bits of x and y, x in the even bits: the Z-order curve
+inline uint32_t MortonCode(uint32_t x, uint32_t y)
+{
+    auto Spread = [](uint32_t v) {
+        v &= 0xFFFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return Spread(x) | (Spread(y) << 1);
+}
+
+class RadixSorter
+{
+public:
+    // Sorts Keys ascending and applies the same permutation to Values. Graph is
+    // reset and reused for every pass.
+    void Sort(JobSystem* Jobs, TaskGraph& Graph, std::vector<uint32_t>& Keys, std::vector<uint32_t>& Values, int ChunkSize)
+    {
+        int Count = (int)Keys.size();
+        if (Count < 2) return;
+        if (!Jobs || ChunkSize >= Count) ChunkSize = Count;
+        int Chunks = (Count + ChunkSize - 1) / ChunkSize;
+        KeyScratch.resize(Count);
+        ValueScratch.resize(Count);
+        Counts.assign((size_t)Chunks * 256, 0);
+
+        Pass State;
+        State.Self = this;
+        State.ChunkSize = ChunkSize;
+        Pass* P = &State;
+        for (int Shift = 0; Shift < 32; Shift += 8)
+        {
+            State.Shift = Shift;
+            State.Keys = Keys.data();
+            State.Values = Values.data();
+            State.KeysOut = KeyScratch.data();
+            State.ValuesOut = ValueScratch.data();
+
+            std::fill(Counts.begin(), Counts.end(), 0);
+            ParallelFor(Jobs, Graph, Count, ChunkSize, [P](int Begin, int End) {
+                int* Histogram = P->Self->Counts.data() + (size_t)(Begin / P->ChunkSize) * 256;
+                for (int i = Begin; i < End; i++)
+                    Histogram[(P->Keys[i] >> P->Shift) & 0xFF]++;
+            });
+
+            // Digit-major, chunk-minor prefix sum: chunk c's slots for digit d
+            // come right after chunk c - 1's
+            bool Trivial = false;
+            int Offset = 0;
+            for (int Digit = 0; Digit < 256; Digit++)
+            {
+                int DigitTotal = 0;
+                for (int c = 0; c < Chunks; c++)
+                {
+                    int& Slot = Counts[(size_t)c * 256 + Digit];
+                    int Here = Slot;
+                    Slot = Offset;
+                    Offset += Here;
+                    DigitTotal += Here;
+                }
+                if (DigitTotal == Count) Trivial = true;
+            }
+            if (Trivial) continue;
+
+            ParallelFor(Jobs, Graph, Count, ChunkSize, [P](int Begin, int End) {
+                int* Next = P->Self->Counts.data() + (size_t)(Begin / P->ChunkSize) * 256;
+                for (int i = Begin; i < End; i++)
+                {
+                    int Slot = Next[(P->Keys[i] >> P->Shift) & 0xFF]++;
+                    P->KeysOut[Slot] = P->Keys[i];
+                    P->ValuesOut[Slot] = P->Values[i];
+                }
+            });
+            Keys.swap(KeyScratch);
+            Values.swap(ValueScratch);
+        }
+    }
+
+private:
+    struct Pass
+    {
+        RadixSorter* Self;
+        int Shift, ChunkSize;
+        const uint32_t* Keys;
+        const uint32_t* Values;
+        uint32_t* KeysOut;
+        uint32_t* ValuesOut;
+    };
+
+    std::vector<uint32_t> KeyScratch, ValueScratch;
+    std::vector<int> Counts;   // Chunks x 256, count then write cursor per (chunk, digit)
+};
@@ -0,0 +1,142 @@
+#pragma once
+// -------------------- Shared Memory --------------------
+// Building blocks for running the simulation as several cooperating local
+// processes: one POSIX shared memory segment, single-producer single-consumer
+// rings inside it, and a spinning barrier.
+//
+// Everything that lives in the segment only uses lock-free atomics, which work
+// across processes on Linux. There's no mutex or condition variable in there,
+// so a crashed peer can't leave a lock held. Waits spin with a poll callback
+// instead, which can drain inboxes or notice that it's time to give up.
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Anonymous-by-name shm segment. The name is unlinked right after mapping, so
+// nothing is left in /dev/shm even if we crash, and forked children inherit the
+// mapping anyway.
+class SharedSegment
+{
+public:
+    SharedSegment() = default;
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+    ~SharedSegment() { Release(); }
+
+    bool Create(size_t Bytes)
+    {
+#ifdef __linux__
+        char Name[64];
+        std::snprintf(Name, sizeof(Name), "/wind-%d-%p", (int)getpid(), (void*)this);
+        int Fd = shm_open(Name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (Fd < 0) return false;
+        shm_unlink(Name);
+        if (ftruncate(Fd, (off_t)Bytes) != 0)
+        {
+            close(Fd);
+            return false;
+        }
+        void* Mapped = mmap(nullptr, Bytes, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+        close(Fd);
+        if (Mapped == MAP_FAILED) return false;
+        Base = Mapped;
+        Size = Bytes;
+        return true;
+#else
+        (void)Bytes;
+        return false;
+#endif
+    }
+
+    void Release()
+    {
+#ifdef __linux__
+        if (Base) munmap(Base, Size);
+#endif
+        Base = nullptr;
+        Size = 0;
+    }
+
+    unsigned char* Data() const { return static_cast<unsigned char*>(Base); }
+    size_t Bytes() const { return Size; }
+
+private:
+    void* Base = nullptr;
+    size_t Size = 0;
+};
+
+// Rounds Offset up so the next block starts on its own cache line
+inline size_t AlignShared(size_t Offset) { return (Offset + 63) & ~(size_t)63; }
+
+// -------------------- SPSC Ring --------------------
+// Head and tail sit on separate cache lines so producer and consumer don't
+// fight over one. Capacity must be a power of two.
+struct SpscRingHeader
+{
+    alignas(64) std::atomic<uint64_t> Head{ 0 };   // next slot to read, written by the consumer
+    alignas(64) std::atomic<uint64_t> Tail{ 0 };   // next slot to write, written by the producer
+};
+
+template <typename T>
+struct SpscRing
+{
+    SpscRingHeader* Header = nullptr;
+    T* Items = nullptr;
+    uint64_t Capacity = 0;
+
+    bool TryPush(const T& Item)
+    {
+        uint64_t Tail = Header->Tail.load(std::memory_order_relaxed);
+        if (Tail - Header->Head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        Items[Tail & (Capacity - 1)] = Item;
+        Header->Tail.store(Tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& Item)
+    {
+        uint64_t Head = Header->Head.load(std::memory_order_relaxed);
+        if (Head == Header->Tail.load(std::memory_order_acquire))
+            return false;
+        Item = Items[Head & (Capacity - 1)];
+        Header->Head.store(Head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// -------------------- Barrier --------------------
+// Sense-reversing: the last one in bumps the generation, everyone else spins
+// on it. WhileWaiting runs on every spin and can return false to give up.
+struct SharedBarrier
+{
+    alignas(64) std::atomic<int> Arrived{ 0 };
+    alignas(64) std::atomic<int> Generation{ 0 };
+
+    template <typename F>
+    bool Wait(int Parties, const F& WhileWaiting)
+    {
+        int Current = Generation.load(std::memory_order_acquire);
+        if (Arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == Parties)
+        {
+            Arrived.store(0, std::memory_order_relaxed);
+            Generation.store(Current + 1, std::memory_order_release);
+            return true;
+        }
+        while (Generation.load(std::memory_order_acquire) == Current)
+        {
+            if (!WhileWaiting())
+                return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+};
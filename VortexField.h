@@ -0,0 +1,627 @@
+#pragma once
+// -------------------- Vortex Particles --------------------
+// A grid-free wake: Rankine vortices. A vortex of circulation Gamma at z_j adds
+//
+//   u - i v = -i Gamma / (2 pi) * conj(z - z_j) / max(|z - z_j|^2, Core^2)
+//
+// at z: solid-body rotation inside Core, and outside it exactly the point
+// vortex's 1 / (z - z_j), which is what lets the expansions below be exact
+// in the limit. Summing that over N vortices at N points is O(N^2).
+//
+// BarnesHutTree puts the vortices in a quadtree and lets a cell stand in for
+// everything inside it once the cell looks small from the target: cell side
+// over distance to its centre below the opening angle Theta. A cell stands in
+// with its first three moments about its centre,
+//
+//   a_k = sum Gamma_j (z_j - c)^k,   sum Gamma_j / (z - z_j) ~ sum a_k / (z - c)^(k + 1)
+//
+// Expanding about the centre instead of a centre of vorticity is what makes it
+// work with both signs of Gamma, where that centroid can be anywhere. A far
+// cell closer than Core gets the core as if all of it sat at its centre.
+//
+// The tree is built over Morton-sorted vortices, so a cell is a contiguous
+// run of them. Evaluation only reads the tree, so any number of threads can
+// evaluate targets at once.
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+#include "JobSystem.h"
+#include "RadixSort.h"
+
+typedef std::complex<float> ComplexF;
+
+// Vortices, one array per field. Strength is the circulation in px^2 per
+// step, positive counter-clockwise.
+struct VortexSet
+{
+    std::vector<float> X, Y, Strength;
+
+    size_t Size() const { return X.size(); }
+
+    void Resize(size_t Count)
+    {
+        X.resize(Count);
+        Y.resize(Count);
+        Strength.resize(Count);
+    }
+
+    void Add(float NewX, float NewY, float NewStrength)
+    {
+        X.push_back(NewX);
+        Y.push_back(NewY);
+        Strength.push_back(NewStrength);
+    }
+};
+
+// sum Gamma_j conj(z - z_j) / max(|z - z_j|^2, Core^2) over [Begin, End), added
+// to (Sr, Si). Real is what the sum is carried out in.
+template <typename Real>
+inline void AccumulateVortices(const float* X, const float* Y, const float* Strength, int Begin, int End, Real x, Real y,
+    Real CoreSquared, Real& Sr, Real& Si)
+{
+    for (int j = Begin; j < End; j++)
+    {
+        Real dx = x - X[j];
+        Real dy = y - Y[j];
+        Real Weight = Strength[j] / std::max(dx * dx + dy * dy, CoreSquared);
+        Sr += Weight * dx;
+        Si -= Weight * dy;
+    }
+}
+
+// (u, v) from S = sum Gamma_j / (z - z_j): u - i v = -i S / (2 pi)
+inline void VelocityFromSum(double Sr, double Si, float& u, float& v)
+{
+    const double InvTwoPi = 0.15915494309189535;
+    u = (float)(Si * InvTwoPi);
+    v = (float)(Sr * InvTwoPi);
+}
+
+// Every vortex, no tree. What the tree is measured against.
+inline void DirectVortexVelocity(const VortexSet& Set, float Core, float x, float y, float& u, float& v)
+{
+    float Sr = 0.0f, Si = 0.0f;
+    AccumulateVortices(Set.X.data(), Set.Y.data(), Set.Strength.data(), 0, (int)Set.Size(), x, y, Core * Core, Sr, Si);
+    VelocityFromSum(Sr, Si, u, v);
+}
+
+class BarnesHutTree
+{
+public:
+    float Theta = 0.5f;   // largest cell side over distance a cell is used whole at
+    int LeafSize = 8;
+
+    // Copies Set in Morton order and builds the cells over it. Jobs may be null.
+    void Build(const VortexSet& Set, float Core, JobSystem* Jobs, TaskGraph& Graph)
+    {
+        Nodes.clear();
+        int Count = (int)Set.Size();
+        Sorted.Resize(Count);
+        CoreSquared = Core * Core;
+        if (Count == 0) return;
+
+        float MinX = *std::min_element(Set.X.begin(), Set.X.end());
+        float MaxX = *std::max_element(Set.X.begin(), Set.X.end());
+        float MinY = *std::min_element(Set.Y.begin(), Set.Y.end());
+        float MaxY = *std::max_element(Set.Y.begin(), Set.Y.end());
+        float Side = std::max(MaxX - MinX, MaxY - MinY) * 1.0001f + 1e-3f;
+        float Scale = 65536.0f / Side;
+        Codes.resize(Count);
+        Order.resize(Count);
+        for (int i = 0; i < Count; i++)
+        {
+            uint32_t qx = std::min((uint32_t)((Set.X[i] - MinX) * Scale), 65535u);
+            uint32_t qy = std::min((uint32_t)((Set.Y[i] - MinY) * Scale), 65535u);
+            Codes[i] = MortonCode(qx, qy);
+            Order[i] = (uint32_t)i;
+        }
+        Sorter.Sort(Jobs, Graph, Codes, Order, 16384);
+        for (int i = 0; i < Count; i++)
+        {
+            Sorted.X[i] = Set.X[Order[i]];
+            Sorted.Y[i] = Set.Y[Order[i]];
+            Sorted.Strength[i] = Set.Strength[Order[i]];
+        }
+
+        Node Root;
+        Root.Cx = MinX + Side * 0.5f;
+        Root.Cy = MinY + Side * 0.5f;
+        Root.Size = Side;
+        Root.Begin = 0;
+        Root.End = Count;
+        Nodes.push_back(Root);
+        Split(0, 0);
+    }
+
+    // Induced velocity at (x, y), px per step
+    void Velocity(float x, float y, float& u, float& v) const
+    {
+        float Sr = 0.0f, Si = 0.0f;
+        if (Nodes.empty())
+        {
+            u = v = 0.0f;
+            return;
+        }
+        // 16 levels, each pops one cell and pushes at most four
+        int Stack[64];
+        int Top = 0;
+        Stack[Top++] = 0;
+        float ThetaSquared = Theta * Theta;
+        while (Top > 0)
+        {
+            const Node& Cell = Nodes[Stack[--Top]];
+            float dx = x - Cell.Cx;
+            float dy = y - Cell.Cy;
+            float DistanceSquared = dx * dx + dy * dy;
+            if (Cell.Size * Cell.Size < ThetaSquared * DistanceSquared)
+            {
+                ComplexF Inv = ComplexF(dx, -dy) / DistanceSquared;
+                ComplexF Sum = Inv * (Cell.Moments[0] + Inv * (Cell.Moments[1] + Inv * Cell.Moments[2]));
+                // The core as it would round off one vortex at the centre
+                if (DistanceSquared < CoreSquared)
+                    Sum *= DistanceSquared / CoreSquared;
+                Sr += Sum.real();
+                Si += Sum.imag();
+            }
+            else if (Cell.Children == 0)
+                AccumulateVortices(Sorted.X.data(), Sorted.Y.data(), Sorted.Strength.data(), Cell.Begin, Cell.End, x, y, CoreSquared, Sr, Si);
+            else
+                for (int c = 0; c < Cell.Children; c++)
+                    Stack[Top++] = Cell.FirstChild + c;
+        }
+        VelocityFromSum(Sr, Si, u, v);
+    }
+
+    int NodeCount() const { return (int)Nodes.size(); }
+
+private:
+    struct Node
+    {
+        float Cx = 0.0f, Cy = 0.0f, Size = 0.0f;
+        int Begin = 0, End = 0;
+        int FirstChild = -1, Children = 0;
+        ComplexF Moments[3];
+    };
+
+    // Splits a cell by the next two Morton bits, then adds up its moments
+    void Split(int Index, int Level)
+    {
+        Node Cell = Nodes[Index];
+        if (Cell.End - Cell.Begin <= LeafSize || Level == 16)
+        {
+            ComplexF Centre(Cell.Cx, Cell.Cy);
+            for (int j = Cell.Begin; j < Cell.End; j++)
+            {
+                ComplexF Offset = ComplexF(Sorted.X[j], Sorted.Y[j]) - Centre;
+                Cell.Moments[0] += Sorted.Strength[j];
+                Cell.Moments[1] += Sorted.Strength[j] * Offset;
+                Cell.Moments[2] += Sorted.Strength[j] * Offset * Offset;
+            }
+            Nodes[Index] = Cell;
+            return;
+        }
+
+        int Shift = 2 * (15 - Level);
+        int First = (int)Nodes.size();
+        int Cursor = Cell.Begin;
+        for (uint32_t Quadrant = 0; Quadrant < 4; Quadrant++)
+        {
+            int Last = (int)(std::partition_point(Codes.begin() + Cursor, Codes.begin() + Cell.End,
+                [Shift, Quadrant](uint32_t Code) { return ((Code >> Shift) & 3) <= Quadrant; }) - Codes.begin());
+            if (Last == Cursor) continue;
+            Node Child;
+            Child.Size = Cell.Size * 0.5f;
+            Child.Cx = Cell.Cx + (Quadrant & 1 ? 0.5f : -0.5f) * Child.Size;
+            Child.Cy = Cell.Cy + (Quadrant & 2 ? 0.5f : -0.5f) * Child.Size;
+            Child.Begin = Cursor;
+            Child.End = Last;
+            Nodes.push_back(Child);
+            Cursor = Last;
+        }
+        int Children = (int)Nodes.size() - First;
+        Nodes[Index].FirstChild = First;
+        Nodes[Index].Children = Children;
+
+        // Each child's moments moved to this centre, (w + d)^k expanded
+        ComplexF Moments[3];
+        for (int c = 0; c < Children; c++)
+        {
+            Split(First + c, Level + 1);
+            const Node& Child = Nodes[First + c];
+            ComplexF d = ComplexF(Child.Cx - Cell.Cx, Child.Cy - Cell.Cy);
+            Moments[0] += Child.Moments[0];
+            Moments[1] += Child.Moments[1] + Child.Moments[0] * d;
+            Moments[2] += Child.Moments[2] + 2.0f * Child.Moments[1] * d + Child.Moments[0] * d * d;
+        }
+        std::copy(Moments, Moments + 3, Nodes[Index].Moments);
+    }
+
+    std::vector<Node> Nodes;
+    VortexSet Sorted;
+    std::vector<uint32_t> Codes, Order;
+    RadixSorter Sorter;
+    float CoreSquared = 0.0f;
+};
+
+// Inverse of MortonCode
+inline void MortonDecode(uint32_t Code, uint32_t& x, uint32_t& y)
+{
+    auto Compact = [](uint32_t v) {
+        v &= 0x55555555;
+        v = (v | (v >> 1)) & 0x33333333;
+        v = (v | (v >> 2)) & 0x0F0F0F0F;
+        v = (v | (v >> 4)) & 0x00FF00FF;
+        v = (v | (v >> 8)) & 0x0000FFFF;
+        return v;
+    };
+    x = Compact(Code);
+    y = Compact(Code >> 1);
+}
+
+// -------------------- Fast Multipole --------------------
+// Greengard and Rokhlin's 2D FMM for the same sum, at a set of targets. The
+// square around the sources, and a region the caller names, is split into a
+// uniform quadtree deep enough for about LeafSize sources per occupied leaf.
+// Boxes of a level are numbered in Morton order, so a box's children are 4m
+// to 4m + 3, and the sources of any box are one run of the leaf-sorted sources.
+//
+//   Build     P2M: each leaf's moments a_k about its centre, k = 0..Order
+//             M2M: children's moments shifted to the parent, level by level
+//   Evaluate  M2L: every box takes the moments of its interaction list (the
+//             children of its parent's neighbours that aren't its own
+//             neighbours) as a local expansion sum b_l (z - c)^l
+//             L2L: the parent's local expansion shifted to each child
+//             leaves: the local expansion at each target, plus the 3 x 3
+//             leaves around it summed directly
+//
+// The boxes only depend on the sources and the region, never on the targets,
+// so a target gets the same velocity whatever else is evaluated with it.
+// Targets outside the square are summed directly.
+//
+// Only occupied boxes are kept: each level has a sorted list of the boxes
+// holding sources, and of the boxes holding targets, with Terms coefficients
+// each. A level can't have more occupied boxes than points, so the
+// expansions take at most 16 bytes x Terms x Levels per source and again per
+// target, about 6.5 KB each at order 40 and 10 levels, however deep it goes.
+//
+// Each pass is a ParallelFor over the occupied boxes of a level, and a box
+// only writes its own coefficients, so the result doesn't depend on the
+// threads. Every pass costs a fixed amount per box or per point, O(N) per
+// level, against Barnes-Hut's O(N log N). The error
+// falls off like (sqrt(2) / (4 - sqrt(2)))^Order or better. Expansions are
+// double, so the near field's float inputs set the floor.
+typedef std::complex<double> ComplexD;
+
+class FastMultipole
+{
+public:
+    static const int MaxOrder = 40;
+    static const int MaxLevels = 10;
+    int Order = 12;
+    int LeafSize = 32;
+
+    // Sorts the sources into boxes over a square covering them and the
+    // rectangle (MinX, MinY) - (MaxX, MaxY), and forms their moments. Jobs may be null.
+    void Build(const VortexSet& Sources, float Core, float MinX, float MinY, float MaxX, float MaxY, JobSystem* Jobs,
+        TaskGraph& Graph)
+    {
+        int SourceCount = (int)Sources.Size();
+        Levels = 0;
+        Sorted.Resize(SourceCount);
+        if (SourceCount == 0) return;
+        Terms = std::min(std::max(Order, 1), MaxOrder) + 1;
+        CoreSquared = (double)Core * Core;
+
+        MinX = std::min(MinX, *std::min_element(Sources.X.begin(), Sources.X.end()));
+        MaxX = std::max(MaxX, *std::max_element(Sources.X.begin(), Sources.X.end()));
+        MinY = std::min(MinY, *std::min_element(Sources.Y.begin(), Sources.Y.end()));
+        MaxY = std::max(MaxY, *std::max_element(Sources.Y.begin(), Sources.Y.end()));
+        OriginX = MinX;
+        OriginY = MinY;
+        Side = std::max(MaxX - MinX, MaxY - MinY) * 1.0001 + 1e-3;
+
+        SourceCodes.resize(SourceCount);
+        SourceOrder.resize(SourceCount);
+        for (int i = 0; i < SourceCount; i++)
+        {
+            SourceCodes[i] = FinestCode(Sources.X[i], Sources.Y[i]);
+            SourceOrder[i] = (uint32_t)i;
+        }
+        Sorter.Sort(Jobs, Graph, SourceCodes, SourceOrder, 4096);
+        for (int i = 0; i < SourceCount; i++)
+        {
+            Sorted.X[i] = Sources.X[SourceOrder[i]];
+            Sorted.Y[i] = Sources.Y[SourceOrder[i]];
+            Sorted.Strength[i] = Sources.Strength[SourceOrder[i]];
+        }
+
+        // Deep enough for LeafSize sources per occupied leaf, so a wake that
+        // only fills a band of the square still gets small leaves. Never
+        // narrower than the core: a target is then at least a leaf away from
+        // every source the expansions carry to it, where the kernel is 1 / z.
+        for (Levels = 2; Levels < MaxLevels; Levels++)
+        {
+            if (SourceCount <= 2LL * LeafSize * CountBoxes(SourceCodes, SourceCount, Levels) || Side / (2 << Levels) < Core)
+                break;
+        }
+
+        for (int l = 2; l <= Levels; l++)
+        {
+            ListBoxes(SourceCodes, SourceCount, l, SourceBoxes[l], SourceFirst[l]);
+            Multipoles[l].assign(SourceBoxes[l].size() * Terms, ComplexD());
+        }
+
+        ParallelFor(Jobs, Graph, (int)SourceBoxes[Levels].size(), 256, [this](int Begin, int End) {
+            for (int b = Begin; b < End; b++)
+                FormMultipole(b);
+        });
+        for (int l = Levels - 1; l >= 2; l--)
+            ParallelFor(Jobs, Graph, (int)SourceBoxes[l].size(), 256, [this, l](int Begin, int End) {
+                for (int b = Begin; b < End; b++)
+                    GatherChildren(l, b);
+            });
+    }
+
+    // Induced velocity at (X[i], Y[i]) into (U[i], V[i]) for i < Count, from
+    // the sources of the last Build. Jobs may be null.
+    void Evaluate(const float* X, const float* Y, int Count, float* U, float* V, JobSystem* Jobs, TaskGraph& Graph)
+    {
+        if (Count <= 0) return;
+        if (Levels == 0)
+        {
+            std::fill(U, U + Count, 0.0f);
+            std::fill(V, V + Count, 0.0f);
+            return;
+        }
+
+        // Targets outside the square sort last
+        const uint32_t Outside = 0xFFFFFFFFu;
+        TargetCodes.resize(Count);
+        TargetOrder.resize(Count);
+        int Inside = 0;
+        for (int i = 0; i < Count; i++)
+        {
+            bool In = X[i] >= OriginX && X[i] < OriginX + Side && Y[i] >= OriginY && Y[i] < OriginY + Side;
+            TargetCodes[i] = In ? FinestCode(X[i], Y[i]) : Outside;
+            TargetOrder[i] = (uint32_t)i;
+            Inside += In;
+        }
+        Sorter.Sort(Jobs, Graph, TargetCodes, TargetOrder, 4096);
+
+        for (int l = 2; l <= Levels; l++)
+        {
+            ListBoxes(TargetCodes, Inside, l, TargetBoxes[l], TargetFirst[l]);
+            Locals[l].assign(TargetBoxes[l].size() * Terms, ComplexD());
+        }
+
+        for (int l = 2; l <= Levels; l++)
+            ParallelFor(Jobs, Graph, (int)TargetBoxes[l].size(), 64, [this, l](int Begin, int End) {
+                for (int b = Begin; b < End; b++)
+                    FormLocal(l, b);
+            });
+        ParallelFor(Jobs, Graph, (int)TargetBoxes[Levels].size(), 64, [this, X, Y, U, V](int Begin, int End) {
+            for (int b = Begin; b < End; b++)
+                EvaluateLeaf(b, X, Y, U, V);
+        });
+        ParallelFor(Jobs, Graph, Count - Inside, 64, [this, Inside, X, Y, U, V](int Begin, int End) {
+            for (int t = Inside + Begin; t < Inside + End; t++)
+            {
+                int i = (int)TargetOrder[t];
+                double Sr = 0.0, Si = 0.0;
+                AccumulateVortices(Sorted.X.data(), Sorted.Y.data(), Sorted.Strength.data(), 0, (int)Sorted.Size(),
+                    (double)X[i], (double)Y[i], CoreSquared, Sr, Si);
+                VelocityFromSum(Sr, Si, U[i], V[i]);
+            }
+        });
+    }
+
+    int LevelCount() const { return Levels; }
+    int BoxCount() const { return Levels > 0 ? (int)SourceBoxes[Levels].size() : 0; }
+
+private:
+    // Box at MaxLevels, the levels above are its top bits
+    uint32_t FinestCode(float x, float y) const
+    {
+        double Scale = (double)(1 << MaxLevels) / Side;
+        uint32_t Last = (1u << MaxLevels) - 1;
+        uint32_t ix = std::min((uint32_t)((x - OriginX) * Scale), Last);
+        uint32_t iy = std::min((uint32_t)((y - OriginY) * Scale), Last);
+        return MortonCode(ix, iy);
+    }
+
+    ComplexD Centre(int Level, uint32_t Code) const
+    {
+        uint32_t ix, iy;
+        MortonDecode(Code, ix, iy);
+        double Width = Side / (1 << Level);
+        return ComplexD(OriginX + (ix + 0.5) * Width, OriginY + (iy + 0.5) * Width);
+    }
+
+    // Distinct boxes of Level among the first Count of sorted Codes
+    static int CountBoxes(const std::vector<uint32_t>& Codes, int Count, int Level)
+    {
+        int Shift = 2 * (MaxLevels - Level);
+        int Boxes = 0;
+        for (int i = 0; i < Count; i++)
+            if (i == 0 || Codes[i] >> Shift != Codes[i - 1] >> Shift)
+                Boxes++;
+        return Boxes;
+    }
+
+    // The distinct boxes of Level among the first Count of sorted Codes, and
+    // where each one's run starts. First ends with Count.
+    static void ListBoxes(const std::vector<uint32_t>& Codes, int Count, int Level, std::vector<uint32_t>& Boxes,
+        std::vector<int>& First)
+    {
+        int Shift = 2 * (MaxLevels - Level);
+        Boxes.clear();
+        First.clear();
+        for (int i = 0; i < Count; i++)
+            if (i == 0 || Codes[i] >> Shift != Codes[i - 1] >> Shift)
+            {
+                Boxes.push_back(Codes[i] >> Shift);
+                First.push_back(i);
+            }
+        First.push_back(Count);
+    }
+
+    // Position of Code in a level's sorted box list, -1 if it isn't occupied
+    static int FindBox(const std::vector<uint32_t>& Boxes, uint32_t Code)
+    {
+        auto It = std::lower_bound(Boxes.begin(), Boxes.end(), Code);
+        return It != Boxes.end() && *It == Code ? (int)(It - Boxes.begin()) : -1;
+    }
+
+    // n choose k for n up to 2 * MaxOrder + 1
+    static double Binomial(int n, int k)
+    {
+        static const std::vector<double> Table = [] {
+            const int Rows = 2 * MaxOrder + 2;
+            std::vector<double> Values((size_t)Rows * Rows, 0.0);
+            for (int Row = 0; Row < Rows; Row++)
+            {
+                Values[(size_t)Row * Rows] = 1.0;
+                for (int Col = 1; Col <= Row; Col++)
+                    Values[(size_t)Row * Rows + Col] = Values[(size_t)(Row - 1) * Rows + Col - 1] + Values[(size_t)(Row - 1) * Rows + Col];
+            }
+            return Values;
+        }();
+        return Table[(size_t)n * (2 * MaxOrder + 2) + k];
+    }
+
+    // P2M for the Box-th occupied leaf
+    void FormMultipole(int Box)
+    {
+        ComplexD* Out = &Multipoles[Levels][(size_t)Box * Terms];
+        ComplexD c = Centre(Levels, SourceBoxes[Levels][Box]);
+        for (int j = SourceFirst[Levels][Box]; j < SourceFirst[Levels][Box + 1]; j++)
+        {
+            ComplexD Offset = ComplexD(Sorted.X[j], Sorted.Y[j]) - c;
+            ComplexD Power = Sorted.Strength[j];
+            for (int k = 0; k < Terms; k++)
+            {
+                Out[k] += Power;
+                Power *= Offset;
+            }
+        }
+    }
+
+    // M2M: a_k = sum_j C(k, j) b_j d^(k - j), d the child's centre from the parent's
+    void GatherChildren(int Level, int Box)
+    {
+        ComplexD* Out = &Multipoles[Level][(size_t)Box * Terms];
+        uint32_t Code = SourceBoxes[Level][Box];
+        ComplexD c = Centre(Level, Code);
+        ComplexD Powers[MaxOrder + 1];
+        const std::vector<uint32_t>& Children = SourceBoxes[Level + 1];
+        for (int Child = (int)(std::lower_bound(Children.begin(), Children.end(), 4 * Code) - Children.begin());
+             Child < (int)Children.size() && Children[Child] >> 2 == Code; Child++)
+        {
+            const ComplexD* In = &Multipoles[Level + 1][(size_t)Child * Terms];
+            ComplexD d = Centre(Level + 1, Children[Child]) - c;
+            Powers[0] = 1.0;
+            for (int k = 1; k < Terms; k++)
+                Powers[k] = Powers[k - 1] * d;
+            for (int k = 0; k < Terms; k++)
+                for (int j = 0; j <= k; j++)
+                    Out[k] += Binomial(k, j) * In[j] * Powers[k - j];
+        }
+    }
+
+    // L2L from the parent, then M2L from the interaction list, for the Box-th target box
+    void FormLocal(int Level, int Box)
+    {
+        ComplexD* Out = &Locals[Level][(size_t)Box * Terms];
+        uint32_t Code = TargetBoxes[Level][Box];
+        ComplexD c = Centre(Level, Code);
+        ComplexD Powers[2 * MaxOrder + 2];
+
+        if (Level > 2)
+        {
+            // e_m = sum_{l >= m} C(l, m) b_l d^(l - m), d the child's centre from the parent's
+            const ComplexD* In = &Locals[Level - 1][(size_t)FindBox(TargetBoxes[Level - 1], Code >> 2) * Terms];
+            ComplexD d = c - Centre(Level - 1, Code >> 2);
+            Powers[0] = 1.0;
+            for (int k = 1; k < Terms; k++)
+                Powers[k] = Powers[k - 1] * d;
+            for (int m = 0; m < Terms; m++)
+                for (int l = m; l < Terms; l++)
+                    Out[m] += Binomial(l, m) * In[l] * Powers[l - m];
+        }
+
+        uint32_t ix, iy;
+        MortonDecode(Code, ix, iy);
+        int Boxes = 1 << Level;
+        int px = (int)ix >> 1, py = (int)iy >> 1;
+        for (int ny = std::max(0, 2 * py - 2); ny <= std::min(Boxes - 1, 2 * py + 3); ny++)
+            for (int nx = std::max(0, 2 * px - 2); nx <= std::min(Boxes - 1, 2 * px + 3); nx++)
+            {
+                if (std::abs(nx - (int)ix) <= 1 && std::abs(ny - (int)iy) <= 1)
+                    continue;
+                uint32_t Source = MortonCode((uint32_t)nx, (uint32_t)ny);
+                int Found = FindBox(SourceBoxes[Level], Source);
+                if (Found < 0) continue;
+                // b_l += sum_k a_k (-1)^(k + 1) C(k + l, k) / z0^(k + l + 1), z0 the source's centre from ours
+                const ComplexD* In = &Multipoles[Level][(size_t)Found * Terms];
+                ComplexD Inverse = 1.0 / (Centre(Level, Source) - c);
+                Powers[0] = Inverse;
+                for (int k = 1; k < 2 * Terms; k++)
+                    Powers[k] = Powers[k - 1] * Inverse;
+                for (int l = 0; l < Terms; l++)
+                {
+                    ComplexD Sum;
+                    for (int k = 0; k < Terms; k++)
+                    {
+                        ComplexD Term = Binomial(k + l, k) * In[k] * Powers[k + l];
+                        Sum += k % 2 ? Term : -Term;
+                    }
+                    Out[l] += Sum;
+                }
+            }
+    }
+
+    // Local expansion plus the neighbours' sources, at every target in the Box-th target leaf
+    void EvaluateLeaf(int Box, const float* X, const float* Y, float* U, float* V) const
+    {
+        const ComplexD* In = &Locals[Levels][(size_t)Box * Terms];
+        uint32_t Code = TargetBoxes[Levels][Box];
+        ComplexD c = Centre(Levels, Code);
+        uint32_t ix, iy;
+        MortonDecode(Code, ix, iy);
+        int Boxes = 1 << Levels;
+        int Near[9], NearCount = 0;
+        for (int ny = std::max(0, (int)iy - 1); ny <= std::min(Boxes - 1, (int)iy + 1); ny++)
+            for (int nx = std::max(0, (int)ix - 1); nx <= std::min(Boxes - 1, (int)ix + 1); nx++)
+            {
+                int Found = FindBox(SourceBoxes[Levels], MortonCode((uint32_t)nx, (uint32_t)ny));
+                if (Found >= 0)
+                    Near[NearCount++] = Found;
+            }
+
+        for (int t = TargetFirst[Levels][Box]; t < TargetFirst[Levels][Box + 1]; t++)
+        {
+            int i = (int)TargetOrder[t];
+            ComplexD w = ComplexD(X[i], Y[i]) - c;
+            ComplexD Sum = In[Terms - 1];
+            for (int l = Terms - 2; l >= 0; l--)
+                Sum = Sum * w + In[l];
+            double Sr = Sum.real(), Si = Sum.imag();
+            for (int n = 0; n < NearCount; n++)
+                AccumulateVortices(Sorted.X.data(), Sorted.Y.data(), Sorted.Strength.data(), SourceFirst[Levels][Near[n]],
+                    SourceFirst[Levels][Near[n] + 1], (double)X[i], (double)Y[i], CoreSquared, Sr, Si);
+            VelocityFromSum(Sr, Si, U[i], V[i]);
+        }
+    }
+
+    int Terms = 0, Levels = 0;
+    double OriginX = 0.0, OriginY = 0.0, Side = 1.0, CoreSquared = 0.0;
+    VortexSet Sorted;
+    RadixSorter Sorter;
+    std::vector<uint32_t> SourceCodes, SourceOrder, TargetCodes, TargetOrder;
+    // Per level: occupied boxes in Morton order, where each one's points start, its coefficients
+    std::vector<uint32_t> SourceBoxes[MaxLevels + 1], TargetBoxes[MaxLevels + 1];
+    std::vector<int> SourceFirst[MaxLevels + 1], TargetFirst[MaxLevels + 1];
+    std::vector<ComplexD> Multipoles[MaxLevels + 1], Locals[MaxLevels + 1];
+};
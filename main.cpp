@@ -4,20 +4,50 @@
 #include <cmath>
 #include <chrono>
 #include <thread>
+#ifdef _WIN32
 #include <Windows.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#endif
 #include <vector>
 #include <cstdlib>
 #include <ctime> // added
 #include <random>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cinttypes>
+#include <algorithm>
+#include <numeric>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <filesystem>
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "FrameCapture.h"
+#include "JobSystem.h"
+#include "Numa.h"
+#include "SharedMemory.h"
+#include "RadixSort.h"
+#include "Arena.h"
+#include "Quantize.h"
+#include "Precision.h"
+#include "PressureField.h"
+#include "CurlNoise.h"
+#include "VortexField.h"
 #include <thread>
 #define M_PI 3.141
 
-void RenderIMGUI();
-
-
 
 
 // -----------------OBJECT TYPE ENUM---------------------
@@ -28,52 +58,721 @@ enum ObjectTypes
     Triangle
 };
 
-// ------------------All wind speed shit--------------
-static float dt = 0.1f;
-static float f = 0.0f;
-static float k = 0.1f;
-static float dPdx = 0.0f;
-static float dPdy = 0.0f;
-static float u = 0.0f;
-static float v = 0.0f;
-
-
-
-static float R;
-static float G;
-static float B;
-static float Size;
 // -------------------- Structs --------------------
 struct Vector2 { float x, y; };
 struct Vector2D { double x, y; };
 struct RGB { float R, G, B; };
-struct Particle { float X, Y; Vector2 Velocity = { 0, 0 }; RGB color; float OringialY; };
+// What a particle last ran into. Only the draw turns it into a color.
+enum ParticleStates : uint8_t
+{
+    ParticleFree,
+    ParticleHitObject,
+    ParticleHitParticle,
+    ParticleStateCount
+};
+const RGB ParticlePalette[ParticleStateCount] = { { 0.0745f, 0.2745f, 0.0667f }, { 255, 0, 0 }, { 255, 255, 0 } };
+struct Particle { float X, Y; Vector2 Velocity = { 0, 0 }; uint8_t State = ParticleFree; float OringialY; };
 struct Object { float X, Y, Size; RGB color; ObjectTypes ObjectType; };
+// Particle storage can be placed node by node, see Numa.h
+typedef std::vector<Particle, NumaAllocator<Particle>> ParticleVector;
+typedef std::vector<float, NumaAllocator<float>> BatchVector;
+// Object edit from the UI or a replay file, applied at the start of a step
+struct PendingInput { long long Step = -1; bool Clear = false; bool ClearWake = false; Object Item = {}; };
+
+// -------------------- Broadphase --------------------
+enum BroadphaseModes
+{
+    BruteForceBroadphase,
+    UniformGridBroadphase,
+    VerletListBroadphase,
+    SweepAndPruneBroadphase
+};
+std::vector<std::string> BroadphaseModeString = { "Brute force", "Uniform grid", "Verlet lists", "Sweep and prune" };
+
+// Particles bucketed by hashed cell, cells as wide as a contact, so every
+// contact partner sits in one of the 3x3 cells around a particle
+struct UniformGrid
+{
+    float CellSize = 10.0f;
+    int BucketMask = 0;
+    std::vector<int> BucketStart;   // BucketCount + 1 offsets into Indices
+    std::vector<int> Indices;       // particle indices grouped by bucket, ascending within a bucket
+    std::vector<int> BucketOf;
+    std::vector<int> Cursor;
+};
+
+// Every particle's partners within contact distance + Skin, kept until some
+// particle has moved more than Skin / 2 since the build. Two particles further
+// apart than that at the build can't both have closed the gap, so the cached
+// pairs still hold every contact. A push inside the current pass can take a
+// particle past Skin / 2, and for the rest of its pass it then checks every
+// particle, see CollideParticleRange.
+struct VerletLists
+{
+    float Skin = 4.0f;
+    std::vector<std::vector<int>> Rows;   // Rows[i]: partners of particle i in Others, ascending
+    std::vector<Vector2> Reference;       // where each particle was at the build
+    float BuiltSkin = 0.0f;
+    long long BuiltSorts = -1;            // a Morton sort renumbers everybody
+    std::atomic<bool> Moved{ false };     // someone is past Skin / 2, set by the update
+    bool Rebuilding = false;              // this step's collide ranges build their rows first
+    std::atomic<long long> Pairs{ 0 };    // over all rows of the last build
+    std::atomic<long long> Escapes{ 0 };  // pushes that took a particle past Skin / 2 within a pass
+    long long Rebuilds = 0;
+    long long Steps = 0;
+    double RebuildRate = 0.0;             // smoothed share of steps that rebuilt
+};
+
+// Particle indices sorted by X, kept from one step to the next. Everything
+// drifts +X at much the same speed, so last step's order is nearly right and
+// an insertion sort fixes it in about one pass. Recycled particles jump from
+// the right edge to the left one, so past a budget of moves it gives up and
+// sorts from scratch instead.
+struct SweepAndPrune
+{
+    std::vector<int> Order;     // indices into Others by ascending X
+    std::vector<float> Keys;    // Others[Order[k]].X
+    long long Moves = 0;        // insertion sort element moves, last step
+    long long FullSorts = 0;
+    long long Steps = 0;
+    double MovesPerParticle = 0.0;   // smoothed
+};
+
+// -------------------- Contact Solver --------------------
+// How overlapping particles get pulled apart. Snap moves each particle to just
+// touching the others, one at a time, and stops it dead. Position based
+// collects every overlapping pair as a distance constraint first, then splits
+// each pair's overlap between its two particles over a few iterations.
+enum ContactSolvers
+{
+    SnapContactSolver,
+    PositionBasedContactSolver
+};
+std::vector<std::string> ContactSolverString = { "Snap", "Position based" };
+
+// Pairs are edge coloured so no particle shows up twice within a colour. The
+// constraints of one colour then never share a particle and can be solved in
+// parallel chunks without atomics, while colour after colour still gives
+// Gauss-Seidel convergence over the whole set. Pairs are sorted before
+// colouring, so the outcome doesn't depend on which thread found them.
+const int ContactMaxColours = 32;   // colour ContactMaxColours collects the rest, solved on one thread
+const int ContactIterations = 96;   // the canned scenes need up to 82 to get under Tolerance, the slider goes to twice this
+struct ContactConstraint { int A, B; };
+struct ContactSolver
+{
+    ContactSolvers Solver = SnapContactSolver;
+    int Iterations = ContactIterations;
+    float Tolerance = 0.01f;                               // px of overlap an iteration may leave and still stop early
+    std::vector<std::vector<ContactConstraint>> Found;     // per thread slot, filled by the collide ranges
+    std::vector<ContactConstraint> Pairs;                  // all of them, ascending
+    std::vector<ContactConstraint> Ordered;                // grouped by colour
+    std::vector<int> ColourStart;                          // ContactMaxColours + 2 offsets into Ordered
+    std::vector<uint8_t> PairColour;
+    std::vector<uint32_t> Used;                            // per particle, colours its pairs already took
+    std::vector<uint8_t> ObjectHit;                        // per particle, handed an object its load this step
+    std::vector<int> Members;                              // particles in any pair, ascending
+    std::vector<Vector2> StartVelocity;                    // per member, before the first iteration
+    std::vector<float> ChunkError;                         // deepest overlap each solve chunk saw
+    TaskGraph Graph;
+    int Colours = 0;
+    int IterationsUsed = 0;
+    float Residual = 0.0f;                                 // deepest overlap in the last iteration
+    double MeanIterations = 0.0;                           // smoothed
+};
+
+// -------------------- Object Loads --------------------
+// What the flow does to each obstacle. A particle that hits an object stops
+// dead and hands it all of its momentum, in particle masses times px per step.
+// Contacts add to per-thread rows, one per thread slot like the arenas, so the
+// collide loop never writes memory another thread touches and needs no
+// atomics. FinishStep sums the rows once per step.
+struct ObjectLoad { float ImpulseX = 0.0f, ImpulseY = 0.0f; int Contacts = 0; };
+struct ObjectLoadTotal
+{
+    Vector2D Force = { 0, 0 };     // impulse handed over in the last step
+    double Drag = 0.0;             // |Force| smoothed, the steady load
+    double Peak = 0.0;             // largest |Force| in a single step, the impact load
+    Vector2D Impulse = { 0, 0 };   // everything since the object was placed
+    long long Contacts = 0;
+};
+struct ObjectLoads
+{
+    std::vector<std::vector<ObjectLoad>> Rows;   // [thread slot][object], padded so rows never share a cache line
+    std::vector<ObjectLoad> Step;                // this step's sum over the rows
+    std::vector<ObjectLoadTotal> Totals;
+};
+
+// Periodic reordering of ParticleList along the Z-order curve of the grid cells,
+// so particles that are close on screen are close in memory too
+struct MortonSort
+{
+    RadixSorter Sorter;
+    std::vector<uint32_t> Keys;
+    std::vector<uint32_t> Order;
+    ParticleVector Scratch;
+    UniformGrid Grid;                // for the locality measurement only
+    // Mean |i - j| over particle pairs within two cells of each other
+    double LocalityBefore = 0.0;     // right before the last sort
+    double Locality = 0.0;           // latest measurement
+    long long Sorts = 0;
+    double LastSortMs = 0.0;         // the smoothed phase time hides a pass that only runs now and then
+};
+
+// Compact particle encoding, 11 bytes instead of sizeof(Particle): positions
+// and OringialY as 16-bit fixed point over the domain, velocities as halves,
+// the state byte as is. Stored as separate arrays so the conversion kernels
+// in Quantize.h get contiguous 16-bit lanes on one side.
+struct CompactParticles
+{
+    // Fixed-point domain: one screen either side of the window, ~0.06 px steps
+    float OriginX = 0.0f, OriginY = 0.0f, StepX = 1.0f, StepY = 1.0f;
+    std::vector<uint16_t> X, Y, OriginalY;
+    std::vector<uint16_t> VelocityX, VelocityY;
+    std::vector<uint8_t> State;
+
+    size_t Size() const { return X.size(); }
+    static size_t BytesPerParticle() { return 5 * sizeof(uint16_t) + sizeof(uint8_t); }
+};
+
+// Everything the renderer needs for one step, so it can be drawn while the
+// live state is already being advanced
+struct FrameSnapshot
+{
+    BatchVector ParticleBatch;   // triangles ready for glDrawArrays, filled by render prep tasks
+    // Compact frames keep the particles encoded and expand them block by block
+    // while drawing, with ParticleBatch as the block buffer
+    bool IsCompact = false;
+    CompactParticles Compact;
+    std::vector<Object> ObjectList;
+};
+
+// -------------------- Wind Field --------------------
+// Where the particles' velocity comes from. Uniform is the one wind speed from
+// WindSpeedEquation straight along +X everywhere. Quadtree adds the flow
+// around the obstacles on an adaptive grid. Vortex adds the wake the circles
+// shed, carried by vortex particles.
+enum WindSources
+{
+    UniformWind,
+    QuadtreeWind,
+    VortexWind
+};
+std::vector<std::string> WindSourceString = { "Uniform", "Quadtree AMR", "Vortex wake" };
+
+// How the wind state (u, v) takes a step of dt under
+//   du/dt =  f v - k u - dPdx / rho
+//   dv/dt = -f u - k v - dPdy / rho
+// Explicit Euler multiplies by 1 - k dt and a rotation stretched by
+// sqrt(1 + (f dt)^2), so with f and dt both near 1 the state spirals outward
+// and k dt > 2 flips it back and forth ever harder. The linear part is a
+// decay times a rotation, e^(-k dt) R(f dt), which the exponential integrator
+// applies exactly; the pressure forcing is held constant over the step and
+// integrated through the same operator. Never grows, whatever dt is.
+enum WindIntegrators
+{
+    EulerIntegrator,
+    ExponentialIntegrator
+};
+std::vector<std::string> WindIntegratorString = { "Explicit Euler", "Exponential" };
+
+// Terms of the step that are often zero. Each combination has its own
+// compiled kernels, see SelectStepKernel.
+enum StepKernelFlags : unsigned
+{
+    KernelCoriolis = 1,       // f != 0
+    KernelPressureY = 2,      // dPdy != 0
+    KernelObjects = 4,        // at least one object
+    KernelMixedObjects = 8,   // some object isn't a circle
+    KernelVariants = 16
+};
+
+// The exponential step's operators, the same for every particle of a step:
+// state' = Decay * state + Forcing * (-dPdx / rho, -dPdy / rho)
+struct WindPropagator
+{
+    float Decay[2][2];
+    float Forcing[2][2];
+};
+
+// With a pressure field every particle has its own gradient. Either
+// integrator's step is affine in it, so a step splits into what's the same
+// for everybody and what the local gradient adds:
+// state' = Base + Forcing * (-dPdx / rho, -dPdy / rho)
+struct LocalWindStep
+{
+    float BaseU = 0.0f, BaseV = 0.0f;
+    float Forcing[2][2] = {};
+};
+
+// Curl noise on top of whatever the wind does, see CurlNoise.h. Amplitude is
+// the strongest push in px per step, Scale the eddy size in px. The noise
+// time moves Rate per step, and the cache's tiles move with it in jumps of
+// RefreshSteps steps, so a tile is filled at most once per jump.
+struct TurbulenceLayer
+{
+    bool Enabled = false;
+    float Amplitude = 1.0f;
+    float Scale = 120.0f;
+    float Rate = 0.02f;
+    int RefreshSteps = 4;
+    CurlNoiseCache Cache;
+};
+
+// Potential flow past the circles, stored for a free stream of 1 px per step
+// and scaled by the wind speed when sampled, so only moving the obstacles
+// means a rebuild. Cells split down to MaxDepth near an obstacle's edge, and
+// wherever the flow changes or turns by more than a limit across the cell.
+// Open sky stays at MinDepth.
+//
+// The tree is linear: no nodes, just the leaves in Morton order with the
+// Morton code of each one's first finest-level cell as its key. A point's
+// leaf is the last key not above the point's own code. Particles remember
+// the leaf they were in, and most steps they're still in it or have drifted
+// into the next one.
+struct QuadtreeField
+{
+    int MinDepth = 3;
+    int MaxDepth = 8;                 // 5.5 px cells over a 1400 px window
+    float VariationLimit = 0.05f;     // largest change in the flow across a leaf
+    float OriginX = 0.0f, OriginY = 0.0f, RootSize = 1.0f, FinestSize = 1.0f;
+    std::vector<uint32_t> Keys;       // ascending, one per leaf
+    std::vector<Vector2> Flow;        // at each leaf's centre
+    std::vector<uint8_t> Depth;
+    std::vector<int> Hints;           // per particle, the leaf it was in last step
+    std::vector<Object> BuiltObjects;
+    int BuiltDepth = -1;
+    long long Builds = 0;
+    double LastBuildMs = 0.0;
+    std::atomic<long long> Lookups{ 0 };
+    std::atomic<long long> Misses{ 0 };
+    double HitRate = 0.0;             // smoothed share of lookups the hint answered
+};
+
+// Vortices shed behind the circles, see VortexField.h. Every ShedInterval
+// steps each circle sheds one from just outside its top and bottom edge,
+// carrying what the shear layer there brought along, U^2 / 2 per step. They
+// drift with the wind plus what they induce on each other, lose a little
+// strength every step and are dropped past the right edge, inside a circle,
+// or oldest first past MaxVortices. Particles get the wind plus what all of
+// them induce, either from a Barnes-Hut tree rebuilt every step and walked
+// per particle, or from one fast multipole pass over the vortices and every
+// particle at the top of the step.
+enum VortexEvaluators
+{
+    BarnesHutEvaluator,
+    MultipoleEvaluator
+};
+std::vector<std::string> VortexEvaluatorString = { "Barnes-Hut", "Fast multipole" };
+
+struct VortexWake
+{
+    VortexEvaluators Evaluator = BarnesHutEvaluator;
+    float Theta = 0.5f;
+    float Core = 6.0f;                // px
+    float Decay = 0.995f;             // strength kept per step
+    int ShedInterval = 2;
+    int MaxVortices = 4000;
+    VortexSet Vortices;
+    BarnesHutTree Tree;
+    FastMultipole Multipole;
+    TaskGraph Graph;                  // the tree's sort, the multipole passes
+    // Positions and induced velocities, the vortices first. The multipole
+    // pass adds every particle after them.
+    std::vector<float> TargetX, TargetY, InducedX, InducedY;
+    int ParticleOffset = 0;
+    long long Shed = 0;
+    long long Clears = 0;             // "Clear wake" presses applied, strip ranks follow rank 0's count
+    double LastBuildMs = 0.0;         // tree build, or the whole multipole pass
+};
+
+// -------------------- Strip Decomposition --------------------
+// One process per vertical strip, see StartStripDomain
+const int StripMaxRanks = 16;
+const int StripMaxObjects = 1024;
+const uint64_t StripRingCapacity = 1 << 15;
+const float StripHalo = 20.0f;   // two grid cells, as far as a particle's candidates reach
+
+struct StripMessage { int Id; int Ghost; Particle Item; };
+
+// Sits at the start of the shared segment
+struct StripShared
+{
+    std::atomic<int> Quit{ 0 };
+    SharedBarrier Barrier;
+    // Written by rank 0 before the publish barrier
+    float dt, f, k, dPdx, dPdy, u, v;
+    int Broadphase;
+    float VerletSkin;
+    int WindSource;
+    float VortexTheta, VortexCore;
+    long long VortexClears;
+    int VortexEvaluator;
+    int MultipoleOrder;
+    int WindIntegrator;
+    int EvolveWind;
+    int PressureField;
+    int Turbulence;
+    float TurbulenceAmplitude, TurbulenceScale;
+    int ObjectCount;
+    Object Objects[StripMaxObjects];
+    // Written by each rank before the view barrier
+    int ViewCount[StripMaxRanks];
+    long long Migrated[StripMaxRanks];
+    long long GhostsSent[StripMaxRanks];
+    ObjectLoad ObjectLoads[StripMaxRanks][StripMaxObjects];
+};
+
+struct StripDomain
+{
+    int Rank = 0;
+    int Ranks = 1;
+    float StripWidth = 0.0f;
+    int ViewCapacity = 0;
+    SharedSegment Segment;
+    StripShared* Shared = nullptr;
+    std::vector<SpscRing<StripMessage>> Rings;   // Rings[From * Ranks + To]
+    std::vector<Particle*> Views;
+    std::vector<int> Children;
+
+    std::vector<int> Ids;                 // id of each own particle, parallel to ParticleList
+    std::vector<StripMessage> Migrants;   // received this step
+    std::vector<StripMessage> Ghosts;
+    ParticleVector Local;                 // own + ghosts in id order, what collisions read
+    std::vector<int> SelfInLocal;
+    std::vector<int> Order;
+    ParticleVector Gathered;              // rank 0: every rank's particles after the step
+};
+
+// -------------------- Heap Counter --------------------
+// Every operator new in the process bumps this, so the profiler can show how
+// many heap allocations a step made. Constant-initialized, so it works before
+// any static constructor runs.
+std::atomic<long long> HeapAllocations{ 0 };
+
+// The replacements stay out of line. Inlined into a caller, GCC sees the
+// malloc() and free() inside and warns that they don't pair with new and delete.
+#ifdef _MSC_VER
+#define HEAP_NOINLINE __declspec(noinline)
+#else
+#define HEAP_NOINLINE __attribute__((noinline))
+#endif
+
+HEAP_NOINLINE void* operator new(size_t Bytes)
+{
+    HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* Data = std::malloc(Bytes ? Bytes : 1))
+        return Data;
+    throw std::bad_alloc();
+}
+
+HEAP_NOINLINE void* operator new(size_t Bytes, std::align_val_t Align)
+{
+    HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    size_t Alignment = std::max(sizeof(void*), (size_t)Align);
+    void* Data = nullptr;
+#ifdef _WIN32
+    Data = _aligned_malloc(Bytes ? Bytes : 1, Alignment);
+#else
+    if (posix_memalign(&Data, Alignment, Bytes ? Bytes : 1) != 0) Data = nullptr;
+#endif
+    if (!Data) throw std::bad_alloc();
+    return Data;
+}
+
+// The sized forms forward to the unsized ones
+HEAP_NOINLINE void operator delete(void* Data) noexcept { std::free(Data); }
+void operator delete(void* Data, size_t) noexcept { ::operator delete(Data); }
+#ifdef _WIN32
+HEAP_NOINLINE void operator delete(void* Data, std::align_val_t) noexcept { _aligned_free(Data); }
+#else
+HEAP_NOINLINE void operator delete(void* Data, std::align_val_t) noexcept { std::free(Data); }
+#endif
+void operator delete(void* Data, size_t, std::align_val_t Align) noexcept { ::operator delete(Data, Align); }
+
+// -------------------- Profiler --------------------
+enum ProfilePhases
+{
+    PhaseUpdate,
+    PhaseBroadphase,
+    PhaseCollision,
+    PhaseContacts,
+    PhaseExchange,
+    PhaseRenderPrep,
+    PhaseDraw,
+    PhaseHash,
+    PhaseSort,
+    PhaseTurbulence,   // inside PhaseUpdate
+    PhaseCount
+};
+const char* ProfilePhaseNames[PhaseCount] = { "Recycle + update", "Broadphase build", "Collision", "Contact solve", "Halo exchange", "Render prep", "Draw", "State hash", "Morton sort", "  - turbulence" };
+
+struct Profiler
+{
+    // Time spent in each phase this step, summed over every thread that worked on it
+    std::atomic<long long> PhaseNs[PhaseCount] = {};
+    // Smoothed values shown in the panel
+    double PhaseMs[PhaseCount] = {};
+    double StepMs = 0.0;
+
+    // NUMA: what the particle chunk tasks of each node streamed this step, and
+    // how many of them ran on a thread from another node
+    std::atomic<long long> NodeBytes[NumaMaxNodes] = {};
+    std::atomic<long long> NodeBusyNs[NumaMaxNodes] = {};
+    std::atomic<long long> NodeChunks[NumaMaxNodes] = {};
+    std::atomic<long long> NodeRemoteChunks[NumaMaxNodes] = {};
+    double NodeGBs[NumaMaxNodes] = {};          // bytes per busy second, smoothed
+    double NodeRemoteShare[NumaMaxNodes] = {};
+    double NodeLocalPages[NumaMaxNodes] = {};   // share of the node's particle pages that live on it
+
+    // Heap allocations between BeginStep and FinishStep. Counts the whole
+    // process, so other threads' allocations (a sweep, the UI) land here too.
+    long long HeapMark = 0;
+    long long StepAllocations = 0;
+    long long QuietSteps = 0;   // steps in a row without any
+};
+
+struct ProfileScope
+{
+    ProfileScope(Profiler& Target, ProfilePhases ScopePhase) : Owner(Target), Phase(ScopePhase), Start(std::chrono::steady_clock::now()) {}
+    ~ProfileScope() { Owner.PhaseNs[Phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count(); }
+    Profiler& Owner;
+    ProfilePhases Phase;
+    std::chrono::steady_clock::time_point Start;
+};
+
+// -------------------- Simulation Context --------------------
+// Everything a single run owns. Nothing in the simulation touches globals, so
+// any number of contexts can be stepped side by side on different threads.
+// The window drives MainSimulation, sweep workers build their own.
+struct SimulationContext
+{
+    Vector2 ScreenSize = { 1400, 1000 };
+    int ParticleAmount = 25;
+    int ParticleDistanceX = 20;
+
+    // ------------------All wind speed shit--------------
+    float dt = 0.1f;
+    float f = 0.0f;
+    float k = 0.1f;
+    float dPdx = 0.0f;
+    float dPdy = 0.0f;
+    float u = 0.0f;
+    float v = 0.0f;
+    WindSources WindSource = UniformWind;
+    QuadtreeField WindField;
+    VortexWake Wake;
+    WindIntegrators Integrator = EulerIntegrator;
+    // Carry (u, v) from step to step instead of restarting from the sliders
+    bool EvolveWind = false;
+    float WindSpeed = 0.0f;   // this step's, set by AdvanceWind
+    // Pressure map loaded with --pressure, see PressureField.h. While it's on,
+    // particles take dPdx and dPdy from it instead of the sliders. Read only,
+    // so every sweep run shares the one the command line loaded.
+    std::shared_ptr<const PressureGradient> Pressure;
+    bool UsePressureField = false;
+    LocalWindStep LocalWind;
+    TurbulenceLayer Turbulence;
+    // Which terms this step's kernels include, see SelectStepKernel
+    unsigned KernelFlags = KernelVariants - 1;
+
+    ParticleVector ParticleList;
+    std::vector<Object> ObjectList;
+    // Scalar policy of the particle kernels, see Precision.h. Float runs the
+    // stock kernels on ParticleList, the others keep their own store and
+    // ParticleList becomes its float view
+    PrecisionModes Precision = SinglePrecision;
+    PrecisionState<DoublePolicy> DoubleState;
+    PrecisionState<HalfPolicy> HalfState;
+
+    // Contact counters, bumped by CheckCollision
+    std::atomic<long long> ObjectCollisions{ 0 };
+    std::atomic<long long> ParticleCollisions{ 0 };
+
+    // With a job system the step runs as a task graph over particle chunks,
+    // without one everything stays on the calling thread
+    JobSystem* Jobs = nullptr;
+    TaskGraph StepGraph;
+    BroadphaseModes Broadphase = BruteForceBroadphase;
+    UniformGrid Grid;
+    VerletLists Verlet;
+    SweepAndPrune SweepPrune;
+    ContactSolver Contacts;
+    ObjectLoads Loads;
+    Profiler Profile;
+    // Sort particles into Morton order every SortInterval steps, 0 never.
+    // Contacts resolve in index order, so a sort changes the outcome (and
+    // the state hash), not just how fast the step runs.
+    int SortInterval = 0;
+    MortonSort Morton;
+    // Set when particle storage is split over NUMA nodes, see EnableNumaPlacement
+    NumaPlacement* Numa = nullptr;
+    // Set when this process only simulates one strip of the screen, see StartStripDomain
+    StripDomain* Domain = nullptr;
+    // Scratch for the step's tasks, one arena per thread, dropped in FinishStep
+    ArenaSet Arenas;
+
+    // Pipelined frames: the renderer draws Frames[DrawFrame] (step N) while the
+    // graph fills the other one with step N+1
+    bool Pipelined = false;
+    // Frames hold compact particles instead of finished triangles
+    bool CompactFrames = false;
+    FrameSnapshot Frames[2];
+    int DrawFrame = 0;
+
+    // Input from other threads waits here for the next step boundary
+    std::mutex InputMutex;
+    std::vector<PendingInput> PendingInputs;
+    std::ofstream InputLog;
+
+    // Deterministic mode: collisions resolve against a snapshot of the step's
+    // start so the result doesn't depend on visiting order, and the whole state
+    // gets hashed after every step
+    bool Deterministic = false;
+    long long StepIndex = 0;
+    uint64_t StateHash = 0;
+    ParticleVector CollisionSnapshot;
+    std::ofstream HashLog;
+
+    // Brush for the next object placed with G
+    float R = 0.0f;
+    float G = 0.0f;
+    float B = 0.0f;
+    float Size = 0.0f;
+    int CurrentObjectType = 0;
+};
+
+// Charges a particle chunk's traffic to the node that owns it
+struct NumaChunkScope
+{
+    NumaChunkScope(SimulationContext& Sim, int Begin, int End, size_t BytesPerParticle)
+        : Owner(Sim), Start(std::chrono::steady_clock::now())
+    {
+        if (!Sim.Numa) return;
+        Node = Sim.Numa->NodeOf((int)Sim.ParticleList.size(), Begin);
+        Bytes = (long long)(End - Begin) * (long long)BytesPerParticle;
+    }
+    ~NumaChunkScope()
+    {
+        if (Node < 0) return;
+        Profiler& Profile = Owner.Profile;
+        Profile.NodeBytes[Node] += Bytes;
+        Profile.NodeBusyNs[Node] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+        Profile.NodeChunks[Node]++;
+        if (Owner.Jobs && Owner.Jobs->CurrentNode() != Node)
+            Profile.NodeRemoteChunks[Node]++;
+    }
+    SimulationContext& Owner;
+    std::chrono::steady_clock::time_point Start;
+    int Node = -1;
+    long long Bytes = 0;
+};
 
 // -------------------- Globals --------------------
-Vector2 ScreenSize = { 1400, 1000 };
+SimulationContext MainSimulation;
 GLFWwindow* window = nullptr;
-std::vector<Particle> ParticleList;
-std::vector<Object> ObjectList;
 std::vector<ObjectTypes> ObjectType = {Circle,Square,Triangle };
 std::vector<std::string> ObjectTypeString = { "Cricle", "Square", "Triangle" };
-int CurrentObjectType = 0;
-
-int ParticleAmount = 25;
-int ParticleDistanceX = 20;
 
 
 
 //Functions
 float WindSpeedEquation(float u, float v, float rho, float dPdx, float dPdy, float f, float k, float dt);
-void UpdateWindParticles();
-void DrawWindParticles();
+WindPropagator MakeWindPropagator(float f, float k, float dt);
+Vector2D IntegrateWind(const SimulationContext& Sim);
+void AdvanceWind(SimulationContext& Sim);
+bool PressureFieldActive(const SimulationContext& Sim);
+void PrepareLocalWind(SimulationContext& Sim);
+float LocalWindSpeed(const SimulationContext& Sim, float X, float Y);
+bool TurbulenceActive(const SimulationContext& Sim);
+void PrepareTurbulence(SimulationContext& Sim);
+void ApplyTurbulence(SimulationContext& Sim, int Begin, int End);
+void RenderIMGUI(SimulationContext& Sim);
+void UpdateWindParticles(SimulationContext& Sim, int Begin = 0, int End = -1);
+void RecycleWindParticles(SimulationContext& Sim, int Begin = 0, int End = -1);
+void StepSimulation(SimulationContext& Sim);
+void PrepareWindField(SimulationContext& Sim);
+void BuildQuadtreeField(QuadtreeField& Field, const std::vector<Object>& Objects, Vector2 ScreenSize);
+void UpdateQuadtreeWindParticles(SimulationContext& Sim, int Begin, int End);
+void AdvanceVortexWake(SimulationContext& Sim);
+void UpdateVortexWindParticles(SimulationContext& Sim, int Begin, int End);
+void BuildStepGraph(SimulationContext& Sim, FrameSnapshot* Target);
+std::chrono::steady_clock::time_point BeginStep(SimulationContext& Sim);
+void FinishStep(SimulationContext& Sim, std::chrono::steady_clock::time_point Start);
+void PrepareParticleBatch(const ParticleVector& Particles, BatchVector& Batch, int Begin, int End);
+void DrawParticleBatch(const BatchVector& Batch);
+void DrawBatchVertices(const float* Data, int Vertices);
+void DrawFrameParticles(FrameSnapshot& Frame);
+void SetCompactDomain(CompactParticles& Compact, Vector2 ScreenSize);
+void EncodeParticles(const ParticleVector& Particles, CompactParticles& Compact, int Begin, int End);
+void DecodeParticles(const CompactParticles& Compact, ParticleVector& Particles, int Begin, int End);
+void PrintCompactReport(const SimulationContext& Sim);
+void DrawWindParticles(SimulationContext& Sim);
 Vector2D CheckCursorInWindow();
-void DrawObjects();
-void AddObjectWINDOWS();
-void CheckCollision();
+void DrawObjects(SimulationContext& Sim);
+void DrawObjectList(const std::vector<Object>& ObjectList);
+#ifdef _WIN32
+void AddObjectWINDOWS(SimulationContext& Sim);
+#endif
+void AddObjectAtCursor(SimulationContext& Sim);
+void CheckCollision(SimulationContext& Sim);
+void CheckCollisionRange(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers = nullptr);
+void BuildUniformGrid(UniformGrid& Grid, const ParticleVector& Particles, float CellSize);
+void PrepareBroadphase(SimulationContext& Sim, const ParticleVector& Others);
+void FlagVerletDisplacement(SimulationContext& Sim, const ParticleVector& Others, int Begin, int End);
+void BuildVerletRows(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers);
+void SortSweepAxis(SweepAndPrune& Sweep, const ParticleVector& Others);
+bool PositionBasedContacts(const SimulationContext& Sim);
+void ReserveContacts(ContactSolver& Solver, int ParticleCount);
+struct StepKernel
+{
+    unsigned Flags;
+    float (*WindSpeed)(const SimulationContext& Sim);
+    void (*Collide)(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers);
+};
+const StepKernel& ActiveStepKernel(const SimulationContext& Sim);
+void SelectStepKernel(SimulationContext& Sim);
+std::string StepKernelName(unsigned Flags);
+bool PrecisionKernels(const SimulationContext& Sim);
+void SyncPrecisionStore(SimulationContext& Sim);
+void SnapshotPrecisionRange(SimulationContext& Sim, int Begin, int End);
+void UpdatePrecisionParticles(SimulationContext& Sim, int Begin, int End);
+void CollidePrecisionParticles(SimulationContext& Sim, int Begin, int End, bool FromSnapshot);
+void PrepareObjectLoads(SimulationContext& Sim);
+void ReduceObjectLoads(SimulationContext& Sim);
+void AccumulateObjectLoads(SimulationContext& Sim);
+void PrintObjectLoads(const SimulationContext& Sim);
+void ColourContacts(ContactSolver& Solver, int ParticleCount);
+void SolveContacts(SimulationContext& Sim);
+void MaybeSortParticles(SimulationContext& Sim);
+void SortParticlesMorton(SimulationContext& Sim);
+double MeasureNeighborLocality(SimulationContext& Sim);
+void QueueInput(SimulationContext& Sim, const PendingInput& Input);
+void ApplyPendingInput(SimulationContext& Sim);
+uint64_t ComputeStateHash(const SimulationContext& Sim);
+uint64_t ComputeStateHash(const ParticleVector& Particles, const std::vector<Object>& Objects);
+bool LoadInputReplay(SimulationContext& Sim, const char* Path);
+int RunSweep(const char* SpecPath, const char* OutPath, int ThreadCount, std::shared_ptr<const PressureGradient> Pressure);
+int RunRegression(const char* Directory, bool UpdateGolden, double TimeThreshold, float StateTolerance, JobSystem* Jobs, NumaPlacement* Numa);
+int RunBroadphaseBenchmark(int Scale, JobSystem* Jobs, NumaPlacement* Numa);
+void EnableNumaPlacement(SimulationContext& Sim, NumaPlacement* Numa);
+void MeasurePageLocality(SimulationContext& Sim);
+void PrintNumaReport(const SimulationContext& Sim);
+void PrintHugePageReport(const SimulationContext& Sim);
+int RunPageBenchmark(int Scale);
+int RunPrecisionBenchmark(int Scale, JobSystem* Jobs);
+int RunVortexBenchmark(int Scale, JobSystem* Jobs);
+bool StartStripDomain(SimulationContext& Sim, StripDomain& Domain, int Ranks);
+void StopStripDomain(SimulationContext& Sim);
+void KeepOwnStrip(SimulationContext& Sim);
+void RenderStrips(SimulationContext& Sim);
+int RunHeadlessCapture(SimulationContext& Sim, const char* Directory, CaptureFormats Format, int Frames);
 // -------------------- Functions --------------------
-GLFWwindow* StartGLFW() {
+GLFWwindow* StartGLFW(Vector2 ScreenSize, bool Headless = false) {
+#ifdef GLFW_PLATFORM_NULL
+    // No display server needed: GLFW's null platform plus an OSMesa (llvmpipe) context
+    if (Headless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW\n";
         return nullptr;
@@ -83,6 +782,12 @@ GLFWwindow* StartGLFW() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
     // Removed Core profile hint
+    if (Headless) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
 
     GLFWwindow* w = glfwCreateWindow((int)ScreenSize.x, (int)ScreenSize.y, "Wind Particle Demo", NULL, NULL);
     if (!w) {
@@ -92,7 +797,7 @@ GLFWwindow* StartGLFW() {
     }
 
     glfwMakeContextCurrent(w);
-    glfwSwapInterval(1); 
+    glfwSwapInterval(Headless ? 0 : 1);
     return w;
 }
 
@@ -108,11 +813,22 @@ void DrawCircle(float x, float y, float radius, int segments) {
     glEnd();
 }
 
-void DrawWindParticles() {
-    for (Particle& p : ParticleList) {
-        glColor3f(p.color.R, p.color.G, p.color.B);
+void DrawWindParticles(SimulationContext& Sim) {
+    for (Particle& p : Sim.ParticleList) {
+        const RGB& Color = ParticlePalette[p.State];
+        glColor3f(Color.R, Color.G, Color.B);
         DrawCircle(p.X, p.Y, 5, 100);
-        if (p.X > ScreenSize.x)
+    }
+}
+
+// Particles that blew off the right edge start over on the left
+void RecycleWindParticles(SimulationContext& Sim, int Begin, int End) {
+    // The precision kernels recycle in their own store
+    if (PrecisionKernels(Sim)) return;
+    if (End < 0) End = (int)Sim.ParticleList.size();
+    for (int i = Begin; i < End; i++) {
+        Particle& p = Sim.ParticleList[i];
+        if (p.X > Sim.ScreenSize.x)
         {
             p.X = 0;
             p.Y = p.OringialY;
@@ -120,295 +836,4253 @@ void DrawWindParticles() {
     }
 }
 
-void Render() {
-    DrawWindParticles(); DrawObjects(); UpdateWindParticles(); CheckCollision();
+// One simulation step without any drawing, shared by the window and the sweep runner
+void StepSimulation(SimulationContext& Sim) {
+    auto Start = BeginStep(Sim);
+    ApplyPendingInput(Sim);
+    MaybeSortParticles(Sim);
+    SyncPrecisionStore(Sim);
+    SelectStepKernel(Sim);
+    AdvanceWind(Sim);
+    PrepareWindField(Sim);
+    if (Sim.Jobs) {
+        BuildStepGraph(Sim, nullptr);
+        Sim.StepGraph.Run();
+    }
+    else {
+        {
+            ProfileScope Scope(Sim.Profile, PhaseUpdate);
+            RecycleWindParticles(Sim); UpdateWindParticles(Sim);
+        }
+        CheckCollision(Sim);
+    }
+    FinishStep(Sim, Start);
 }
 
-bool PopulateParticleList() {
-    float padding = ScreenSize.y / static_cast<float>(ParticleAmount);
-    for (int j = 0; j < ScreenSize.x / ParticleDistanceX; j++)
-    {
-        for (int i = 0; i < ParticleAmount; i++) {
-            Particle p;
-            p.Y = padding * i + 50;
-            p.OringialY = p.Y;
-            p.X = 0 -(j * ParticleDistanceX); // start on the left
-            p.color = { 0.0745f, 0.2745f, 0.0667f };
-            ParticleList.push_back(p);
+void Render(SimulationContext& Sim) {
+    if (Sim.Domain) {
+        RenderStrips(Sim);
+        return;
+    }
+    if (!Sim.Jobs) {
+        {
+            ProfileScope Scope(Sim.Profile, PhaseDraw);
+            DrawWindParticles(Sim); DrawObjects(Sim);
         }
+        StepSimulation(Sim);
+        return;
     }
 
-    return true;
-}
+    auto Start = BeginStep(Sim);
+    ApplyPendingInput(Sim);
+    MaybeSortParticles(Sim);
+    SyncPrecisionStore(Sim);
+    SelectStepKernel(Sim);
+    AdvanceWind(Sim);
+    PrepareWindField(Sim);
 
-void UpdateWindParticles()
-{
-    for (int i = 0; i < ParticleList.size(); i++)
+    if (Sim.Pipelined) {
+        // Step N+1 is simulated into one snapshot while step N is drawn from the
+        // other, so a frame costs max(sim, render) instead of the sum. What's on
+        // screen is one step behind the live state.
+        FrameSnapshot& Next = Sim.Frames[1 - Sim.DrawFrame];
+        BuildStepGraph(Sim, &Next);
+        Sim.StepGraph.Start();
+        {
+            ProfileScope Scope(Sim.Profile, PhaseDraw);
+            FrameSnapshot& Current = Sim.Frames[Sim.DrawFrame];
+            DrawFrameParticles(Current);
+            DrawObjectList(Current.ObjectList);
+        }
+        Sim.StepGraph.Wait();
+        Sim.DrawFrame = 1 - Sim.DrawFrame;
+        FinishStep(Sim, Start);
+        return;
+    }
+
+    // Objects get drawn on this thread while the workers step the particles,
+    // then the particles come out of the batch the render prep tasks built
+    FrameSnapshot& Frame = Sim.Frames[Sim.DrawFrame];
+    BuildStepGraph(Sim, &Frame);
+    Sim.StepGraph.Start();
     {
-        Particle& CurrentParticle = ParticleList[i];
-        CurrentParticle.Velocity.x = WindSpeedEquation(u, v, 1.225f, dPdx, dPdy, f, k, dt);
-        CurrentParticle.X += CurrentParticle.Velocity.x;
+        ProfileScope Scope(Sim.Profile, PhaseDraw);
+        DrawObjects(Sim);
+    }
+    Sim.StepGraph.Wait();
+    {
+        ProfileScope Scope(Sim.Profile, PhaseDraw);
+        DrawFrameParticles(Frame);
     }
+    FinishStep(Sim, Start);
 }
-// Wind speed equation
-float WindSpeedEquation(float u, float v, float rho, float dPdx, float dPdy, float f, float k, float dt) {
-    float du_dt = f * v - (1.0f / rho) * dPdx - k * u;
-    float dv_dt = -f * u - (1.0f / rho) * dPdy - k * v;
-
-    float u_new = u + du_dt * dt;
-    float v_new = v + dv_dt * dt;
 
-    return std::sqrt(u_new * u_new + v_new * v_new);
+// Readies the step arenas and marks the heap counter, returns the step's start time
+std::chrono::steady_clock::time_point BeginStep(SimulationContext& Sim) {
+    Sim.Arenas.Resize(Sim.Jobs);
+    Sim.Profile.HeapMark = HeapAllocations.load(std::memory_order_relaxed);
+    return std::chrono::steady_clock::now();
 }
 
-// -------------------- Main --------------------
-int main() {
-    srand((unsigned)time(0));
+// Bookkeeping after every step: step counter, state hash, profiler rollover
+void FinishStep(SimulationContext& Sim, std::chrono::steady_clock::time_point Start) {
+    Sim.StepIndex++;
+    Sim.Arenas.ResetAll();
+    // Strip ranks reduced theirs before publishing, see StepStrip
+    if (!Sim.Domain)
+        ReduceObjectLoads(Sim);
+    AccumulateObjectLoads(Sim);
 
-    // Initialize GLFW and window
-    window = StartGLFW();
-    std::thread Contols(AddObjectWINDOWS);
-    Contols.detach();
-    if (!window) return -1;
+    // With strips only rank 0 sees the whole state
+    if (Sim.Deterministic && (!Sim.Domain || Sim.Domain->Rank == 0)) {
+        ProfileScope Scope(Sim.Profile, PhaseHash);
+        Sim.StateHash = Sim.Domain ? ComputeStateHash(Sim.Domain->Gathered, Sim.ObjectList) : ComputeStateHash(Sim);
+        if (Sim.HashLog.is_open()) {
+            char Line[64];
+            std::snprintf(Line, sizeof(Line), "%lld %016" PRIx64 "\n", Sim.StepIndex, Sim.StateHash);
+            Sim.HashLog << Line;
+        }
+    }
 
-    // Setup OpenGL 2D projection
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, ScreenSize.x, 0, ScreenSize.y, -1, 1);
-    glMatrixMode(GL_MODELVIEW);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    Profiler& Profile = Sim.Profile;
+    for (int i = 0; i < PhaseCount; i++)
+        Profile.PhaseMs[i] = Profile.PhaseMs[i] * 0.9 + Profile.PhaseNs[i].exchange(0) * 1e-6 * 0.1;
+    double StepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    Profile.StepMs = Profile.StepMs * 0.9 + StepMs * 0.1;
+    Profile.StepAllocations = HeapAllocations.load(std::memory_order_relaxed) - Profile.HeapMark;
+    Profile.QuietSteps = Profile.StepAllocations ? 0 : Profile.QuietSteps + 1;
 
-    PopulateParticleList();
+    if (Sim.Numa) {
+        for (int n = 0; n < Sim.Numa->NodeCount(); n++) {
+            long long Bytes = Profile.NodeBytes[n].exchange(0);
+            long long BusyNs = Profile.NodeBusyNs[n].exchange(0);
+            long long Chunks = Profile.NodeChunks[n].exchange(0);
+            long long Remote = Profile.NodeRemoteChunks[n].exchange(0);
+            if (BusyNs > 0)
+                Profile.NodeGBs[n] = Profile.NodeGBs[n] * 0.9 + (double)Bytes / BusyNs * 0.1;
+            if (Chunks > 0)
+                Profile.NodeRemoteShare[n] = Profile.NodeRemoteShare[n] * 0.9 + (double)Remote / Chunks * 0.1;
+        }
+        // Pages can migrate behind our back (automatic NUMA balancing), so check now and then
+        if (Sim.StepIndex % 120 == 1)
+            MeasurePageLocality(Sim);
+    }
+}
 
-    // -------------------- ImGui Setup --------------------
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
+// -------------------- Particle Batch --------------------
+// Every particle becomes a small triangle fan flattened into a triangle list,
+// interleaved x, y, r, g, b, so the whole lot is one glDrawArrays
+const int BatchSegments = 16;
+const int BatchVerticesPerParticle = BatchSegments * 3;
+const int BatchFloatsPerVertex = 5;
 
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 120"); // OpenGL 2.1 uses GLSL 1.20
+// Writes one particle's fan at Out and returns the end of it
+inline float* EmitParticleFan(float* Out, float X, float Y, const RGB& Color) {
+    struct CircleTable { float Cos[BatchSegments + 1], Sin[BatchSegments + 1]; };
+    static const CircleTable Table = [] {
+        CircleTable t;
+        for (int i = 0; i <= BatchSegments; i++) {
+            t.Cos[i] = cosf(i * 2.0f * 3.14159265f / BatchSegments);
+            t.Sin[i] = sinf(i * 2.0f * 3.14159265f / BatchSegments);
+        }
+        return t;
+    }();
 
-    // -------------------- Main Loop --------------------
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+    const float Radius = 5.0f;
+    for (int s = 0; s < BatchSegments; s++) {
+        float Corners[3][2] = {
+            { X, Y },
+            { X + Radius * Table.Cos[s], Y + Radius * Table.Sin[s] },
+            { X + Radius * Table.Cos[s + 1], Y + Radius * Table.Sin[s + 1] },
+        };
+        for (int c = 0; c < 3; c++) {
+            *Out++ = Corners[c][0];
+            *Out++ = Corners[c][1];
+            *Out++ = Color.R;
+            *Out++ = Color.G;
+            *Out++ = Color.B;
+        }
+    }
+    return Out;
+}
 
-        // Clear screen
-        glClear(GL_COLOR_BUFFER_BIT);
+void PrepareParticleBatch(const ParticleVector& Particles, BatchVector& Batch, int Begin, int End) {
+    float* Out = Batch.data() + (size_t)Begin * BatchVerticesPerParticle * BatchFloatsPerVertex;
+    for (int i = Begin; i < End; i++)
+        Out = EmitParticleFan(Out, Particles[i].X, Particles[i].Y, ParticlePalette[Particles[i].State]);
+}
 
-        // Render particles
-        Render();
+void DrawParticleBatch(const BatchVector& Batch) {
+    DrawBatchVertices(Batch.data(), (int)(Batch.size() / BatchFloatsPerVertex));
+}
 
-        // Render ImGui
-        RenderIMGUI();
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+void DrawBatchVertices(const float* Data, int Vertices) {
+    if (Vertices == 0) return;
 
-        glfwSwapBuffers(window);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, BatchFloatsPerVertex * sizeof(float), Data);
+    glColorPointer(3, GL_FLOAT, BatchFloatsPerVertex * sizeof(float), Data + 2);
+    glDrawArrays(GL_TRIANGLES, 0, Vertices);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Draws whichever kind of frame the render prep tasks filled
+void DrawFrameParticles(FrameSnapshot& Frame) {
+    if (!Frame.IsCompact) {
+        DrawParticleBatch(Frame.ParticleBatch);
+        return;
     }
 
-    // -------------------- Cleanup --------------------
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
-    glfwDestroyWindow(window);
-    glfwTerminate();
-    return 0;
+    // Expand a block at a time, so the triangles never exist for the whole population
+    const CompactParticles& Compact = Frame.Compact;
+    const int Block = 1024;
+    float X[Block], Y[Block];
+    Frame.ParticleBatch.resize((size_t)Block * BatchVerticesPerParticle * BatchFloatsPerVertex);
+    for (int Begin = 0; Begin < (int)Compact.Size(); Begin += Block) {
+        int Count = std::min(Block, (int)Compact.Size() - Begin);
+        DequantizeFixed16(Compact.X.data() + Begin, X, 1, Count, Compact.OriginX, Compact.StepX);
+        DequantizeFixed16(Compact.Y.data() + Begin, Y, 1, Count, Compact.OriginY, Compact.StepY);
+        float* Out = Frame.ParticleBatch.data();
+        for (int i = 0; i < Count; i++)
+            Out = EmitParticleFan(Out, X[i], Y[i], ParticlePalette[Compact.State[Begin + i]]);
+        DrawBatchVertices(Frame.ParticleBatch.data(), Count * BatchVerticesPerParticle);
+    }
 }
 
+// -------------------- Compact Particles --------------------
+// Particles can sit up to a screen off either side (spawn columns start left
+// of the window, pushes can shove them past an edge), so the fixed-point range
+// covers three screens: ~0.064 px steps across a 1400 px window.
+static_assert(sizeof(Particle) % sizeof(float) == 0, "the kernels walk Particle fields in float strides");
+const size_t ParticleStride = sizeof(Particle) / sizeof(float);
 
-void RenderIMGUI() {
+void SetCompactDomain(CompactParticles& Compact, Vector2 ScreenSize) {
+    Compact.OriginX = -ScreenSize.x;
+    Compact.OriginY = -ScreenSize.y;
+    Compact.StepX = 3.0f * ScreenSize.x / 65535.0f;
+    Compact.StepY = 3.0f * ScreenSize.y / 65535.0f;
+}
 
+// Particles [Begin, End) into the same slots of Compact, which must be big enough
+void EncodeParticles(const ParticleVector& Particles, CompactParticles& Compact, int Begin, int End) {
+    if (Begin >= End) return;
+    const Particle* First = &Particles[Begin];
+    size_t Count = (size_t)(End - Begin);
+    QuantizeFixed16(&First->X, ParticleStride, Compact.X.data() + Begin, Count, Compact.OriginX, Compact.StepX);
+    QuantizeFixed16(&First->Y, ParticleStride, Compact.Y.data() + Begin, Count, Compact.OriginY, Compact.StepY);
+    QuantizeFixed16(&First->OringialY, ParticleStride, Compact.OriginalY.data() + Begin, Count, Compact.OriginY, Compact.StepY);
+    FloatsToHalves(&First->Velocity.x, ParticleStride, Compact.VelocityX.data() + Begin, Count);
+    FloatsToHalves(&First->Velocity.y, ParticleStride, Compact.VelocityY.data() + Begin, Count);
+    for (int i = Begin; i < End; i++)
+        Compact.State[i] = Particles[i].State;
+}
 
-    // Start ImGui frame
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+void DecodeParticles(const CompactParticles& Compact, ParticleVector& Particles, int Begin, int End) {
+    if (Begin >= End) return;
+    Particle* First = &Particles[Begin];
+    size_t Count = (size_t)(End - Begin);
+    DequantizeFixed16(Compact.X.data() + Begin, &First->X, ParticleStride, Count, Compact.OriginX, Compact.StepX);
+    DequantizeFixed16(Compact.Y.data() + Begin, &First->Y, ParticleStride, Count, Compact.OriginY, Compact.StepY);
+    DequantizeFixed16(Compact.OriginalY.data() + Begin, &First->OringialY, ParticleStride, Count, Compact.OriginY, Compact.StepY);
+    HalvesToFloats(Compact.VelocityX.data() + Begin, &First->Velocity.x, ParticleStride, Count);
+    HalvesToFloats(Compact.VelocityY.data() + Begin, &First->Velocity.y, ParticleStride, Count);
+    for (int i = Begin; i < End; i++)
+        Particles[i].State = (ParticleStates)Compact.State[i];
+}
 
-    // ImGui window
-    ImGui::Begin("Wind Controls");
-    ImGui::SliderFloat("dt", &dt, 0.01f, 1.0f);
-    ImGui::SliderFloat("Coriolis f", &f, -1.0f, 1.0f);
-    ImGui::SliderFloat("Friction k", &k, 0.0f, 1.0f);
-    ImGui::SliderFloat("Pressure dPdx", &dPdx, -10.0f, 10.0f);
-    ImGui::SliderFloat("Pressure dPdy", &dPdy, -10.0f, 10.0f);
+// Bytes per particle for each representation, plus the round-trip error on the current state
+void PrintCompactReport(const SimulationContext& Sim) {
+    int Count = (int)Sim.ParticleList.size();
+    CompactParticles Compact;
+    SetCompactDomain(Compact, Sim.ScreenSize);
+    for (std::vector<uint16_t>* Field : { &Compact.X, &Compact.Y, &Compact.OriginalY, &Compact.VelocityX, &Compact.VelocityY })
+        Field->resize(Count);
+    Compact.State.resize(Count);
+    EncodeParticles(Sim.ParticleList, Compact, 0, Count);
+    ParticleVector Decoded(Count);
+    DecodeParticles(Compact, Decoded, 0, Count);
 
+    float PositionError = 0.0f, VelocityError = 0.0f;
+    for (int i = 0; i < Count; i++) {
+        const Particle& a = Sim.ParticleList[i];
+        const Particle& b = Decoded[i];
+        PositionError = std::max({ PositionError, std::fabs(a.X - b.X), std::fabs(a.Y - b.Y), std::fabs(a.OringialY - b.OringialY) });
+        VelocityError = std::max({ VelocityError, std::fabs(a.Velocity.x - b.Velocity.x), std::fabs(a.Velocity.y - b.Velocity.y) });
+    }
 
-    ImGui::SliderFloat("R", &R, 0.0f, 1.0f);
-    ImGui::SliderFloat("G", &G, 0.0f, 1.0f);
-    ImGui::SliderFloat("B", &B, 0.0f, 1.0f);
-    ImGui::SliderFloat("Size", &Size, 0.0f, 100.0f);
-    ImGui::Text("Wind Speed: %.3f m/s", WindSpeedEquation(u, v, 1.225f, dPdx, dPdy, f, k, dt));
+    size_t Live = sizeof(Particle), Packed = CompactParticles::BytesPerParticle();
+    size_t Frame = BatchVerticesPerParticle * BatchFloatsPerVertex * sizeof(float);
+    std::printf("Particle memory: %zu B live, %zu B compact (%.0f%% less); frame %zu B as triangles, %zu B compact\n",
+        Live, Packed, 100.0 * (1.0 - (double)Packed / Live), Frame, Packed);
+    std::printf("Compact round trip over %d particles: position error %.4f px, velocity error %.4g\n", Count, PositionError, VelocityError);
+}
 
+// -------------------- Task Graph Step --------------------
+// Least particle traffic each chunk task causes, for the per-node bandwidth
+// counters. Software estimates, so neighbour reads and cache misses aren't in it.
+const size_t UpdateBytesPerParticle = 3 * sizeof(Particle);  // read, write, snapshot copy
+const size_t CollideBytesPerParticle = 2 * sizeof(Particle);
+const size_t RenderPrepBytesPerParticle = sizeof(Particle) + BatchVerticesPerParticle * BatchFloatsPerVertex * sizeof(float);
+const size_t CompactPrepBytesPerParticle = sizeof(Particle) + CompactParticles::BytesPerParticle();
 
+// Chunks over all particles. With NUMA placement each node's slice is chunked
+// on its own and tagged with the node, so a chunk never straddles two nodes
+// and only that node's threads run it.
+template <typename F>
+TaskRange AddParticleChunks(SimulationContext& Sim, const char* Name, int ChunkSize, const F& Fn)
+{
+    TaskGraph& Graph = Sim.StepGraph;
+    int Count = (int)Sim.ParticleList.size();
+    if (!Sim.Numa || !Sim.Numa->Active())
+        return Graph.AddChunks(Name, Count, ChunkSize, Fn);
 
-    if (ImGui::BeginCombo("ObjectType", ObjectTypeString[CurrentObjectType].c_str())) // label + preview
-    {
-        for (int n = 0; n < ObjectType.size(); n++)
-        {
-            bool isSelected = (CurrentObjectType == n);
-            if (ImGui::Selectable(ObjectTypeString[n].c_str(), isSelected))
-                CurrentObjectType = n;
+    TaskRange Range;
+    Range.First = Graph.Size();
+    for (int n = 0; n < Sim.Numa->NodeCount(); n++)
+        Range.Count += Graph.AddChunkRange(Name, Sim.Numa->SliceBegin(Count, n), Sim.Numa->SliceBegin(Count, n + 1), ChunkSize, Fn, n).Count;
+    return Range;
+}
 
-            if (isSelected)
-                ImGui::SetItemDefaultFocus();
+// The same step as the serial path, split over particle chunks:
+//   Update[c] (recycle, wind, snapshot copy) -> Broadphase -> Collide[c] -> (Contacts) -> RenderPrep[c]
+// Collisions always read the snapshot here, so a chunk never sees another
+// chunk's half-finished writes and the result doesn't depend on thread count.
+// With a Target, the render prep tasks and an object copy fill it for drawing.
+void BuildStepGraph(SimulationContext& Sim, FrameSnapshot* Target) {
+    TaskGraph& Graph = Sim.StepGraph;
+    Graph.Reset(*Sim.Jobs);
+
+    int Count = (int)Sim.ParticleList.size();
+    int ChunkSize = std::max(64, Count / (Sim.Jobs->ThreadCount() * 4) + 1);
+    Sim.CollisionSnapshot.resize(Count);
+    if (Target) {
+        Target->IsCompact = Sim.CompactFrames;
+        if (Target->IsCompact) {
+            SetCompactDomain(Target->Compact, Sim.ScreenSize);
+            for (std::vector<uint16_t>* Field : { &Target->Compact.X, &Target->Compact.Y, &Target->Compact.OriginalY, &Target->Compact.VelocityX, &Target->Compact.VelocityY })
+                Field->resize(Count);
+            Target->Compact.State.resize(Count);
         }
-        ImGui::EndCombo();
+        else
+            Target->ParticleBatch.resize((size_t)Count * BatchVerticesPerParticle * BatchFloatsPerVertex);
     }
 
+    SimulationContext* S = &Sim;
+    TaskRange Update = AddParticleChunks(Sim, "Update", ChunkSize, [S](int Begin, int End) {
+        ProfileScope Scope(S->Profile, PhaseUpdate);
+        NumaChunkScope Traffic(*S, Begin, End, UpdateBytesPerParticle);
+        RecycleWindParticles(*S, Begin, End);
+        UpdateWindParticles(*S, Begin, End);
+        std::copy(S->ParticleList.begin() + Begin, S->ParticleList.begin() + End, S->CollisionSnapshot.begin() + Begin);
+        SnapshotPrecisionRange(*S, Begin, End);
+        if (S->Broadphase == VerletListBroadphase)
+            FlagVerletDisplacement(*S, S->CollisionSnapshot, Begin, End);
+    });
 
-    if (ImGui::Button("Clear Objects"))
-    {
-        ObjectList.clear();
-    }
+    TaskHandle Broadphase = Graph.Add("Broadphase", [S]() {
+        ProfileScope Scope(S->Profile, PhaseBroadphase);
+        PrepareBroadphase(*S, S->CollisionSnapshot);
+    });
 
+    TaskRange Collide = AddParticleChunks(Sim, "Collide", ChunkSize, [S](int Begin, int End) {
+        NumaChunkScope Traffic(*S, Begin, End, CollideBytesPerParticle);
+        CheckCollisionRange(*S, Begin, End, S->CollisionSnapshot);
+    });
 
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
-    ImGui::End();
+    Graph.Precede(Update, Broadphase);
+    Graph.Precede(Broadphase, Collide);
 
-}
+    // Position based contacts need every pair before solving any, so one task
+    // sits between the collide and render prep chunks and fans out per colour
+    TaskHandle Contacts = -1;
+    if (PositionBasedContacts(Sim)) {
+        Contacts = Graph.Add("Contacts", [S]() {
+            SolveContacts(*S);
+        });
+        Graph.Precede(Collide, Contacts);
+    }
 
+    if (Target) {
+        TaskRange Prep = AddParticleChunks(Sim, "RenderPrep", ChunkSize, [S, Target](int Begin, int End) {
+            ProfileScope Scope(S->Profile, PhaseRenderPrep);
+            NumaChunkScope Traffic(*S, Begin, End, Target->IsCompact ? CompactPrepBytesPerParticle : RenderPrepBytesPerParticle);
+            if (Target->IsCompact)
+                EncodeParticles(S->ParticleList, Target->Compact, Begin, End);
+            else
+                PrepareParticleBatch(S->ParticleList, Target->ParticleBatch, Begin, End);
+        });
+        if (Contacts >= 0)
+            Graph.Precede(Contacts, Prep);
+        else
+            Graph.PrecedeEach(Collide, Prep);
 
-void AddObjectWINDOWS()
-{
-    //Windows Verison of Adding Objects
-    //Windows Verison of Adding Objects
-    //Windows Verison of Adding Objects
-    while (true)
-    {
-        if (GetAsyncKeyState('G') & 0x8000)
-        {
-            Object Item;
-            Vector2D Pos = CheckCursorInWindow();
-            Item.X = Pos.x;
-            Item.Y = Pos.y;
-            Item.color = { R, G, B };
-            Item.ObjectType = ObjectType[CurrentObjectType];
-            Item.Size = Size;
-            ObjectList.push_back(Item);
-            std::cout << "added color " << R << ":" << G << ":" << B << std::endl;
-            std::cout << "Shouldve added the object hah" << std::endl;
-            std::this_thread::sleep_for(std::chrono::milliseconds(10)); // ~60 FPS check        }
-        }
+        // Objects only change between steps, so this can run alongside everything else
+        Graph.Add("SnapshotObjects", [S, Target]() {
+            Target->ObjectList = S->ObjectList;
+        });
     }
 }
 
-
-
-
-void DrawObjects()
-{
-    for (int i = 0; i < ObjectList.size(); i++)
+bool PopulateParticleList(SimulationContext& Sim) {
+    const int ParticleAmount = Sim.ParticleAmount;
+    const int ParticleDistanceX = Sim.ParticleDistanceX;
+    float padding = Sim.ScreenSize.y / static_cast<float>(ParticleAmount);
+    // One allocation up front, so placed storage is first-touched once
+    Sim.ParticleList.reserve(Sim.ParticleList.size() + (size_t)(Sim.ScreenSize.x / ParticleDistanceX + 1) * ParticleAmount);
+    for (int j = 0; j < Sim.ScreenSize.x / ParticleDistanceX; j++)
     {
-        Object& CurrentObject = ObjectList[i];
-        switch (CurrentObject.ObjectType)
-        {
-        case ObjectTypes::Circle:
-            glColor3f(CurrentObject.color.R, CurrentObject.color.G, CurrentObject.color.B);
-            DrawCircle(CurrentObject.X, CurrentObject.Y, CurrentObject.Size, 100);
-            break;
+        for (int i = 0; i < ParticleAmount; i++) {
+            Particle p;
+            p.Y = padding * i + 50;
+            p.OringialY = p.Y;
+            p.X = 0 -(j * ParticleDistanceX); // start on the left
+            Sim.ParticleList.push_back(p);
         }
     }
+
+    // With strips every rank builds the same list and keeps its part
+    if (Sim.Domain)
+        KeepOwnStrip(Sim);
+    return true;
 }
 
+void UpdateWindParticles(SimulationContext& Sim, int Begin, int End)
+{
+    if (End < 0) End = (int)Sim.ParticleList.size();
+    if (PrecisionKernels(Sim)) {
+        UpdatePrecisionParticles(Sim, Begin, End);
+        return;
+    }
+    if (Sim.WindSource == QuadtreeWind) {
+        UpdateQuadtreeWindParticles(Sim, Begin, End);
+    }
+    else if (Sim.WindSource == VortexWind) {
+        UpdateVortexWindParticles(Sim, Begin, End);
+    }
+    else if (PressureFieldActive(Sim)) {
+        for (int i = Begin; i < End; i++)
+        {
+            Particle& CurrentParticle = Sim.ParticleList[i];
+            CurrentParticle.Velocity.x = LocalWindSpeed(Sim, CurrentParticle.X, CurrentParticle.Y);
+            CurrentParticle.X += CurrentParticle.Velocity.x;
+        }
+    }
+    else {
+        for (int i = Begin; i < End; i++)
+        {
+            Particle& CurrentParticle = Sim.ParticleList[i];
+            CurrentParticle.Velocity.x = Sim.WindSpeed;
+            CurrentParticle.X += CurrentParticle.Velocity.x;
+        }
+    }
+    if (TurbulenceActive(Sim))
+        ApplyTurbulence(Sim, Begin, End);
+}
+// Wind speed equation
+float WindSpeedEquation(float u, float v, float rho, float dPdx, float dPdy, float f, float k, float dt) {
+    float du_dt = f * v - (1.0f / rho) * dPdx - k * u;
+    float dv_dt = -f * u - (1.0f / rho) * dPdy - k * v;
+
+    float u_new = u + du_dt * dt;
+    float v_new = v + dv_dt * dt;
+
+    return std::sqrt(u_new * u_new + v_new * v_new);
+}
+
+// exp(A dt) for A = [[-k, f], [-f, -k]], and A^-1 (exp(A dt) - I) for the
+// forcing, which tends to dt I as k and f go to zero
+WindPropagator MakeWindPropagator(float f, float k, float dt) {
+    WindPropagator Step;
+    double Decay = std::exp(-(double)k * dt);
+    double c = Decay * std::cos((double)f * dt);
+    double s = Decay * std::sin((double)f * dt);
+    Step.Decay[0][0] = (float)c;  Step.Decay[0][1] = (float)s;
+    Step.Decay[1][0] = (float)-s; Step.Decay[1][1] = (float)c;
+
+    double Det = (double)k * k + (double)f * f;
+    if (Det * dt * dt < 1e-12) {
+        Step.Forcing[0][0] = dt; Step.Forcing[0][1] = 0.0f;
+        Step.Forcing[1][0] = 0.0f; Step.Forcing[1][1] = dt;
+        return Step;
+    }
+    // A^-1 = [[-k, -f], [f, -k]] / Det, times (exp(A dt) - I)
+    double e00 = c - 1.0, e01 = s, e10 = -s, e11 = c - 1.0;
+    Step.Forcing[0][0] = (float)((-k * e00 - f * e10) / Det);
+    Step.Forcing[0][1] = (float)((-k * e01 - f * e11) / Det);
+    Step.Forcing[1][0] = (float)((f * e00 - k * e10) / Det);
+    Step.Forcing[1][1] = (float)((f * e01 - k * e11) / Det);
+    return Step;
+}
+
+// (u, v) one dt after the current state, with the selected integrator
+Vector2D IntegrateWind(const SimulationContext& Sim) {
+    const float rho = 1.225f;
+    if (Sim.Integrator == EulerIntegrator) {
+        float du_dt = Sim.f * Sim.v - (1.0f / rho) * Sim.dPdx - Sim.k * Sim.u;
+        float dv_dt = -Sim.f * Sim.u - (1.0f / rho) * Sim.dPdy - Sim.k * Sim.v;
+        return { Sim.u + du_dt * Sim.dt, Sim.v + dv_dt * Sim.dt };
+    }
+    WindPropagator Step = MakeWindPropagator(Sim.f, Sim.k, Sim.dt);
+    float Fx = -(1.0f / rho) * Sim.dPdx;
+    float Fy = -(1.0f / rho) * Sim.dPdy;
+    return {
+        Step.Decay[0][0] * Sim.u + Step.Decay[0][1] * Sim.v + Step.Forcing[0][0] * Fx + Step.Forcing[0][1] * Fy,
+        Step.Decay[1][0] * Sim.u + Step.Decay[1][1] * Sim.v + Step.Forcing[1][0] * Fx + Step.Forcing[1][1] * Fy,
+    };
+}
+
+// Once at the top of every step: the speed every particle moves at this step,
+// and with EvolveWind the new state
+void AdvanceWind(SimulationContext& Sim) {
+    if (PressureFieldActive(Sim))
+        PrepareLocalWind(Sim);
+    if (Sim.Integrator == EulerIntegrator && !Sim.EvolveWind) {
+        Sim.WindSpeed = ActiveStepKernel(Sim).WindSpeed(Sim);
+        return;
+    }
+    Vector2D Next = IntegrateWind(Sim);
+    Sim.WindSpeed = (float)std::sqrt(Next.x * Next.x + Next.y * Next.y);
+    if (Sim.EvolveWind) {
+        Sim.u = (float)Next.x;
+        Sim.v = (float)Next.y;
+    }
+}
+
+// -------------------- Pressure Field --------------------
+bool PressureFieldActive(const SimulationContext& Sim) {
+    return Sim.UsePressureField && Sim.Pressure && !Sim.Pressure->Empty();
+}
+
+// The part of this step's wind that doesn't depend on where a particle is
+void PrepareLocalWind(SimulationContext& Sim) {
+    LocalWindStep& Step = Sim.LocalWind;
+    if (Sim.Integrator == EulerIntegrator) {
+        Step.BaseU = Sim.u + (Sim.f * Sim.v - Sim.k * Sim.u) * Sim.dt;
+        Step.BaseV = Sim.v + (-Sim.f * Sim.u - Sim.k * Sim.v) * Sim.dt;
+        Step.Forcing[0][0] = Sim.dt; Step.Forcing[0][1] = 0.0f;
+        Step.Forcing[1][0] = 0.0f;   Step.Forcing[1][1] = Sim.dt;
+        return;
+    }
+    WindPropagator Propagator = MakeWindPropagator(Sim.f, Sim.k, Sim.dt);
+    Step.BaseU = Propagator.Decay[0][0] * Sim.u + Propagator.Decay[0][1] * Sim.v;
+    Step.BaseV = Propagator.Decay[1][0] * Sim.u + Propagator.Decay[1][1] * Sim.v;
+    std::memcpy(Step.Forcing, Propagator.Forcing, sizeof(Step.Forcing));
+}
+
+// Wind speed at (X, Y) with the gradient there in place of the sliders'
+float LocalWindSpeed(const SimulationContext& Sim, float X, float Y) {
+    const float rho = 1.225f;
+    float dPdx, dPdy;
+    SamplePressureGradient(*Sim.Pressure, X, Y, dPdx, dPdy);
+    const LocalWindStep& Step = Sim.LocalWind;
+    float Fx = -(1.0f / rho) * dPdx;
+    float Fy = -(1.0f / rho) * dPdy;
+    float u_new = Step.BaseU + Step.Forcing[0][0] * Fx + Step.Forcing[0][1] * Fy;
+    float v_new = Step.BaseV + Step.Forcing[1][0] * Fx + Step.Forcing[1][1] * Fy;
+    return std::sqrt(u_new * u_new + v_new * v_new);
+}
+
+// -------------------- Turbulence --------------------
+bool TurbulenceActive(const SimulationContext& Sim) {
+    return Sim.Turbulence.Enabled && Sim.Turbulence.Amplitude != 0.0f;
+}
+
+// Once per step: the cache covers the screen and one eddy past every edge.
+// The time comes from the step index, so strips and reruns see the same field.
+void PrepareTurbulence(SimulationContext& Sim) {
+    if (!TurbulenceActive(Sim)) return;
+    TurbulenceLayer& Layer = Sim.Turbulence;
+    float Margin = Layer.Scale;
+    Layer.Cache.Configure(-Margin, -Margin, Sim.ScreenSize.x + 2 * Margin, Sim.ScreenSize.y + 2 * Margin, Layer.Scale);
+    long long Key = Sim.StepIndex / std::max(1, Layer.RefreshSteps);
+    Layer.Cache.SetTime(Key, (float)(Key * std::max(1, Layer.RefreshSteps)) * Layer.Rate);
+}
+
+// Adds the curl noise to this step's velocity and position. A separate pass
+// after the wind, so the wind loops stay as they were.
+void ApplyTurbulence(SimulationContext& Sim, int Begin, int End) {
+    ProfileScope Scope(Sim.Profile, PhaseTurbulence);
+    TurbulenceLayer& Layer = Sim.Turbulence;
+    // Only the quadtree and the wake give particles a vertical wind of their own
+    bool KeepY = Sim.WindSource != UniformWind;
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& CurrentParticle = Sim.ParticleList[i];
+        float FlowX, FlowY;
+        Layer.Cache.Sample(CurrentParticle.X, CurrentParticle.Y, FlowX, FlowY);
+        FlowX *= Layer.Amplitude;
+        FlowY *= Layer.Amplitude;
+        CurrentParticle.Velocity.x += FlowX;
+        CurrentParticle.Velocity.y = (KeepY ? CurrentParticle.Velocity.y : 0.0f) + FlowY;
+        CurrentParticle.X += FlowX;
+        CurrentParticle.Y += FlowY;
+    }
+}
+
+// -------------------- Main --------------------
+// Position of Value among the words a flag accepts, listed in its enum's
+// order. Anything else prints what the flag takes and gives -1.
+int ParseChoice(const std::string& Flag, const std::string& Value, std::initializer_list<const char*> Choices)
+{
+    int Index = 0;
+    for (const char* Choice : Choices) {
+        if (Value == Choice)
+            return Index;
+        Index++;
+    }
+    std::cerr << "Unknown " << Flag << " '" << Value << "', expected one of:";
+    for (const char* Choice : Choices)
+        std::cerr << " " << Choice;
+    std::cerr << "\n";
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    // Headless parameter sweep: wind.exe --sweep spec.txt [--out results.csv] [--threads N] [--pressure map]
+    // Frame capture:              wind.exe --capture dir [--capture-format png|ppm] [--frames N] [--headless]
+    // Reproducible runs:          wind.exe --deterministic [--hash-log hashes.txt] [--record-input in.txt | --replay-input in.txt]
+    // Regression check:           wind.exe --regress dir [--update-golden] [--time-threshold 1.15] [--state-tolerance 0.01]
+    // --pipelined draws step N while step N+1 is simulated (needs more than one thread)
+    // --compact keeps frames as 11-byte quantized particles instead of triangles (needs more than one thread)
+    // --threads N sets the worker count everywhere (sweep runs, or the step task graph); 1 runs single threaded
+    // --ranks N simulates N vertical strips in N processes sharing memory (Linux); rank 0 shows the window
+    // Broadphase comparison:      wind.exe --bench [--bench-scale N] (regression scenes, N times the particles)
+    // Page size comparison:       wind.exe --bench-pages [--bench-scale N] (TLB misses and step time per page mode)
+    // Precision comparison:       wind.exe --bench-precision [--bench-scale N] (step time and drift from double per policy)
+    // Vortex summation:           wind.exe --bench-vortex [--bench-scale N] (Barnes-Hut and multipole against direct, error per order)
+    // --broadphase brute|grid|verlet|sap picks the contact search (default brute); --verlet-skin PX sets the list margin
+    // --precision float|double|half picks the particle kernels' scalar policy (default float, strips always float)
+    // --pressure map.pgm|map.pfm|map.raw replaces the dPdx/dPdy sliders with the map's gradient; --pressure-range P
+    //   is what the map's full scale means (default 1000), --pressure-size W H gives a raw file's size
+    // --turbulence AMP adds curl noise pushing up to AMP px per step; --turbulence-scale PX sets the eddy size (default 120)
+    // --integrator euler|exp steps the wind ODE (default euler); --evolve-wind carries (u, v) over from step to step
+    // --wind uniform|amr|vortex picks the wind field (default uniform); --amr-depth N sets the quadtree's finest level
+    // --vortex-theta T sets the wake's Barnes-Hut opening angle (default 0.5, 0 sums every vortex)
+    // --vortex-fmm P evaluates the wake with a fast multipole pass of order P instead
+    // --contacts snap|pbd picks the particle contact response (default snap); --contact-iterations N caps the pbd iterations (default 96)
+    // --sort-interval N sorts particles into Morton order every N steps (default 0, off)
+    // --huge-pages off|thp|explicit backs particle storage with 2 MB pages where the OS allows (default off)
+    // --numa pins workers to NUMA nodes and places each node's particles on it; --numa-nodes N fakes N nodes
+    const char* SweepSpec = nullptr;
+    const char* SweepOut = "sweep_results.csv";
+    int ThreadCount = 0;
+    const char* CaptureDir = nullptr;
+    CaptureFormats CaptureFormat = CapturePNG;
+    int CaptureFrames = 0;
+    bool Headless = false;
+    const char* HashLogPath = nullptr;
+    const char* RecordInputPath = nullptr;
+    const char* ReplayInputPath = nullptr;
+    const char* RegressDir = nullptr;
+    bool UpdateGolden = false;
+    double TimeThreshold = 1.15;
+    float StateTolerance = 0.01f;
+    bool UseNuma = false;
+    int EmulateNodes = 0;
+    int Ranks = 1;
+    int SortInterval = 0;
+    BroadphaseModes Broadphase = BruteForceBroadphase;
+    bool Bench = false;
+    bool BenchPages = false;
+    bool BenchPrecision = false;
+    bool BenchVortex = false;
+    const char* PressurePath = nullptr;
+    int PressureWidth = 0, PressureHeight = 0;
+    float PressureRange = 1000.0f;
+    int BenchScale = 1;
+    HugePageModes HugePages = HugePagesOff;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string Arg = argv[i];
+        if (Arg == "--sweep" && i + 1 < argc) SweepSpec = argv[++i];
+        else if (Arg == "--out" && i + 1 < argc) SweepOut = argv[++i];
+        else if (Arg == "--threads" && i + 1 < argc) ThreadCount = std::atoi(argv[++i]);
+        else if (Arg == "--capture" && i + 1 < argc) CaptureDir = argv[++i];
+        else if (Arg == "--capture-format" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "ppm", "png" });
+            if (Mode < 0) return 1;
+            CaptureFormat = (CaptureFormats)Mode;
+        }
+        else if (Arg == "--frames" && i + 1 < argc) CaptureFrames = std::atoi(argv[++i]);
+        else if (Arg == "--headless") Headless = true;
+        else if (Arg == "--pipelined") MainSimulation.Pipelined = true;
+        else if (Arg == "--compact") MainSimulation.CompactFrames = true;
+        else if (Arg == "--deterministic") MainSimulation.Deterministic = true;
+        else if (Arg == "--hash-log" && i + 1 < argc) HashLogPath = argv[++i];
+        else if (Arg == "--record-input" && i + 1 < argc) RecordInputPath = argv[++i];
+        else if (Arg == "--replay-input" && i + 1 < argc) ReplayInputPath = argv[++i];
+        else if (Arg == "--regress" && i + 1 < argc) RegressDir = argv[++i];
+        else if (Arg == "--update-golden") UpdateGolden = true;
+        else if (Arg == "--time-threshold" && i + 1 < argc) TimeThreshold = std::atof(argv[++i]);
+        else if (Arg == "--state-tolerance" && i + 1 < argc) StateTolerance = (float)std::atof(argv[++i]);
+        else if (Arg == "--ranks" && i + 1 < argc) Ranks = std::atoi(argv[++i]);
+        else if (Arg == "--broadphase" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "brute", "grid", "verlet", "sap" });
+            if (Mode < 0) return 1;
+            Broadphase = (BroadphaseModes)Mode;
+        }
+        else if (Arg == "--integrator" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "euler", "exp" });
+            if (Mode < 0) return 1;
+            MainSimulation.Integrator = (WindIntegrators)Mode;
+        }
+        else if (Arg == "--evolve-wind") MainSimulation.EvolveWind = true;
+        else if (Arg == "--pressure" && i + 1 < argc) PressurePath = argv[++i];
+        else if (Arg == "--pressure-range" && i + 1 < argc) PressureRange = (float)std::atof(argv[++i]);
+        else if (Arg == "--pressure-size" && i + 2 < argc) {
+            PressureWidth = std::atoi(argv[++i]);
+            PressureHeight = std::atoi(argv[++i]);
+        }
+        else if (Arg == "--turbulence" && i + 1 < argc) {
+            MainSimulation.Turbulence.Enabled = true;
+            MainSimulation.Turbulence.Amplitude = (float)std::atof(argv[++i]);
+        }
+        else if (Arg == "--turbulence-scale" && i + 1 < argc) MainSimulation.Turbulence.Scale = std::max(1.0f, (float)std::atof(argv[++i]));
+        else if (Arg == "--wind" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "uniform", "amr", "vortex" });
+            if (Mode < 0) return 1;
+            MainSimulation.WindSource = (WindSources)Mode;
+        }
+        else if (Arg == "--vortex-theta" && i + 1 < argc) MainSimulation.Wake.Theta = std::max(0.0f, (float)std::atof(argv[++i]));
+        else if (Arg == "--vortex-fmm" && i + 1 < argc) {
+            MainSimulation.Wake.Evaluator = MultipoleEvaluator;
+            MainSimulation.Wake.Multipole.Order = std::min(std::max(1, std::atoi(argv[++i])), FastMultipole::MaxOrder);
+        }
+        else if (Arg == "--amr-depth" && i + 1 < argc) MainSimulation.WindField.MaxDepth = std::atoi(argv[++i]);
+        else if (Arg == "--contacts" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "snap", "pbd" });
+            if (Mode < 0) return 1;
+            MainSimulation.Contacts.Solver = (ContactSolvers)Mode;
+        }
+        else if (Arg == "--contact-iterations" && i + 1 < argc) MainSimulation.Contacts.Iterations = std::max(1, std::atoi(argv[++i]));
+        else if (Arg == "--verlet-skin" && i + 1 < argc) MainSimulation.Verlet.Skin = std::max(0.1f, (float)std::atof(argv[++i]));
+        else if (Arg == "--bench") Bench = true;
+        else if (Arg == "--bench-pages") BenchPages = true;
+        else if (Arg == "--bench-precision") BenchPrecision = true;
+        else if (Arg == "--bench-vortex") BenchVortex = true;
+        else if (Arg == "--precision" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "float", "double", "half" });
+            if (Mode < 0) return 1;
+            MainSimulation.Precision = (PrecisionModes)Mode;
+        }
+        else if (Arg == "--huge-pages" && i + 1 < argc) {
+            int Mode = ParseChoice(Arg, argv[++i], { "off", "thp", "explicit" });
+            if (Mode < 0) return 1;
+            HugePages = (HugePageModes)Mode;
+        }
+        else if (Arg == "--bench-scale" && i + 1 < argc) BenchScale = std::max(1, std::atoi(argv[++i]));
+        else if (Arg == "--sort-interval" && i + 1 < argc) SortInterval = std::max(0, std::atoi(argv[++i]));
+        else if (Arg == "--numa") UseNuma = true;
+        else if (Arg == "--numa-nodes" && i + 1 < argc) { UseNuma = true; EmulateNodes = std::atoi(argv[++i]); }
+    }
+    // Before the strips fork, so every rank starts with the gradient
+    if (PressurePath) {
+        auto Start = std::chrono::steady_clock::now();
+        std::string Error;
+        auto Gradient = std::make_shared<PressureGradient>();
+        if (!LoadPressureGradient(PressurePath, PressureWidth, PressureHeight, PressureRange, MainSimulation.ScreenSize.x,
+                MainSimulation.ScreenSize.y, *Gradient, Error)) {
+            std::cerr << "Pressure field: " << Error << "\n";
+            return 1;
+        }
+        MainSimulation.Pressure = Gradient;
+        MainSimulation.UsePressureField = true;
+        std::cout << "Pressure field: " << Gradient->Width << " x " << Gradient->Height << ", "
+                  << Gradient->Bytes() / 1048576.0 << " MB of gradient, loaded in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count() << " ms\n";
+    }
+
+    // Sweeps run one whole simulation per thread, everything else splits each step over the pool
+    if (SweepSpec)
+        return RunSweep(SweepSpec, SweepOut, ThreadCount, MainSimulation.Pressure);
+
+    // Strip processes fork before any thread, window or log file exists
+    StripDomain Domain;
+    if (Ranks > 1 && !RegressDir && !Bench && !BenchPages && !BenchPrecision && !BenchVortex && !StartStripDomain(MainSimulation, Domain, Ranks))
+        return 1;
+
+    // Strips are one process per core, so they don't get a pool
+    bool Pooled = ThreadCount != 1 && !MainSimulation.Domain;
+    std::unique_ptr<JobSystem> Jobs;
+    std::unique_ptr<NumaPlacement> Numa;
+    if (Pooled && UseNuma) {
+        // Workers spread over the nodes and pinned to their node's CPUs, this
+        // thread on node 0. The placement needs the pool to first-touch with.
+        NumaTopology Topology = DetectNumaTopology(EmulateNodes);
+        int CpuCount = 0;
+        for (const std::vector<int>& Cpus : Topology.NodeCpus)
+            CpuCount += (int)Cpus.size();
+        int WorkerCount = ThreadCount > 1 ? ThreadCount - 1 : std::max(0, CpuCount - 1);
+        std::vector<int> WorkerNodes = AssignWorkerNodes(Topology, WorkerCount);
+        Jobs.reset(new JobSystem(WorkerCount, WorkerNodes, [Topology, WorkerNodes](int Worker) {
+            PinCurrentThread(Topology.NodeCpus[WorkerNodes[Worker]]);
+        }));
+        if (!PinCurrentThread(Topology.NodeCpus[0]))
+            std::cerr << "Could not pin threads, NUMA placement is best effort\n";
+        JobSystem::SetCurrentThreadNode(0);
+        Numa.reset(new NumaPlacement(Topology, Jobs.get(), HugePages));
+        EnableNumaPlacement(MainSimulation, Numa.get());
+    }
+    else if (Pooled)
+        Jobs.reset(new JobSystem(ThreadCount > 1 ? ThreadCount - 1 : -1));
+    // Huge pages without NUMA: a one-node placement that only picks the pages
+    if (!Numa && HugePages != HugePagesOff) {
+        JobSystem::SetCurrentThreadNode(0);
+        Numa.reset(new NumaPlacement(SingleNodeTopology(), Jobs.get(), HugePages));
+        EnableNumaPlacement(MainSimulation, Numa.get());
+    }
+    MainSimulation.Jobs = Jobs.get();
+    MainSimulation.Broadphase = Broadphase;
+    MainSimulation.SortInterval = SortInterval;
+
+    if (BenchPages)
+        return RunPageBenchmark(BenchScale);
+    if (BenchPrecision)
+        return RunPrecisionBenchmark(BenchScale, Jobs.get());
+    if (BenchVortex)
+        return RunVortexBenchmark(BenchScale, Jobs.get());
+    if (Bench)
+        return RunBroadphaseBenchmark(BenchScale, Jobs.get(), Numa.get());
+    if (RegressDir)
+        return RunRegression(RegressDir, UpdateGolden, TimeThreshold, StateTolerance, Jobs.get(), Numa.get());
+    if (HashLogPath) {
+        MainSimulation.HashLog.open(HashLogPath);
+        MainSimulation.Deterministic = true;
+    }
+    if (RecordInputPath)
+        MainSimulation.InputLog.open(RecordInputPath);
+    if (ReplayInputPath && !LoadInputReplay(MainSimulation, ReplayInputPath))
+        return 1;
+    if (Headless) {
+        int Result = RunHeadlessCapture(MainSimulation, CaptureDir ? CaptureDir : "capture", CaptureFormat, CaptureFrames > 0 ? CaptureFrames : 300);
+        StopStripDomain(MainSimulation);
+        return Result;
+    }
+
+    srand((unsigned)time(0));
+
+    // Initialize GLFW and window
+    window = StartGLFW(MainSimulation.ScreenSize);
+#ifdef _WIN32
+    std::thread Contols(AddObjectWINDOWS, std::ref(MainSimulation));
+    Contols.detach();
+#endif
+    if (!window) return -1;
+
+    // Setup OpenGL 2D projection
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, MainSimulation.ScreenSize.x, 0, MainSimulation.ScreenSize.y, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    PopulateParticleList(MainSimulation);
+
+    // -------------------- ImGui Setup --------------------
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO(); (void)io;
+
+    ImGui::StyleColorsDark();
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 120"); // OpenGL 2.1 uses GLSL 1.20
+
+    // Recording renders the scene offscreen so the ImGui panel stays out of the video
+    FrameCapture Capture;
+    if (CaptureDir)
+        Capture.Init((int)MainSimulation.ScreenSize.x, (int)MainSimulation.ScreenSize.y, CaptureDir, CaptureFormat);
+
+    // -------------------- Main Loop --------------------
+    while (!glfwWindowShouldClose(window)) {
+        glfwPollEvents();
+#ifndef _WIN32
+        if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS)
+            AddObjectAtCursor(MainSimulation);
+#endif
+
+        if (Capture.IsReady() && CaptureFrames > 0 && Capture.FramesCaptured() >= CaptureFrames)
+            Capture.Shutdown();
+        Capture.BeginFrame();
+
+        // Clear screen
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        // Render particles
+        Render(MainSimulation);
+
+        if (Capture.IsReady()) {
+            Capture.EndFrame();
+            int Width, Height;
+            glfwGetFramebufferSize(window, &Width, &Height);
+            Capture.BlitToWindow(Width, Height);
+        }
+
+        // Render ImGui
+        RenderIMGUI(MainSimulation);
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+
+        glfwSwapBuffers(window);
+    }
+
+    // -------------------- Cleanup --------------------
+    StopStripDomain(MainSimulation);
+    Capture.Shutdown();
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
+
+
+void RenderIMGUI(SimulationContext& Sim) {
+
+
+    // Start ImGui frame
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+
+    // ImGui window
+    ImGui::Begin("Wind Controls");
+    ImGui::SliderFloat("dt", &Sim.dt, 0.01f, 1.0f);
+    ImGui::SliderFloat("Coriolis f", &Sim.f, -1.0f, 1.0f);
+    ImGui::SliderFloat("Friction k", &Sim.k, 0.0f, 1.0f);
+    ImGui::SliderFloat("Pressure dPdx", &Sim.dPdx, -10.0f, 10.0f);
+    ImGui::SliderFloat("Pressure dPdy", &Sim.dPdy, -10.0f, 10.0f);
+    if (Sim.Pressure && !Sim.Pressure->Empty()) {
+        ImGui::Checkbox("Pressure map (overrides dPdx/dPdy)", &Sim.UsePressureField);
+        ImGui::SameLine();
+        ImGui::Text("%d x %d", Sim.Pressure->Width, Sim.Pressure->Height);
+    }
+    ImGui::Checkbox("Turbulence", &Sim.Turbulence.Enabled);
+    if (Sim.Turbulence.Enabled) {
+        ImGui::SliderFloat("Turbulence amplitude", &Sim.Turbulence.Amplitude, 0.0f, 5.0f);
+        ImGui::SliderFloat("Turbulence scale", &Sim.Turbulence.Scale, 20.0f, 600.0f);
+    }
+
+
+    ImGui::SliderFloat("R", &Sim.R, 0.0f, 1.0f);
+    ImGui::SliderFloat("G", &Sim.G, 0.0f, 1.0f);
+    ImGui::SliderFloat("B", &Sim.B, 0.0f, 1.0f);
+    ImGui::SliderFloat("Size", &Sim.Size, 0.0f, 100.0f);
+    if (ImGui::BeginCombo("Integrator", WindIntegratorString[Sim.Integrator].c_str()))
+    {
+        for (int n = 0; n < (int)WindIntegratorString.size(); n++)
+        {
+            bool isSelected = (Sim.Integrator == n);
+            if (ImGui::Selectable(WindIntegratorString[n].c_str(), isSelected))
+                Sim.Integrator = (WindIntegrators)n;
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::Checkbox("Evolve wind state", &Sim.EvolveWind);
+    ImGui::SameLine();
+    if (ImGui::Button("Reset wind")) {
+        Sim.u = 0.0f;
+        Sim.v = 0.0f;
+    }
+    ImGui::Text("Wind Speed: %.3f m/s  (u %.3f, v %.3f)", Sim.WindSpeed, Sim.u, Sim.v);
+    if (ImGui::BeginCombo("Wind field", WindSourceString[Sim.WindSource].c_str()))
+    {
+        for (int n = 0; n < (int)WindSourceString.size(); n++)
+        {
+            bool isSelected = (Sim.WindSource == n);
+            if (ImGui::Selectable(WindSourceString[n].c_str(), isSelected))
+                Sim.WindSource = (WindSources)n;
+        }
+        ImGui::EndCombo();
+    }
+    if (Sim.WindSource == QuadtreeWind)
+        ImGui::SliderInt("AMR max depth", &Sim.WindField.MaxDepth, Sim.WindField.MinDepth, 12);
+    if (Sim.WindSource == VortexWind) {
+        if (ImGui::BeginCombo("Wake evaluator", VortexEvaluatorString[Sim.Wake.Evaluator].c_str()))
+        {
+            for (int n = 0; n < (int)VortexEvaluatorString.size(); n++)
+            {
+                bool isSelected = (Sim.Wake.Evaluator == n);
+                if (ImGui::Selectable(VortexEvaluatorString[n].c_str(), isSelected))
+                    Sim.Wake.Evaluator = (VortexEvaluators)n;
+            }
+            ImGui::EndCombo();
+        }
+        if (Sim.Wake.Evaluator == MultipoleEvaluator)
+            ImGui::SliderInt("Expansion order", &Sim.Wake.Multipole.Order, 1, 30);
+        else
+            ImGui::SliderFloat("Opening angle", &Sim.Wake.Theta, 0.0f, 1.2f);
+        ImGui::SliderFloat("Vortex core", &Sim.Wake.Core, 1.0f, 30.0f, "%.1f px");
+        if (ImGui::Button("Clear wake"))
+        {
+            PendingInput Input;
+            Input.ClearWake = true;
+            QueueInput(Sim, Input);
+        }
+    }
+
+    if (ImGui::BeginCombo("Broadphase", BroadphaseModeString[Sim.Broadphase].c_str()))
+    {
+        for (int n = 0; n < (int)BroadphaseModeString.size(); n++)
+        {
+            bool isSelected = (Sim.Broadphase == n);
+            if (ImGui::Selectable(BroadphaseModeString[n].c_str(), isSelected))
+                Sim.Broadphase = (BroadphaseModes)n;
+        }
+        ImGui::EndCombo();
+    }
+    if (Sim.Broadphase == VerletListBroadphase)
+        ImGui::SliderFloat("Verlet skin", &Sim.Verlet.Skin, 0.5f, 20.0f, "%.1f px");
+    if (ImGui::BeginCombo("Contacts", ContactSolverString[Sim.Contacts.Solver].c_str()))
+    {
+        for (int n = 0; n < (int)ContactSolverString.size(); n++)
+        {
+            bool isSelected = (Sim.Contacts.Solver == n);
+            if (ImGui::Selectable(ContactSolverString[n].c_str(), isSelected))
+                Sim.Contacts.Solver = (ContactSolvers)n;
+        }
+        ImGui::EndCombo();
+    }
+    if (Sim.Contacts.Solver == PositionBasedContactSolver)
+        ImGui::SliderInt("Contact iterations", &Sim.Contacts.Iterations, 1, 2 * ContactIterations);
+    ImGui::SliderInt("Morton sort every", &Sim.SortInterval, 0, 600, Sim.SortInterval ? "%d steps" : "off");
+    ImGui::Checkbox("Deterministic", &Sim.Deterministic);
+    if (Sim.Jobs)
+    {
+        ImGui::Checkbox("Pipelined frames", &Sim.Pipelined);
+        ImGui::Checkbox("Compact frames", &Sim.CompactFrames);
+    }
+    if (Sim.Deterministic)
+        ImGui::Text("Step %lld  hash %016" PRIx64, Sim.StepIndex, Sim.StateHash);
+
+
+
+    if (ImGui::BeginCombo("ObjectType", ObjectTypeString[Sim.CurrentObjectType].c_str())) // label + preview
+    {
+        for (int n = 0; n < ObjectType.size(); n++)
+        {
+            bool isSelected = (Sim.CurrentObjectType == n);
+            if (ImGui::Selectable(ObjectTypeString[n].c_str(), isSelected))
+                Sim.CurrentObjectType = n;
+
+            if (isSelected)
+                ImGui::SetItemDefaultFocus();
+        }
+        ImGui::EndCombo();
+    }
+
+
+    if (ImGui::Button("Clear Objects"))
+    {
+        PendingInput Input;
+        Input.Clear = true;
+        QueueInput(Sim, Input);
+    }
+
+
+    ImGuiIO& io = ImGui::GetIO(); (void)io;
+    ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+    ImGui::End();
+
+    // Phase times are summed over every thread, so with a pool they can add up to more than the step
+    ImGui::Begin("Profiler");
+    ImGui::Text("Threads: %d", Sim.Jobs ? Sim.Jobs->ThreadCount() : 1);
+    ImGui::Text("Step: %.3f ms", Sim.Profile.StepMs);
+    ImGui::Text("Per particle: %zu B live, %zu B compact; frames %zu B", sizeof(Particle), CompactParticles::BytesPerParticle(),
+        Sim.CompactFrames ? CompactParticles::BytesPerParticle() : BatchVerticesPerParticle * BatchFloatsPerVertex * sizeof(float));
+    ImGui::Text("Step kernel: %s", StepKernelName(Sim.KernelFlags).c_str());
+    if (PrecisionKernels(Sim))
+        ImGui::Text("Precision: %s kernels, %zu B per particle in their store", PrecisionModeNames[Sim.Precision],
+            Sim.Precision == DoublePrecision ? PrecisionStore<DoublePolicy>::BytesPerParticle() : PrecisionStore<HalfPolicy>::BytesPerParticle());
+    ImGui::Text("Heap allocations: %lld last step, none for %lld steps (arenas %.1f KB)", Sim.Profile.StepAllocations,
+        Sim.Profile.QuietSteps, Sim.Arenas.Capacity() / 1024.0);
+    for (int i = 0; i < PhaseCount; i++)
+        ImGui::Text("%-18s %8.3f ms", ProfilePhaseNames[i], Sim.Profile.PhaseMs[i]);
+    if (TurbulenceActive(Sim))
+        ImGui::Text("Turbulence: %.1f ns per particle, %d tiles of %.0f px cells, %lld refills",
+            Sim.Profile.PhaseMs[PhaseTurbulence] * 1e6 / std::max<size_t>(1, Sim.ParticleList.size()), Sim.Turbulence.Cache.TileCount(),
+            Sim.Turbulence.Cache.LatticeSpacing(), Sim.Turbulence.Cache.Refills());
+    if (Sim.Morton.Sorts > 0)
+        ImGui::Text("Neighbour index distance %.1f (%.1f before the last of %lld sorts, %.3f ms)", Sim.Morton.Locality,
+            Sim.Morton.LocalityBefore, Sim.Morton.Sorts, Sim.Morton.LastSortMs);
+    else
+        ImGui::Text("Neighbour index distance %.1f", Sim.Morton.Locality);
+    if (Sim.Broadphase == VerletListBroadphase && Sim.Verlet.Steps > 0) {
+        const VerletLists& Verlet = Sim.Verlet;
+        ImGui::Text("Verlet lists: rebuilt %.1f%% of steps (%lld of %lld), %.1f pairs per particle, %lld pushed out of the skin", Verlet.RebuildRate * 100.0,
+            Verlet.Rebuilds, Verlet.Steps, Verlet.Rows.empty() ? 0.0 : (double)Verlet.Pairs / Verlet.Rows.size(), Verlet.Escapes.load());
+    }
+    if (Sim.Broadphase == SweepAndPruneBroadphase && Sim.SweepPrune.Steps > 0)
+        ImGui::Text("Sweep and prune: %.2f moves per particle, %lld full sorts in %lld steps", Sim.SweepPrune.MovesPerParticle,
+            Sim.SweepPrune.FullSorts, Sim.SweepPrune.Steps);
+    if (Sim.WindSource == QuadtreeWind && Sim.WindField.Builds > 0) {
+        const QuadtreeField& Field = Sim.WindField;
+        ImGui::Text("Wind quadtree: %zu leaves, %.2f%% of a uniform %d x %d grid, %.3f ms to build", Field.Keys.size(),
+            100.0 * Field.Keys.size() / std::pow(4.0, Field.MaxDepth), 1 << Field.MaxDepth, 1 << Field.MaxDepth, Field.LastBuildMs);
+        ImGui::Text("Leaf lookups answered by the cached leaf: %.1f%%", Field.HitRate * 100.0);
+    }
+    if (Sim.WindSource == VortexWind && Sim.Wake.Evaluator == MultipoleEvaluator)
+        ImGui::Text("Vortex wake: %zu vortices (%lld shed), order %d multipole over %d levels, %.3f ms per pass", Sim.Wake.Vortices.Size(),
+            Sim.Wake.Shed, Sim.Wake.Multipole.Order, Sim.Wake.Multipole.LevelCount(), Sim.Wake.LastBuildMs);
+    else if (Sim.WindSource == VortexWind)
+        ImGui::Text("Vortex wake: %zu vortices (%lld shed), %d tree cells, %.3f ms to build", Sim.Wake.Vortices.Size(), Sim.Wake.Shed,
+            Sim.Wake.Tree.NodeCount(), Sim.Wake.LastBuildMs);
+    if (PositionBasedContacts(Sim))
+        ImGui::Text("Contacts: %zu pairs in %d colours, %.1f iterations, %.3f px deepest overlap in the last pass", Sim.Contacts.Pairs.size(),
+            Sim.Contacts.Colours, Sim.Contacts.MeanIterations, Sim.Contacts.Residual);
+    if (!Sim.Loads.Totals.empty()) {
+        // Last step's force, smoothed drag, worst single step, contacts since placed
+        ImGui::Separator();
+        ImGui::Text("Object loads (particle masses x px/step, per step)");
+        if (ImGui::BeginTable("ObjectLoads", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            for (const char* Heading : { "Object", "Fx", "Fy", "Drag", "Peak", "Hits" })
+                ImGui::TableSetupColumn(Heading);
+            ImGui::TableHeadersRow();
+            for (size_t j = 0; j < Sim.Loads.Totals.size(); j++) {
+                const ObjectLoadTotal& Total = Sim.Loads.Totals[j];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::Text("%zu", j);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", Total.Force.x);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", Total.Force.y);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", Total.Drag);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", Total.Peak);
+                ImGui::TableNextColumn(); ImGui::Text("%lld", Total.Contacts);
+            }
+            ImGui::EndTable();
+        }
+    }
+    if (Sim.Domain) {
+        const StripShared& Shared = *Sim.Domain->Shared;
+        long long Migrated = 0, Ghosts = 0;
+        for (int Rank = 0; Rank < Sim.Domain->Ranks; Rank++) {
+            Migrated += Shared.Migrated[Rank];
+            Ghosts += Shared.GhostsSent[Rank];
+        }
+        ImGui::Separator();
+        ImGui::Text("Strips: %d processes, %d px wide", Sim.Domain->Ranks, (int)Sim.Domain->StripWidth);
+        ImGui::Text("Per step: %lld migrated, %lld ghosts", Migrated, Ghosts);
+    }
+    if (Sim.Numa) {
+        // Bandwidth is bytes the node's chunks streamed per second they were busy
+        ImGui::Separator();
+        ImGui::Text("NUMA nodes: %d%s", Sim.Numa->NodeCount(), Sim.Numa->Layout().Emulated ? " (emulated)" : "");
+        for (int n = 0; n < Sim.Numa->NodeCount(); n++) {
+            if (Sim.Profile.NodeLocalPages[n] >= 0.0)
+                ImGui::Text("Node %d %8.3f GB/s  remote %5.1f%%  local pages %5.1f%%", n, Sim.Profile.NodeGBs[n],
+                    Sim.Profile.NodeRemoteShare[n] * 100.0, Sim.Profile.NodeLocalPages[n] * 100.0);
+            else
+                ImGui::Text("Node %d %8.3f GB/s  remote %5.1f%%", n, Sim.Profile.NodeGBs[n], Sim.Profile.NodeRemoteShare[n] * 100.0);
+        }
+    }
+    ImGui::End();
+
+}
+
+
+#ifdef _WIN32
+void AddObjectWINDOWS(SimulationContext& Sim)
+{
+    //Windows Verison of Adding Objects
+    //Windows Verison of Adding Objects
+    //Windows Verison of Adding Objects
+    while (true)
+    {
+        if (GetAsyncKeyState('G') & 0x8000)
+        {
+            AddObjectAtCursor(Sim);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10)); // ~60 FPS check, and don't eat a whole core
+    }
+}
+#endif
+
+// Places an object with the current brush under the mouse
+void AddObjectAtCursor(SimulationContext& Sim)
+{
+    Object Item;
+    Vector2D Pos = CheckCursorInWindow();
+    Item.X = Pos.x;
+    Item.Y = Pos.y;
+    Item.color = { Sim.R, Sim.G, Sim.B };
+    Item.ObjectType = ObjectType[Sim.CurrentObjectType];
+    Item.Size = Sim.Size;
+
+    PendingInput Input;
+    Input.Item = Item;
+    QueueInput(Sim, Input);
+}
+
+
+
+
+void DrawObjects(SimulationContext& Sim)
+{
+    DrawObjectList(Sim.ObjectList);
+}
+
+void DrawObjectList(const std::vector<Object>& ObjectList)
+{
+    for (int i = 0; i < ObjectList.size(); i++)
+    {
+        const Object& CurrentObject = ObjectList[i];
+        switch (CurrentObject.ObjectType)
+        {
+        case ObjectTypes::Circle:
+            glColor3f(CurrentObject.color.R, CurrentObject.color.G, CurrentObject.color.B);
+            DrawCircle(CurrentObject.X, CurrentObject.Y, CurrentObject.Size, 100);
+            break;
+        }
+    }
+}
+
+
+Vector2D CheckCursorInWindow() {
+    if (!window) return { -1, -1 }; // invalid cursor/window
+
+    // Get window size
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+
+    // Get cursor position relative to window
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+
+    // Flip Y coordinate
+    ypos = height - ypos;
+
+    // Check if inside bounds
+    if (xpos < 0 || xpos > width || ypos < 0 || ypos > height)
+        return { -1, -1 }; // cursor is outside
+
+    return { xpos, ypos };
+}
+
+void CheckCollision(SimulationContext& Sim)
+{
+    ProfileScope Scope(Sim.Profile, PhaseCollision);
+
+    // Deterministic mode pushes against where the others were at the start of
+    // the pass, not wherever earlier iterations already moved them
+    if (Sim.Deterministic) {
+        Sim.CollisionSnapshot = Sim.ParticleList;
+        SnapshotPrecisionRange(Sim, 0, (int)Sim.ParticleList.size());
+    }
+    const ParticleVector& Others = Sim.Deterministic ? Sim.CollisionSnapshot : Sim.ParticleList;
+
+    if (Sim.Broadphase == VerletListBroadphase)
+        FlagVerletDisplacement(Sim, Others, 0, (int)Others.size());
+    PrepareBroadphase(Sim, Others);
+
+    CheckCollisionRange(Sim, 0, (int)Sim.ParticleList.size(), Others);
+    if (PositionBasedContacts(Sim))
+        SolveContacts(Sim);
+}
+
+// The calling thread's load row
+inline ObjectLoad* LocalObjectLoads(SimulationContext& Sim)
+{
+    return Sim.Loads.Rows[Sim.Jobs ? Sim.Jobs->CurrentWorker() + 1 : 0].data();
+}
+
+// A particle moving at Velocity just stopped against the object
+inline void AddObjectLoad(ObjectLoad& Load, Vector2 Velocity)
+{
+    Load.ImpulseX += Velocity.x;
+    Load.ImpulseY += Velocity.y;
+    Load.Contacts++;
+}
+
+// Move (X, Y) just outside obj's edge if it's inside, obj being a circle.
+// Real is the precision policy's compute type, see Precision.h.
+template <typename Real>
+inline bool PushOutOfCircle(Real& X, Real& Y, const Object& obj, Real particleRadius)
+{
+    Real dx = X - obj.X;
+    Real dy = Y - obj.Y;
+    Real distanceSquared = dx * dx + dy * dy;
+    Real combinedRadius = obj.Size + particleRadius;
+
+    if (distanceSquared <= combinedRadius * combinedRadius)
+    {
+        Real dist = std::sqrt(distanceSquared);
+        if (dist > 0)
+        {
+            Real nx = dx / dist;
+            Real ny = dy / dist;
+
+            // Move particle just outside the object’s edge
+            X = obj.X + nx * combinedRadius;
+            Y = obj.Y + ny * combinedRadius;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Only circles have contacts so far
+template <typename Real>
+inline bool PushOutOfObject(Real& X, Real& Y, const Object& obj, Real particleRadius)
+{
+    return obj.ObjectType == Circle && PushOutOfCircle(X, Y, obj, particleRadius);
+}
+
+// Push (X, Y) away from (OtherX, OtherY) so the two edges just touch
+template <typename Real>
+inline bool PushOutOfParticle(Real& X, Real& Y, Real OtherX, Real OtherY, Real particleRadius)
+{
+    Real dx = X - OtherX;
+    Real dy = Y - OtherY;
+    Real distanceSquared = dx * dx + dy * dy;
+    Real combinedRadius = particleRadius * 2;
+
+    if (distanceSquared <= combinedRadius * combinedRadius)
+    {
+        Real dist = std::sqrt(distanceSquared);
+        if (dist > 0)
+        {
+            Real nx = dx / dist;
+            Real ny = dy / dist;
+
+            X = OtherX + nx * combinedRadius;
+            Y = OtherY + ny * combinedRadius;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Move p just outside obj's edge if it's inside. Without CheckShape obj has
+// to be a circle.
+template <bool CheckShape = true>
+inline bool ResolveObjectContact(Particle& p, const Object& obj, float particleRadius)
+{
+    if (CheckShape && obj.ObjectType != Circle)
+        return false;
+    if (!PushOutOfCircle(p.X, p.Y, obj, particleRadius))
+        return false;
+    p.Velocity.x = 0;
+    p.Velocity.y = 0;
+    p.State = ParticleHitObject;
+    return true;
+}
+
+// Push p away from other so their edges just touch
+inline bool ResolveParticleContact(Particle& p, const Particle& other, float particleRadius)
+{
+    if (!PushOutOfParticle(p.X, p.Y, other.X, other.Y, particleRadius))
+        return false;
+    p.Velocity.x = 0;
+    p.Velocity.y = 0;
+    p.State = ParticleHitParticle;
+    return true;
+}
+
+// Everything in the 3x3 cells around (X, Y), in index order like the brute force loop
+void GatherGridCandidates(const UniformGrid& Grid, float X, float Y, ArenaVector<int>& Candidates)
+{
+    Candidates.clear();
+    int cx = (int)std::floor(X / Grid.CellSize);
+    int cy = (int)std::floor(Y / Grid.CellSize);
+    for (int oy = -1; oy <= 1; oy++)
+        for (int ox = -1; ox <= 1; ox++)
+        {
+            int Bucket = (int)(((unsigned)(cx + ox) * 73856093u) ^ ((unsigned)(cy + oy) * 19349663u)) & Grid.BucketMask;
+            for (int k = Grid.BucketStart[Bucket]; k < Grid.BucketStart[Bucket + 1]; k++)
+                Candidates.push_back(Grid.Indices[k]);
+        }
+    std::sort(Candidates.begin(), Candidates.end());
+    Candidates.erase(std::unique(Candidates.begin(), Candidates.end()), Candidates.end());
+}
+
+// Everything whose X is within Reach of X, back in index order
+void GatherSweepCandidates(const SweepAndPrune& Sweep, float X, float Reach, ArenaVector<int>& Candidates)
+{
+    Candidates.clear();
+    size_t k = std::lower_bound(Sweep.Keys.begin(), Sweep.Keys.end(), X - Reach) - Sweep.Keys.begin();
+    for (; k < Sweep.Keys.size() && Sweep.Keys[k] <= X + Reach; k++)
+        Candidates.push_back(Sweep.Order[k]);
+    std::sort(Candidates.begin(), Candidates.end());
+}
+
+// Resolves particles [Begin, End) against the objects and against Others.
+// Only writes particles in the range, so disjoint ranges can run in parallel
+// as long as Others isn't ParticleList itself. Others[i] is particle i itself
+// unless SelfInOthers says where it is.
+void CheckCollisionRange(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers)
+{
+    if (PrecisionKernels(Sim)) {
+        CollidePrecisionParticles(Sim, Begin, End, &Others != &Sim.ParticleList);
+        return;
+    }
+    ActiveStepKernel(Sim).Collide(Sim, Begin, End, Others, SelfInOthers);
+}
+
+// CheckCollisionRange with the object terms Flags leaves out compiled away
+template <unsigned Flags>
+void CollideParticleRange(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers)
+{
+    const float particleRadius = 5.0f;
+    ParticleVector& ParticleList = Sim.ParticleList;
+    std::vector<Object>& ObjectList = Sim.ObjectList;
+    long long ObjectContacts = 0;
+    long long ParticleContacts = 0;
+    ObjectLoad* Loads = LocalObjectLoads(Sim);
+    ArenaVector<int> Candidates{ ArenaAllocator<int>(Sim.Arenas.Local(Sim.Jobs)) };
+    Candidates.reserve(64);
+    if (Sim.Broadphase == VerletListBroadphase && Sim.Verlet.Rebuilding)
+        BuildVerletRows(Sim, Begin, End, Others, SelfInOthers);
+
+    // Position based contacts only record the pair here (once, from its lower
+    // index) and leave the moving to SolveContacts
+    bool Gather = PositionBasedContacts(Sim);
+    std::vector<ContactConstraint>* Found = Gather ? &Sim.Contacts.Found[Sim.Jobs ? Sim.Jobs->CurrentWorker() + 1 : 0] : nullptr;
+    auto Touch = [&](Particle& p, int Self, int j) {
+        if (!Gather)
+            return ResolveParticleContact(p, Others[j], particleRadius);
+        float dx = p.X - Others[j].X;
+        float dy = p.Y - Others[j].Y;
+        float distanceSquared = dx * dx + dy * dy;
+        float combinedRadius = particleRadius * 2.0f;
+        if (distanceSquared > combinedRadius * combinedRadius || distanceSquared == 0.0f)
+            return false;
+        if (Self < j)
+            Found->push_back({ Self, j });
+        p.State = ParticleHitParticle;
+        return true;
+    };
+
+    // Touch against the candidates in index order, like the brute force loop.
+    // They were gathered around where p was, and a push can carry it out of
+    // their reach, so after one they get gathered again around where p is now
+    // and the scan carries on past the partner that pushed.
+    auto Scan = [&](Particle& p, int Self, auto&& Gather) {
+        bool Hit = false;
+        Gather(p.X, p.Y);
+        size_t c = 0;
+        while (c < Candidates.size())
+        {
+            int j = Candidates[c++];
+            float X = p.X, Y = p.Y;
+            if (Self == j || !Touch(p, Self, j))
+                continue;
+            Hit = true;
+            ParticleContacts++;
+            if (p.X != X || p.Y != Y) {
+                Gather(p.X, p.Y);
+                c = std::upper_bound(Candidates.begin(), Candidates.end(), j) - Candidates.begin();
+            }
+        }
+        return Hit;
+    };
+
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& p = ParticleList[i];
+        bool collided = false;
+        int Self = SelfInOthers ? SelfInOthers[i] : i;
+
+        // ---- Collision with Objects ----
+        if constexpr ((Flags & KernelObjects) != 0)
+        {
+            for (int j = 0; j < ObjectList.size(); j++)
+            {
+                Vector2 Before = p.Velocity;
+                if (ResolveObjectContact<(Flags & KernelMixedObjects) != 0>(p, ObjectList[j], particleRadius))
+                {
+                    AddObjectLoad(Loads[j], Before);
+                    collided = true;
+                    ObjectContacts++;
+                }
+            }
+        }
+        // SolveContacts won't load an object again with a particle that already did
+        if (Gather)
+            Sim.Contacts.ObjectHit[i] = collided;
+
+        // ---- Collision with Other Particles ----
+        if (Sim.Broadphase == UniformGridBroadphase)
+        {
+            if (Scan(p, Self, [&](float X, float Y) { GatherGridCandidates(Sim.Grid, X, Y, Candidates); }))
+                collided = true;
+        }
+        else if (Sim.Broadphase == SweepAndPruneBroadphase)
+        {
+            if (Scan(p, Self, [&](float X, float /*Y*/) { GatherSweepCandidates(Sim.SweepPrune, X, particleRadius * 2.0f, Candidates); }))
+                collided = true;
+        }
+        else if (Sim.Broadphase == VerletListBroadphase)
+        {
+            // The row holds every contact while p is within Skin / 2 of where
+            // it was at the build. A push (an object's or a particle's) can
+            // take it further, and from there only every particle will do.
+            VerletLists& Verlet = Sim.Verlet;
+            float Limit = Verlet.BuiltSkin * 0.5f;
+            auto Gather = [&](float X, float Y) {
+                float dx = X - Verlet.Reference[i].x;
+                float dy = Y - Verlet.Reference[i].y;
+                if (dx * dx + dy * dy <= Limit * Limit) {
+                    Candidates.assign(Verlet.Rows[i].begin(), Verlet.Rows[i].end());
+                    return;
+                }
+                Candidates.resize(Others.size());
+                std::iota(Candidates.begin(), Candidates.end(), 0);
+                Verlet.Escapes++;
+            };
+            if (Scan(p, Self, Gather))
+                collided = true;
+        }
+        else
+        {
+            for (int j = 0; j < Others.size(); j++)
+            {
+                if (Self != j && Touch(p, Self, j))
+                {
+                    collided = true;
+                    ParticleContacts++;
+                }
+            }
+        }
+
+        // ---- Default Color if No Collision ----
+        if (!collided)
+            p.State = ParticleFree;
+    }
+
+    Sim.ObjectCollisions += ObjectContacts;
+    Sim.ParticleCollisions += ParticleContacts;
+}
+
+// -------------------- Step Kernels --------------------
+// One instantiation of the per-step kernels for every StepKernelFlags
+// combination. SelectStepKernel picks one at the top of each step from the
+// current parameters, so terms that are zero this step aren't computed.
+
+// WindSpeedEquation without the terms Flags says are zero. Adding a zero
+// term never changes a float, so this matches it bit for bit.
+template <unsigned Flags>
+float EulerWindSpeed(const SimulationContext& Sim)
+{
+    const float rho = 1.225f;
+    const bool Coriolis = (Flags & KernelCoriolis) != 0;
+    const bool PressureY = (Flags & KernelPressureY) != 0;
+    float du_dt, dv_dt;
+    if constexpr (Coriolis)
+        du_dt = Sim.f * Sim.v - (1.0f / rho) * Sim.dPdx - Sim.k * Sim.u;
+    else
+        du_dt = -(1.0f / rho) * Sim.dPdx - Sim.k * Sim.u;
+    if constexpr (Coriolis && PressureY)
+        dv_dt = -Sim.f * Sim.u - (1.0f / rho) * Sim.dPdy - Sim.k * Sim.v;
+    else if constexpr (Coriolis)
+        dv_dt = -Sim.f * Sim.u - Sim.k * Sim.v;
+    else if constexpr (PressureY)
+        dv_dt = -(1.0f / rho) * Sim.dPdy - Sim.k * Sim.v;
+    else
+        dv_dt = -Sim.k * Sim.v;
+
+    float u_new = Sim.u + du_dt * Sim.dt;
+    float v_new = Sim.v + dv_dt * Sim.dt;
+    return std::sqrt(u_new * u_new + v_new * v_new);
+}
+
+template <unsigned Flags>
+StepKernel MakeStepKernel()
+{
+    return { Flags, &EulerWindSpeed<Flags>, &CollideParticleRange<Flags> };
+}
+
+template <size_t... Index>
+std::array<StepKernel, KernelVariants> MakeStepKernelTable(std::index_sequence<Index...>)
+{
+    return { { MakeStepKernel<(unsigned)Index>()... } };
+}
+
+const std::array<StepKernel, KernelVariants> StepKernels = MakeStepKernelTable(std::make_index_sequence<KernelVariants>());
+
+const StepKernel& ActiveStepKernel(const SimulationContext& Sim)
+{
+    return StepKernels[Sim.KernelFlags];
+}
+
+// Once per step, after input and before anything runs a kernel
+void SelectStepKernel(SimulationContext& Sim)
+{
+    unsigned Flags = 0;
+    if (Sim.f != 0.0f) Flags |= KernelCoriolis;
+    if (Sim.dPdy != 0.0f) Flags |= KernelPressureY;
+    if (!Sim.ObjectList.empty()) Flags |= KernelObjects;
+    for (const Object& Item : Sim.ObjectList)
+        if (Item.ObjectType != Circle)
+            Flags |= KernelMixedObjects;
+    Sim.KernelFlags = Flags;
+}
+
+std::string StepKernelName(unsigned Flags)
+{
+    std::string Name = Flags & KernelCoriolis ? "coriolis" : "no coriolis";
+    Name += Flags & KernelPressureY ? ", dP/dy" : ", no dP/dy";
+    Name += !(Flags & KernelObjects) ? ", no objects" : Flags & KernelMixedObjects ? ", mixed objects" : ", circles only";
+    return Name;
+}
+
+// Counting sort of particle indices into hashed cells
+void BuildUniformGrid(UniformGrid& Grid, const ParticleVector& Particles, float CellSize)
+{
+    int Count = (int)Particles.size();
+    int Buckets = 64;
+    while (Buckets < Count * 2)
+        Buckets <<= 1;
+
+    Grid.CellSize = CellSize;
+    Grid.BucketMask = Buckets - 1;
+    Grid.BucketStart.assign(Buckets + 1, 0);
+    Grid.BucketOf.resize(Count);
+    Grid.Indices.resize(Count);
+
+    for (int i = 0; i < Count; i++)
+    {
+        int cx = (int)std::floor(Particles[i].X / CellSize);
+        int cy = (int)std::floor(Particles[i].Y / CellSize);
+        int Bucket = (int)(((unsigned)cx * 73856093u) ^ ((unsigned)cy * 19349663u)) & Grid.BucketMask;
+        Grid.BucketOf[i] = Bucket;
+        Grid.BucketStart[Bucket + 1]++;
+    }
+    for (int b = 0; b < Buckets; b++)
+        Grid.BucketStart[b + 1] += Grid.BucketStart[b];
+
+    Grid.Cursor.assign(Grid.BucketStart.begin(), Grid.BucketStart.end() - 1);
+    for (int i = 0; i < Count; i++)
+        Grid.Indices[Grid.Cursor[Grid.BucketOf[i]]++] = i;
+}
+
+// Builds whatever the selected broadphase reads before CheckCollisionRange runs over Others
+void PrepareBroadphase(SimulationContext& Sim, const ParticleVector& Others)
+{
+    // Pair lists and load rows for the collide ranges, one per thread slot like the arenas
+    if (PositionBasedContacts(Sim)) {
+        Sim.Contacts.Found.resize(Sim.Jobs ? Sim.Jobs->ThreadCount() : 1);
+        Sim.Contacts.ObjectHit.resize(Sim.ParticleList.size());
+        ReserveContacts(Sim.Contacts, (int)Sim.ParticleList.size());
+    }
+    PrepareObjectLoads(Sim);
+
+    // The precision kernels only know the grid and brute force
+    if (Sim.Broadphase == UniformGridBroadphase || (PrecisionKernels(Sim) && Sim.Broadphase != BruteForceBroadphase)) {
+        BuildUniformGrid(Sim.Grid, Others, 10.0f);
+        return;
+    }
+    if (Sim.Broadphase == SweepAndPruneBroadphase) {
+        SortSweepAxis(Sim.SweepPrune, Others);
+        return;
+    }
+    if (Sim.Broadphase != VerletListBroadphase)
+        return;
+
+    // Strip ranks renumber own + ghosts every step, so their lists never survive one
+    VerletLists& Verlet = Sim.Verlet;
+    int Count = (int)Sim.ParticleList.size();
+    bool Stale = Sim.Domain || (int)Verlet.Rows.size() != Count || Verlet.BuiltSkin != Verlet.Skin || Verlet.BuiltSorts != Sim.Morton.Sorts;
+    Verlet.Rebuilding = Verlet.Moved.exchange(false) || Stale;
+    Verlet.Steps++;
+    Verlet.RebuildRate = Verlet.RebuildRate * 0.95 + (Verlet.Rebuilding ? 0.05 : 0.0);
+    if (!Verlet.Rebuilding)
+        return;
+
+    // The rows themselves get built by the collide ranges, see BuildVerletRows
+    Verlet.Rebuilds++;
+    Verlet.Rows.resize(Count);
+    Verlet.Reference.resize(Count);
+    Verlet.BuiltSkin = Verlet.Skin;
+    Verlet.BuiltSorts = Sim.Morton.Sorts;
+    Verlet.Pairs = 0;
+    BuildUniformGrid(Sim.Grid, Others, 10.0f + Verlet.Skin);
+}
+
+// Sets Verlet.Moved if a particle in [Begin, End) is more than Skin / 2 away
+// from where it was at the last build. Runs right after the update.
+void FlagVerletDisplacement(SimulationContext& Sim, const ParticleVector& Others, int Begin, int End)
+{
+    VerletLists& Verlet = Sim.Verlet;
+    if ((int)Verlet.Reference.size() != (int)Others.size())
+        return;
+    float Limit = Verlet.BuiltSkin * 0.5f;
+    for (int i = Begin; i < End; i++)
+    {
+        float dx = Others[i].X - Verlet.Reference[i].x;
+        float dy = Others[i].Y - Verlet.Reference[i].y;
+        if (dx * dx + dy * dy > Limit * Limit) {
+            Verlet.Moved = true;
+            return;
+        }
+    }
+}
+
+// Rows [Begin, End) from the grid PrepareBroadphase just built. Each row is only
+// written by the range that owns the particle, so collide chunks can do this in parallel.
+void BuildVerletRows(SimulationContext& Sim, int Begin, int End, const ParticleVector& Others, const int* SelfInOthers)
+{
+    VerletLists& Verlet = Sim.Verlet;
+    float Reach = 10.0f + Verlet.BuiltSkin;
+    ArenaVector<int> Candidates{ ArenaAllocator<int>(Sim.Arenas.Local(Sim.Jobs)) };
+    Candidates.reserve(64);
+    long long Pairs = 0;
+    for (int i = Begin; i < End; i++)
+    {
+        int Self = SelfInOthers ? SelfInOthers[i] : i;
+        const Particle& p = Others[Self];
+        GatherGridCandidates(Sim.Grid, p.X, p.Y, Candidates);
+
+        std::vector<int>& Row = Verlet.Rows[i];
+        Row.clear();
+        for (int j : Candidates)
+        {
+            float dx = p.X - Others[j].X;
+            float dy = p.Y - Others[j].Y;
+            if (j != Self && dx * dx + dy * dy <= Reach * Reach)
+                Row.push_back(j);
+        }
+        Verlet.Reference[i] = { p.X, p.Y };
+        Pairs += (long long)Row.size();
+    }
+    Verlet.Pairs += Pairs;
+}
+
+// Refreshes the keys from Others and restores X order, starting from last
+// step's. A changed count or a Morton sort just shows up as a lot of moves.
+void SortSweepAxis(SweepAndPrune& Sweep, const ParticleVector& Others)
+{
+    int Count = (int)Others.size();
+    if ((int)Sweep.Order.size() != Count) {
+        Sweep.Order.resize(Count);
+        for (int i = 0; i < Count; i++)
+            Sweep.Order[i] = i;
+    }
+    Sweep.Keys.resize(Count);
+    for (int k = 0; k < Count; k++)
+        Sweep.Keys[k] = Others[Sweep.Order[k]].X;
+
+    long long Budget = 8LL * Count + 64;
+    long long Moves = 0;
+    for (int k = 1; k < Count && Moves <= Budget; k++)
+    {
+        float Key = Sweep.Keys[k];
+        int Index = Sweep.Order[k];
+        int m = k;
+        for (; m > 0 && Sweep.Keys[m - 1] > Key; m--)
+        {
+            Sweep.Keys[m] = Sweep.Keys[m - 1];
+            Sweep.Order[m] = Sweep.Order[m - 1];
+        }
+        Sweep.Keys[m] = Key;
+        Sweep.Order[m] = Index;
+        Moves += k - m;
+    }
+
+    // Too far from sorted for the insertion sort to pay off
+    if (Moves > Budget) {
+        std::sort(Sweep.Order.begin(), Sweep.Order.end(), [&Others](int a, int b) { return Others[a].X < Others[b].X; });
+        for (int k = 0; k < Count; k++)
+            Sweep.Keys[k] = Others[Sweep.Order[k]].X;
+        Sweep.FullSorts++;
+    }
+    Sweep.Moves = Moves;
+    Sweep.Steps++;
+    Sweep.MovesPerParticle = Sweep.MovesPerParticle * 0.9 + (Count ? (double)Moves / Count : 0.0) * 0.1;
+}
+
+// -------------------- Contact Solver --------------------
+// Strip ranks only see their own particles plus ghosts they can't move, so
+// they stay with the snap response
+bool PositionBasedContacts(const SimulationContext& Sim)
+{
+    return Sim.Contacts.Solver == PositionBasedContactSolver && !Sim.Domain && !PrecisionKernels(Sim);
+}
+
+// Room for three pairs per particle, about what a hexagonal pile has, so a
+// pile that grows step by step doesn't keep reallocating the pair buffers.
+// The per-thread lists get twice their even share, the solve graph a task
+// per 256 of those pairs, the smallest chunk SolveContacts cuts.
+void ReserveContacts(ContactSolver& Solver, int ParticleCount)
+{
+    size_t Pairs = 3 * (size_t)ParticleCount;
+    if (Solver.Pairs.capacity() >= Pairs)
+        return;
+    for (std::vector<ContactConstraint>& Found : Solver.Found)
+        Found.reserve(2 * Pairs / Solver.Found.size() + 64);
+    Solver.Pairs.reserve(Pairs);
+    Solver.Ordered.reserve(Pairs);
+    Solver.PairColour.reserve(Pairs);
+    Solver.Members.reserve(ParticleCount);
+    Solver.StartVelocity.reserve(ParticleCount);
+    Solver.ChunkError.reserve(Pairs / 256 + 2);
+    Solver.Graph.Reserve((int)(Pairs / 256 + 2));
+}
+
+// Merges the pairs the collide ranges found, sorts them and colours them
+// greedily: each pair takes the lowest colour neither of its particles has yet
+void ColourContacts(ContactSolver& Solver, int ParticleCount)
+{
+    Solver.Pairs.clear();
+    for (std::vector<ContactConstraint>& Found : Solver.Found)
+    {
+        Solver.Pairs.insert(Solver.Pairs.end(), Found.begin(), Found.end());
+        Found.clear();
+    }
+    std::sort(Solver.Pairs.begin(), Solver.Pairs.end(), [](const ContactConstraint& a, const ContactConstraint& b) {
+        return a.A != b.A ? a.A < b.A : a.B < b.B;
+    });
+
+    int Count = (int)Solver.Pairs.size();
+    Solver.Used.assign(ParticleCount, 0);
+    Solver.PairColour.resize(Count);
+    Solver.ColourStart.assign(ContactMaxColours + 2, 0);
+    Solver.Colours = 0;
+    for (int k = 0; k < Count; k++)
+    {
+        const ContactConstraint& Pair = Solver.Pairs[k];
+        uint32_t Taken = Solver.Used[Pair.A] | Solver.Used[Pair.B];
+        int Colour = 0;
+        while (Colour < ContactMaxColours && (Taken >> Colour) & 1)
+            Colour++;
+        if (Colour < ContactMaxColours)
+        {
+            Solver.Used[Pair.A] |= 1u << Colour;
+            Solver.Used[Pair.B] |= 1u << Colour;
+            Solver.Colours = std::max(Solver.Colours, Colour + 1);
+        }
+        Solver.PairColour[k] = (uint8_t)Colour;
+        Solver.ColourStart[Colour + 1]++;
+    }
+    for (int c = 0; c <= ContactMaxColours; c++)
+        Solver.ColourStart[c + 1] += Solver.ColourStart[c];
+
+    int Cursor[ContactMaxColours + 1];
+    std::copy(Solver.ColourStart.begin(), Solver.ColourStart.end() - 1, Cursor);
+    Solver.Ordered.resize(Count);
+    for (int k = 0; k < Count; k++)
+        Solver.Ordered[Cursor[Solver.PairColour[k]]++] = Solver.Pairs[k];
+
+    // Every pair took a colour bit on both particles, or went to the leftovers
+    Solver.Members.clear();
+    for (int i = 0; i < ParticleCount; i++)
+        if (Solver.Used[i])
+            Solver.Members.push_back(i);
+    if (Solver.ColourStart[ContactMaxColours + 1] > Solver.ColourStart[ContactMaxColours]) {
+        for (int k = Solver.ColourStart[ContactMaxColours]; k < Count; k++) {
+            Solver.Members.push_back(Solver.Ordered[k].A);
+            Solver.Members.push_back(Solver.Ordered[k].B);
+        }
+        std::sort(Solver.Members.begin(), Solver.Members.end());
+        Solver.Members.erase(std::unique(Solver.Members.begin(), Solver.Members.end()), Solver.Members.end());
+    }
+}
+
+// Splits the overlap of a and b evenly between them along the line joining
+// them. The push also goes into the velocities, so they carry what the
+// particles actually did this step. Returns the overlap it found.
+inline float SolveContactPair(Particle& a, Particle& b, float RestDistance)
+{
+    float dx = b.X - a.X;
+    float dy = b.Y - a.Y;
+    float distanceSquared = dx * dx + dy * dy;
+    if (distanceSquared >= RestDistance * RestDistance || distanceSquared == 0.0f)
+        return 0.0f;
+
+    float dist = std::sqrt(distanceSquared);
+    float Overlap = RestDistance - dist;
+    float Push = Overlap * 0.5f / dist;
+    float px = dx * Push;
+    float py = dy * Push;
+    a.X -= px; a.Y -= py;
+    a.Velocity.x -= px; a.Velocity.y -= py;
+    b.X += px; b.Y += py;
+    b.Velocity.x += px; b.Velocity.y += py;
+    return Overlap;
+}
+
+// Runs after every collide range is done. Iterates until the deepest overlap
+// left is under the tolerance, or the iteration budget runs out. Objects
+// don't move, so after each iteration's pairs every particle in a pair gets
+// pushed back out of them, once per particle. One the pairs pushed into an
+// object hands it the velocity it had before the solve, and only if the
+// collide loop didn't already have it hit one, so each particle loads
+// objects at most once per step like it does with snap contacts.
+void SolveContacts(SimulationContext& Sim)
+{
+    ProfileScope Scope(Sim.Profile, PhaseContacts);
+    ContactSolver& Solver = Sim.Contacts;
+    ColourContacts(Solver, (int)Sim.ParticleList.size());
+    Solver.StartVelocity.resize(Solver.Members.size());
+    for (size_t m = 0; m < Solver.Members.size(); m++)
+        Solver.StartVelocity[m] = Sim.ParticleList[Solver.Members[m]].Velocity;
+
+    int Threads = Sim.Jobs ? Sim.Jobs->ThreadCount() : 1;
+    SimulationContext* S = &Sim;
+    Solver.IterationsUsed = 0;
+    Solver.Residual = 0.0f;
+    for (int Iteration = 0; Iteration < Solver.Iterations && !Solver.Ordered.empty(); Iteration++)
+    {
+        float Residual = 0.0f;
+        for (int Colour = 0; Colour <= ContactMaxColours; Colour++)
+        {
+            int First = Solver.ColourStart[Colour];
+            int Count = Solver.ColourStart[Colour + 1] - First;
+            if (Count == 0)
+                continue;
+            // The leftover colour may share particles, so it gets a single chunk
+            int ChunkSize = Colour == ContactMaxColours ? Count : std::max(256, Count / (Threads * 2) + 1);
+            Solver.ChunkError.assign(Count / ChunkSize + 1, 0.0f);
+            ParallelFor(Sim.Jobs, Solver.Graph, Count, ChunkSize, [S, First, ChunkSize](int Begin, int End) {
+                const float particleRadius = 5.0f;
+                ContactSolver& Solver = S->Contacts;
+                ParticleVector& ParticleList = S->ParticleList;
+                float Deepest = 0.0f;
+                for (int k = First + Begin; k < First + End; k++)
+                {
+                    Particle& a = ParticleList[Solver.Ordered[k].A];
+                    Particle& b = ParticleList[Solver.Ordered[k].B];
+                    Deepest = std::max(Deepest, SolveContactPair(a, b, particleRadius * 2.0f));
+                }
+                Solver.ChunkError[Begin / ChunkSize] = Deepest;
+            });
+            for (float Error : Solver.ChunkError)
+                Residual = std::max(Residual, Error);
+        }
+        if (!Sim.ObjectList.empty()) {
+            int Members = (int)Solver.Members.size();
+            ParallelFor(Sim.Jobs, Solver.Graph, Members, std::max(256, Members / (Threads * 2) + 1), [S](int Begin, int End) {
+                const float particleRadius = 5.0f;
+                ContactSolver& Solver = S->Contacts;
+                ObjectLoad* Loads = LocalObjectLoads(*S);
+                for (int m = Begin; m < End; m++)
+                {
+                    int i = Solver.Members[m];
+                    Particle& p = S->ParticleList[i];
+                    for (int j = 0; j < (int)S->ObjectList.size(); j++)
+                    {
+                        if (!ResolveObjectContact(p, S->ObjectList[j], particleRadius) || Solver.ObjectHit[i])
+                            continue;
+                        AddObjectLoad(Loads[j], Solver.StartVelocity[m]);
+                        Solver.ObjectHit[i] = 1;
+                    }
+                }
+            });
+        }
+        Solver.IterationsUsed++;
+        Solver.Residual = Residual;
+        if (Residual <= Solver.Tolerance)
+            break;
+    }
+    Solver.MeanIterations = Solver.MeanIterations * 0.95 + Solver.IterationsUsed * 0.05;
+}
+
+// -------------------- Object Loads --------------------
+// Sizes the rows for this step's objects, before any collide range runs. Rows
+// only grow, and a reduction leaves every slot it read at zero.
+void PrepareObjectLoads(SimulationContext& Sim)
+{
+    ObjectLoads& Loads = Sim.Loads;
+    size_t Objects = Sim.ObjectList.size();
+    size_t Padded = Objects + 64 / sizeof(ObjectLoad) + 1;
+    Loads.Rows.resize(Sim.Jobs ? Sim.Jobs->ThreadCount() : 1);
+    for (std::vector<ObjectLoad>& Row : Loads.Rows)
+        if (Row.size() < Padded)
+            Row.resize(Padded);
+    Loads.Step.resize(Objects);
+    Loads.Totals.resize(Objects);
+}
+
+// Sums the thread rows into Step and clears them for the next step
+void ReduceObjectLoads(SimulationContext& Sim)
+{
+    ObjectLoads& Loads = Sim.Loads;
+    for (size_t j = 0; j < Loads.Step.size(); j++)
+    {
+        ObjectLoad Sum;
+        for (std::vector<ObjectLoad>& Row : Loads.Rows)
+        {
+            Sum.ImpulseX += Row[j].ImpulseX;
+            Sum.ImpulseY += Row[j].ImpulseY;
+            Sum.Contacts += Row[j].Contacts;
+            Row[j] = ObjectLoad();
+        }
+        Loads.Step[j] = Sum;
+    }
+}
+
+// Folds the step's loads into the per-object totals
+void AccumulateObjectLoads(SimulationContext& Sim)
+{
+    ObjectLoads& Loads = Sim.Loads;
+    for (size_t j = 0; j < Loads.Step.size() && j < Loads.Totals.size(); j++)
+    {
+        const ObjectLoad& Step = Loads.Step[j];
+        ObjectLoadTotal& Total = Loads.Totals[j];
+        Total.Force = { Step.ImpulseX, Step.ImpulseY };
+        double Magnitude = std::sqrt(Total.Force.x * Total.Force.x + Total.Force.y * Total.Force.y);
+        Total.Drag = Total.Drag * 0.95 + Magnitude * 0.05;
+        Total.Peak = std::max(Total.Peak, Magnitude);
+        Total.Impulse.x += Step.ImpulseX;
+        Total.Impulse.y += Step.ImpulseY;
+        Total.Contacts += Step.Contacts;
+    }
+}
+
+void PrintObjectLoads(const SimulationContext& Sim)
+{
+    const std::vector<ObjectLoadTotal>& Totals = Sim.Loads.Totals;
+    if (Totals.empty()) return;
+    std::printf("Object loads (particle masses x px/step, per step):\n");
+    std::printf("  %-4s %8s %8s %10s %10s %10s %10s %10s\n", "obj", "x", "y", "Fx", "Fy", "drag", "peak", "hits");
+    for (size_t j = 0; j < Totals.size(); j++)
+    {
+        const Object& Item = Sim.ObjectList[j];
+        const ObjectLoadTotal& Total = Totals[j];
+        std::printf("  %-4zu %8.1f %8.1f %10.3f %10.3f %10.3f %10.3f %10lld\n", j, Item.X, Item.Y, Total.Force.x, Total.Force.y,
+            Total.Drag, Total.Peak, Total.Contacts);
+        std::printf("       total impulse (%.1f, %.1f)\n", Total.Impulse.x, Total.Impulse.y);
+    }
+}
+
+// -------------------- Wind Field --------------------
+// Flow past every circle in Objects for a free stream of 1 along +X: each
+// circle adds its doublet. That's exact for one circle and close enough while
+// they're a few radii apart. The radius includes a particle's, so particle
+// centres get steered around the edge instead of into it. Zero inside.
+Vector2 ObstacleFlow(const std::vector<Object>& Objects, float X, float Y)
+{
+    const float particleRadius = 5.0f;
+    Vector2 Flow = { 1.0f, 0.0f };
+    for (const Object& obj : Objects)
+    {
+        if (obj.ObjectType != Circle)
+            continue;
+        float dx = X - obj.X;
+        float dy = Y - obj.Y;
+        float r2 = dx * dx + dy * dy;
+        float R = obj.Size + particleRadius;
+        if (r2 <= R * R)
+            return { 0.0f, 0.0f };
+        float Scale = R * R / (r2 * r2);
+        Flow.x += Scale * (dy * dy - dx * dx);
+        Flow.y -= Scale * 2.0f * dx * dy;
+    }
+    return Flow;
+}
+
+// Whether a cell is too coarse for the flow inside it: an obstacle's edge
+// runs through it, or the flow at its corners strays too far from the centre.
+// ObstacleFlow is a sum of doublets and has no vorticity anywhere, so there
+// is no high-vorticity region to refine. Curl noise and the vortex wake are
+// other wind sources and never reach this tree.
+bool NeedsRefinement(const QuadtreeField& Field, const std::vector<Object>& Objects, float X0, float Y0, float Size)
+{
+    const float particleRadius = 5.0f;
+    float Cx = X0 + Size * 0.5f;
+    float Cy = Y0 + Size * 0.5f;
+    float HalfDiagonal = Size * 0.70711f;
+    for (const Object& obj : Objects)
+    {
+        if (obj.ObjectType != Circle)
+            continue;
+        float Edge = std::sqrt((Cx - obj.X) * (Cx - obj.X) + (Cy - obj.Y) * (Cy - obj.Y)) - (obj.Size + particleRadius);
+        if (std::fabs(Edge) < HalfDiagonal)
+            return true;
+    }
+
+    Vector2 Centre = ObstacleFlow(Objects, Cx, Cy);
+    Vector2 Corners[4] = {
+        ObstacleFlow(Objects, X0, Y0), ObstacleFlow(Objects, X0 + Size, Y0),
+        ObstacleFlow(Objects, X0, Y0 + Size), ObstacleFlow(Objects, X0 + Size, Y0 + Size),
+    };
+    float Variation = 0.0f;
+    for (const Vector2& Corner : Corners)
+        Variation = std::max(Variation, std::sqrt((Corner.x - Centre.x) * (Corner.x - Centre.x) + (Corner.y - Centre.y) * (Corner.y - Centre.y)));
+    return Variation > Field.VariationLimit;
+}
+
+// Depth first from the root, children in Z order, so leaves come out already
+// sorted by Morton code
+void BuildQuadtreeField(QuadtreeField& Field, const std::vector<Object>& Objects, Vector2 ScreenSize)
+{
+    Field.MaxDepth = std::max(Field.MinDepth, std::min(Field.MaxDepth, 12));
+    Field.OriginX = 0.0f;
+    Field.OriginY = 0.0f;
+    Field.RootSize = std::max(ScreenSize.x, ScreenSize.y);
+    Field.FinestSize = Field.RootSize / (float)(1 << Field.MaxDepth);
+    Field.Keys.clear();
+    Field.Flow.clear();
+    Field.Depth.clear();
+
+    struct Cell { uint32_t X, Y; int Depth; };   // X, Y counted in cells of that depth
+    std::vector<Cell> Stack;
+    Stack.push_back({ 0, 0, 0 });
+    while (!Stack.empty())
+    {
+        Cell Current = Stack.back();
+        Stack.pop_back();
+        float Size = Field.RootSize / (float)(1 << Current.Depth);
+        float X0 = Field.OriginX + Current.X * Size;
+        float Y0 = Field.OriginY + Current.Y * Size;
+
+        bool Split = Current.Depth < Field.MinDepth;
+        if (!Split && Current.Depth < Field.MaxDepth)
+            Split = NeedsRefinement(Field, Objects, X0, Y0, Size);
+        if (Split)
+        {
+            // Pushed backwards so they pop as (0,0) (1,0) (0,1) (1,1)
+            for (int Child = 3; Child >= 0; Child--)
+                Stack.push_back({ Current.X * 2 + (Child & 1), Current.Y * 2 + (Child >> 1), Current.Depth + 1 });
+            continue;
+        }
+
+        int Shift = Field.MaxDepth - Current.Depth;
+        Field.Keys.push_back(MortonCode(Current.X << Shift, Current.Y << Shift));
+        Field.Flow.push_back(ObstacleFlow(Objects, X0 + Size * 0.5f, Y0 + Size * 0.5f));
+        Field.Depth.push_back((uint8_t)Current.Depth);
+    }
+}
+
+// Called at the top of a step: moves the turbulence and the wake on, rebuilds
+// the tree when the obstacles or the depth changed and makes room for every
+// particle's hint
+void PrepareWindField(SimulationContext& Sim)
+{
+    PrepareTurbulence(Sim);
+    if (Sim.WindSource == VortexWind)
+        AdvanceVortexWake(Sim);
+    if (Sim.WindSource != QuadtreeWind) return;
+    QuadtreeField& Field = Sim.WindField;
+    long long Lookups = Field.Lookups.exchange(0);
+    long long Misses = Field.Misses.exchange(0);
+    if (Lookups > 0)
+        Field.HitRate = Field.HitRate * 0.9 + (1.0 - (double)Misses / Lookups) * 0.1;
+
+    bool Current = Field.BuiltDepth == Field.MaxDepth && Field.BuiltObjects.size() == Sim.ObjectList.size()
+        && std::equal(Field.BuiltObjects.begin(), Field.BuiltObjects.end(), Sim.ObjectList.begin(), [](const Object& a, const Object& b) {
+            return a.X == b.X && a.Y == b.Y && a.Size == b.Size && a.ObjectType == b.ObjectType;
+        });
+    if (!Current) {
+        auto Start = std::chrono::steady_clock::now();
+        BuildQuadtreeField(Field, Sim.ObjectList, Sim.ScreenSize);
+        Field.LastBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        Field.BuiltObjects = Sim.ObjectList;
+        Field.BuiltDepth = Field.MaxDepth;
+        Field.Builds++;
+    }
+    // A Morton sort or a strip exchange reorders particles, which only costs a few misses
+    Field.Hints.resize(Sim.ParticleList.size(), 0);
+}
+
+// Flow at (X, Y), free stream outside the root. Hint is the leaf to try
+// first and comes back as the leaf that held the point.
+template <typename Real>
+inline Vector2 SampleQuadtreeField(const QuadtreeField& Field, Real X, Real Y, int& Hint, long long& Misses)
+{
+    Real fx = (X - Field.OriginX) / Field.FinestSize;
+    Real fy = (Y - Field.OriginY) / Field.FinestSize;
+    Real Cells = (Real)(1 << Field.MaxDepth);
+    if (!(fx >= 0.0f && fy >= 0.0f && fx < Cells && fy < Cells) || Field.Keys.empty())
+        return { 1.0f, 0.0f };
+
+    uint32_t Code = MortonCode((uint32_t)fx, (uint32_t)fy);
+    int Leaves = (int)Field.Keys.size();
+    auto Holds = [&Field, Code, Leaves](int Leaf) {
+        return Leaf >= 0 && Leaf < Leaves && Field.Keys[Leaf] <= Code && (Leaf + 1 == Leaves || Code < Field.Keys[Leaf + 1]);
+    };
+    if (!Holds(Hint) && !Holds(Hint + 1)) {
+        Hint = (int)(std::upper_bound(Field.Keys.begin(), Field.Keys.end(), Code) - Field.Keys.begin()) - 1;
+        Misses++;
+    }
+    else if (!Holds(Hint))
+        Hint++;
+    return Field.Flow[Hint];
+}
+
+// The quadtree's flow, scaled by the same wind speed the uniform wind uses
+void UpdateQuadtreeWindParticles(SimulationContext& Sim, int Begin, int End)
+{
+    QuadtreeField& Field = Sim.WindField;
+    bool Local = PressureFieldActive(Sim);
+    float Speed = Sim.WindSpeed;
+    long long Misses = 0;
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& CurrentParticle = Sim.ParticleList[i];
+        if (Local)
+            Speed = LocalWindSpeed(Sim, CurrentParticle.X, CurrentParticle.Y);
+        Vector2 Flow = SampleQuadtreeField(Field, CurrentParticle.X, CurrentParticle.Y, Field.Hints[i], Misses);
+        CurrentParticle.Velocity.x = Flow.x * Speed;
+        CurrentParticle.Velocity.y = Flow.y * Speed;
+        CurrentParticle.X += CurrentParticle.Velocity.x;
+        CurrentParticle.Y += CurrentParticle.Velocity.y;
+    }
+    Field.Lookups += End - Begin;
+    Field.Misses += Misses;
+}
+
+// -------------------- Vortex Wake --------------------
+bool InsideCircle(const std::vector<Object>& Objects, float X, float Y)
+{
+    for (const Object& obj : Objects)
+        if (obj.ObjectType == Circle && (X - obj.X) * (X - obj.X) + (Y - obj.Y) * (Y - obj.Y) < obj.Size * obj.Size)
+            return true;
+    return false;
+}
+
+// Once per step, before the particles move: culls and sheds, builds the tree
+// the particles will use, then moves the vortices with it. Only depends on
+// the step index, the objects, the wind and the screen, so every strip rank
+// keeps the same wake.
+void AdvanceVortexWake(SimulationContext& Sim)
+{
+    VortexWake& Wake = Sim.Wake;
+    VortexSet& Set = Wake.Vortices;
+
+    int Kept = 0;
+    int Excess = std::max(0, (int)Set.Size() - Wake.MaxVortices);
+    for (int i = Excess; i < (int)Set.Size(); i++) {
+        if (Set.X[i] > Sim.ScreenSize.x + Wake.Core || InsideCircle(Sim.ObjectList, Set.X[i], Set.Y[i]))
+            continue;
+        Set.X[Kept] = Set.X[i];
+        Set.Y[Kept] = Set.Y[i];
+        Set.Strength[Kept] = Set.Strength[i] * Wake.Decay;
+        Kept++;
+    }
+    Set.Resize(Kept);
+
+    float U = Sim.WindSpeed;
+    if (U > 0.0f && Sim.StepIndex % std::max(1, Wake.ShedInterval) == 0) {
+        // Top sheds clockwise, bottom counter-clockwise. The two sides take
+        // turns being 10% stronger, so the wake doesn't stay symmetric.
+        float Gamma = 0.5f * U * U * std::max(1, Wake.ShedInterval);
+        long long Round = Sim.StepIndex / std::max(1, Wake.ShedInterval);
+        for (size_t n = 0; n < Sim.ObjectList.size(); n++) {
+            const Object& obj = Sim.ObjectList[n];
+            if (obj.ObjectType != Circle)
+                continue;
+            float Bias = (Round + (long long)n) % 2 ? 1.1f : 0.9f;
+            float Offset = obj.Size + Wake.Core;
+            Set.Add(obj.X, obj.Y + Offset, -Gamma * Bias);
+            Set.Add(obj.X, obj.Y - Offset, Gamma * (2.0f - Bias));
+            Wake.Shed += 2;
+        }
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    int Count = (int)Set.Size();
+    if (Wake.Evaluator == MultipoleEvaluator) {
+        // Boxes over the screen and the vortices, never the particles, which
+        // differ between strip ranks
+        Wake.Multipole.Build(Set, Wake.Core, 0.0f, 0.0f, Sim.ScreenSize.x, Sim.ScreenSize.y, Sim.Jobs, Wake.Graph);
+        int Particles = (int)Sim.ParticleList.size();
+        Wake.InducedX.resize(Count + Particles);
+        Wake.InducedY.resize(Count + Particles);
+        Wake.Multipole.Evaluate(Set.X.data(), Set.Y.data(), Count, Wake.InducedX.data(), Wake.InducedY.data(), Sim.Jobs,
+            Wake.Graph);
+
+        // Particles at where this step's recycle will put them
+        Wake.TargetX.resize(Particles);
+        Wake.TargetY.resize(Particles);
+        for (int i = 0; i < Particles; i++) {
+            const Particle& p = Sim.ParticleList[i];
+            bool Recycled = p.X > Sim.ScreenSize.x;
+            Wake.TargetX[i] = Recycled ? 0.0f : p.X;
+            Wake.TargetY[i] = Recycled ? p.OringialY : p.Y;
+        }
+        Wake.Multipole.Evaluate(Wake.TargetX.data(), Wake.TargetY.data(), Particles, Wake.InducedX.data() + Count,
+            Wake.InducedY.data() + Count, Sim.Jobs, Wake.Graph);
+    }
+    else {
+        Wake.Tree.Theta = Wake.Theta;
+        Wake.Tree.Build(Set, Wake.Core, Sim.Jobs, Wake.Graph);
+        Wake.InducedX.resize(Count);
+        Wake.InducedY.resize(Count);
+        ParallelFor(Sim.Jobs, Wake.Graph, Count, 512, [&Wake, &Set](int Begin, int End) {
+            for (int i = Begin; i < End; i++)
+                Wake.Tree.Velocity(Set.X[i], Set.Y[i], Wake.InducedX[i], Wake.InducedY[i]);
+        });
+    }
+    Wake.LastBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+
+    Wake.ParticleOffset = Count;
+    for (int i = 0; i < Count; i++) {
+        Set.X[i] += U + Wake.InducedX[i];
+        Set.Y[i] += Wake.InducedY[i];
+    }
+}
+
+// What the wake induces at particle Index, sitting at (X, Y)
+inline void WakeVelocity(const VortexWake& Wake, int Index, float X, float Y, float& u, float& v)
+{
+    if (Wake.Evaluator == MultipoleEvaluator) {
+        u = Wake.InducedX[Wake.ParticleOffset + Index];
+        v = Wake.InducedY[Wake.ParticleOffset + Index];
+    }
+    else
+        Wake.Tree.Velocity(X, Y, u, v);
+}
+
+// The wind along +X plus what the wake induces
+void UpdateVortexWindParticles(SimulationContext& Sim, int Begin, int End)
+{
+    bool Local = PressureFieldActive(Sim);
+    float Speed = Sim.WindSpeed;
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& CurrentParticle = Sim.ParticleList[i];
+        if (Local)
+            Speed = LocalWindSpeed(Sim, CurrentParticle.X, CurrentParticle.Y);
+        float u, v;
+        WakeVelocity(Sim.Wake, i, CurrentParticle.X, CurrentParticle.Y, u, v);
+        CurrentParticle.Velocity.x = Speed + u;
+        CurrentParticle.Velocity.y = v;
+        CurrentParticle.X += CurrentParticle.Velocity.x;
+        CurrentParticle.Y += CurrentParticle.Velocity.y;
+    }
+}
+
+// -------------------- Precision Kernels --------------------
+// With a precision other than float, positions and velocities live in that
+// policy's PrecisionStore and the update and collide ranges run the kernels
+// below on it. ParticleList stays the float view everything else reads
+// (broadphase, drawing, capture, hashes), and each kernel rewrites it for the
+// range it owns. Strips and position based contacts stay on float.
+
+bool PrecisionKernels(const SimulationContext& Sim)
+{
+    return Sim.Precision != SinglePrecision && !Sim.Domain;
+}
+
+// Calls Fn with the active policy's state
+template <typename Fn>
+void WithPrecisionState(SimulationContext& Sim, Fn&& Body)
+{
+    if (Sim.Precision == DoublePrecision)
+        Body(Sim.DoubleState);
+    else
+        Body(Sim.HalfState);
+}
+
+template <typename Policy>
+void SyncPrecisionState(SimulationContext& Sim, PrecisionState<Policy>& State)
+{
+    PrecisionStore<Policy>& Live = State.Live;
+    size_t Count = Sim.ParticleList.size();
+    if (Live.Size() != Count) {
+        // Particles were (re)populated, start over from the float view
+        Live.Resize(Count);
+        for (size_t i = 0; i < Count; i++) {
+            const Particle& p = Sim.ParticleList[i];
+            Live.X[i] = Policy::Store(p.X);
+            Live.Y[i] = Policy::Store(p.Y);
+            Live.VelocityX[i] = Policy::Store(p.Velocity.x);
+            Live.VelocityY[i] = Policy::Store(p.Velocity.y);
+        }
+        State.Sorts = Sim.Morton.Sorts;
+    }
+    else if (State.Sorts != Sim.Morton.Sorts) {
+        // A Morton sort reordered ParticleList this step, the store follows
+        Live.Permute(Sim.Morton.Order, State.Snapshot);
+        State.Sorts = Sim.Morton.Sorts;
+    }
+    State.Snapshot.Resize(Count);
+}
+
+// After sorting and before the update, every step
+void SyncPrecisionStore(SimulationContext& Sim)
+{
+    if (!PrecisionKernels(Sim)) return;
+    WithPrecisionState(Sim, [&Sim](auto& State) { SyncPrecisionState(Sim, State); });
+}
+
+// The store's side of CollisionSnapshot
+void SnapshotPrecisionRange(SimulationContext& Sim, int Begin, int End)
+{
+    if (!PrecisionKernels(Sim)) return;
+    WithPrecisionState(Sim, [Begin, End](auto& State) { State.Snapshot.CopyRange(State.Live, Begin, End); });
+}
+
+// Recycle and wind, like RecycleWindParticles + UpdateWindParticles
+template <typename Policy>
+void UpdatePrecisionRange(SimulationContext& Sim, PrecisionState<Policy>& State, int Begin, int End)
+{
+    typedef typename Policy::Real Real;
+    PrecisionStore<Policy>& Live = State.Live;
+    QuadtreeField& Field = Sim.WindField;
+    bool Quadtree = Sim.WindSource == QuadtreeWind;
+    bool Vortices = Sim.WindSource == VortexWind;
+    bool Local = PressureFieldActive(Sim);
+    bool Turbulent = TurbulenceActive(Sim);
+    Real Speed = Sim.WindSpeed;
+    Real Right = Sim.ScreenSize.x;
+    long long Misses = 0;
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& p = Sim.ParticleList[i];
+        Real X = Policy::Load(Live.X[i]);
+        Real Y = Policy::Load(Live.Y[i]);
+        Real VelocityY = Policy::Load(Live.VelocityY[i]);
+        if (X > Right) {
+            X = 0;
+            Y = p.OringialY;
+        }
+        if (Local)
+            Speed = LocalWindSpeed(Sim, (float)X, (float)Y);
+        Real VelocityX = Speed;
+        if (Quadtree) {
+            Vector2 Flow = SampleQuadtreeField(Field, X, Y, Field.Hints[i], Misses);
+            VelocityX = Flow.x * Speed;
+            VelocityY = Flow.y * Speed;
+            Y += VelocityY;
+        }
+        else if (Vortices) {
+            float u, v;
+            WakeVelocity(Sim.Wake, i, (float)X, (float)Y, u, v);
+            VelocityX = Speed + u;
+            VelocityY = v;
+            Y += VelocityY;
+        }
+        else if (Turbulent)
+            VelocityY = 0;
+        X += VelocityX;
+
+        Live.X[i] = Policy::Store(X);
+        Live.Y[i] = Policy::Store(Y);
+        Live.VelocityX[i] = Policy::Store(VelocityX);
+        Live.VelocityY[i] = Policy::Store(VelocityY);
+        p.X = (float)Policy::Load(Live.X[i]);
+        p.Y = (float)Policy::Load(Live.Y[i]);
+        p.Velocity = { (float)Policy::Load(Live.VelocityX[i]), (float)Policy::Load(Live.VelocityY[i]) };
+    }
+    if (Quadtree) {
+        Field.Lookups += End - Begin;
+        Field.Misses += Misses;
+    }
+    if (!Turbulent) return;
+
+    // Its own pass, like ApplyTurbulence
+    ProfileScope Scope(Sim.Profile, PhaseTurbulence);
+    TurbulenceLayer& Layer = Sim.Turbulence;
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& p = Sim.ParticleList[i];
+        Real X = Policy::Load(Live.X[i]);
+        Real Y = Policy::Load(Live.Y[i]);
+        float FlowX, FlowY;
+        Layer.Cache.Sample((float)X, (float)Y, FlowX, FlowY);
+        Real PushX = (Real)(FlowX * Layer.Amplitude);
+        Real PushY = (Real)(FlowY * Layer.Amplitude);
+        Live.X[i] = Policy::Store(X + PushX);
+        Live.Y[i] = Policy::Store(Y + PushY);
+        Live.VelocityX[i] = Policy::Store(Policy::Load(Live.VelocityX[i]) + PushX);
+        Live.VelocityY[i] = Policy::Store(Policy::Load(Live.VelocityY[i]) + PushY);
+        p.X = (float)Policy::Load(Live.X[i]);
+        p.Y = (float)Policy::Load(Live.Y[i]);
+        p.Velocity = { (float)Policy::Load(Live.VelocityX[i]), (float)Policy::Load(Live.VelocityY[i]) };
+    }
+}
+
+// Snap contacts, like CheckCollisionRange. Others is the snapshot or, serial
+// and not deterministic, the live store itself.
+template <typename Policy>
+void CollidePrecisionRange(SimulationContext& Sim, PrecisionState<Policy>& State, int Begin, int End, bool FromSnapshot)
+{
+    typedef typename Policy::Real Real;
+    const Real particleRadius = 5;
+    PrecisionStore<Policy>& Live = State.Live;
+    const PrecisionStore<Policy>& Others = FromSnapshot ? State.Snapshot : State.Live;
+    const std::vector<Object>& ObjectList = Sim.ObjectList;
+    bool Grid = Sim.Broadphase != BruteForceBroadphase;
+    long long ObjectContacts = 0;
+    long long ParticleContacts = 0;
+    ObjectLoad* Loads = LocalObjectLoads(Sim);
+    ArenaVector<int> Candidates{ ArenaAllocator<int>(Sim.Arenas.Local(Sim.Jobs)) };
+    Candidates.reserve(64);
+
+    for (int i = Begin; i < End; i++)
+    {
+        Particle& p = Sim.ParticleList[i];
+        Real X = Policy::Load(Live.X[i]);
+        Real Y = Policy::Load(Live.Y[i]);
+        Real VelocityX = Policy::Load(Live.VelocityX[i]);
+        Real VelocityY = Policy::Load(Live.VelocityY[i]);
+        bool collided = false;
+
+        for (int j = 0; j < (int)ObjectList.size(); j++)
+        {
+            if (PushOutOfObject(X, Y, ObjectList[j], particleRadius))
+            {
+                AddObjectLoad(Loads[j], { (float)VelocityX, (float)VelocityY });
+                VelocityX = 0;
+                VelocityY = 0;
+                p.State = ParticleHitObject;
+                collided = true;
+                ObjectContacts++;
+            }
+        }
+
+        auto Touch = [&](int j) {
+            if (j == i || !PushOutOfParticle(X, Y, Policy::Load(Others.X[j]), Policy::Load(Others.Y[j]), particleRadius))
+                return;
+            VelocityX = 0;
+            VelocityY = 0;
+            p.State = ParticleHitParticle;
+            collided = true;
+            ParticleContacts++;
+        };
+        if (Grid) {
+            // Gathered again after every push, like the float kernel's Scan
+            GatherGridCandidates(Sim.Grid, (float)X, (float)Y, Candidates);
+            size_t c = 0;
+            while (c < Candidates.size())
+            {
+                int j = Candidates[c++];
+                Real BeforeX = X, BeforeY = Y;
+                Touch(j);
+                if (X != BeforeX || Y != BeforeY) {
+                    GatherGridCandidates(Sim.Grid, (float)X, (float)Y, Candidates);
+                    c = std::upper_bound(Candidates.begin(), Candidates.end(), j) - Candidates.begin();
+                }
+            }
+        }
+        else {
+            for (int j = 0; j < (int)Others.Size(); j++)
+                Touch(j);
+        }
+
+        if (!collided)
+            p.State = ParticleFree;
+        Live.X[i] = Policy::Store(X);
+        Live.Y[i] = Policy::Store(Y);
+        Live.VelocityX[i] = Policy::Store(VelocityX);
+        Live.VelocityY[i] = Policy::Store(VelocityY);
+        p.X = (float)Policy::Load(Live.X[i]);
+        p.Y = (float)Policy::Load(Live.Y[i]);
+        p.Velocity = { (float)Policy::Load(Live.VelocityX[i]), (float)Policy::Load(Live.VelocityY[i]) };
+    }
+
+    Sim.ObjectCollisions += ObjectContacts;
+    Sim.ParticleCollisions += ParticleContacts;
+}
+
+void UpdatePrecisionParticles(SimulationContext& Sim, int Begin, int End)
+{
+    WithPrecisionState(Sim, [&Sim, Begin, End](auto& State) { UpdatePrecisionRange(Sim, State, Begin, End); });
+}
+
+void CollidePrecisionParticles(SimulationContext& Sim, int Begin, int End, bool FromSnapshot)
+{
+    WithPrecisionState(Sim, [&Sim, Begin, End, FromSnapshot](auto& State) { CollidePrecisionRange(Sim, State, Begin, End, FromSnapshot); });
+}
+
+// -------------------- Morton Sort --------------------
+// Contacts and field sampling walk particles by index, but after enough
+// pushes and wrap-arounds index order has little to do with position. Sorting
+// by the Morton code of each particle's cell every few steps puts spatial
+// neighbours back next to each other in memory.
+const float MortonCellSize = 10.0f;
+
+// Called at the top of a step, before anything reads the particle order
+void MaybeSortParticles(SimulationContext& Sim)
+{
+    // Strip ranks keep an id per particle and don't reorder
+    if (Sim.Domain) return;
+    MortonSort& Morton = Sim.Morton;
+    if (Sim.SortInterval > 0 && Sim.StepIndex > 0 && Sim.StepIndex % Sim.SortInterval == 0) {
+        Morton.LocalityBefore = MeasureNeighborLocality(Sim);
+        auto Start = std::chrono::steady_clock::now();
+        {
+            ProfileScope Scope(Sim.Profile, PhaseSort);
+            SortParticlesMorton(Sim);
+        }
+        Morton.LastSortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        Morton.Locality = MeasureNeighborLocality(Sim);
+    }
+    else if (Sim.StepIndex % 120 == 0) {
+        // Keep the panel current while sorting is off, or between sorts
+        Morton.Locality = MeasureNeighborLocality(Sim);
+    }
+}
+
+void SortParticlesMorton(SimulationContext& Sim)
+{
+    MortonSort& Morton = Sim.Morton;
+    int Count = (int)Sim.ParticleList.size();
+    if (Count < 2) return;
+    int ChunkSize = Sim.Jobs ? std::max(4096, Count / (Sim.Jobs->ThreadCount() * 4) + 1) : Count;
+    Morton.Keys.resize(Count);
+    Morton.Order.resize(Count);
+
+    // Cells are biased so the particles queued left of the screen still get codes in order
+    SimulationContext* S = &Sim;
+    ParallelFor(Sim.Jobs, Sim.StepGraph, Count, ChunkSize, [S](int Begin, int End) {
+        for (int i = Begin; i < End; i++) {
+            const Particle& p = S->ParticleList[i];
+            int cx = std::min(std::max((int)std::floor(p.X / MortonCellSize) + 32768, 0), 65535);
+            int cy = std::min(std::max((int)std::floor(p.Y / MortonCellSize) + 32768, 0), 65535);
+            S->Morton.Keys[i] = MortonCode((uint32_t)cx, (uint32_t)cy);
+            S->Morton.Order[i] = (uint32_t)i;
+        }
+    });
+    Morton.Sorter.Sort(Sim.Jobs, Sim.StepGraph, Morton.Keys, Morton.Order, ChunkSize);
+
+    // Gather into scratch storage placed the same way as the live list, then swap
+    if (Morton.Scratch.get_allocator() != Sim.ParticleList.get_allocator())
+        Morton.Scratch = ParticleVector(Sim.ParticleList.get_allocator());
+    Morton.Scratch.resize(Count);
+    ParallelFor(Sim.Jobs, Sim.StepGraph, Count, ChunkSize, [S](int Begin, int End) {
+        for (int i = Begin; i < End; i++)
+            S->Morton.Scratch[i] = S->ParticleList[S->Morton.Order[i]];
+    });
+    Sim.ParticleList.swap(Morton.Scratch);
+    Morton.Sorts++;
+}
+
+// Mean index distance between particles within two cells of each other, over
+// a sample of at most 64k particles. Lower means neighbours sit closer in memory.
+double MeasureNeighborLocality(SimulationContext& Sim)
+{
+    const ParticleVector& Particles = Sim.ParticleList;
+    int Count = (int)Particles.size();
+    if (Count < 2) return 0.0;
+    UniformGrid& Grid = Sim.Morton.Grid;
+    BuildUniformGrid(Grid, Particles, MortonCellSize);
+
+    const float Reach = 2.0f * MortonCellSize;
+    int Stride = std::max(1, Count / 65536);
+    double Sum = 0.0;
+    long long Pairs = 0;
+    for (int i = 0; i < Count; i += Stride) {
+        const Particle& p = Particles[i];
+        int cx = (int)std::floor(p.X / Grid.CellSize);
+        int cy = (int)std::floor(p.Y / Grid.CellSize);
+        for (int oy = -2; oy <= 2; oy++)
+            for (int ox = -2; ox <= 2; ox++) {
+                int Bucket = (int)(((unsigned)(cx + ox) * 73856093u) ^ ((unsigned)(cy + oy) * 19349663u)) & Grid.BucketMask;
+                for (int k = Grid.BucketStart[Bucket]; k < Grid.BucketStart[Bucket + 1]; k++) {
+                    int j = Grid.Indices[k];
+                    float dx = Particles[j].X - p.X, dy = Particles[j].Y - p.Y;
+                    // Hashed buckets can hold far-away cells too
+                    if (j == i || dx * dx + dy * dy > Reach * Reach) continue;
+                    Sum += std::abs(i - j);
+                    Pairs++;
+                }
+            }
+    }
+    return Pairs > 0 ? Sum / Pairs : 0.0;
+}
+
+
+// -------------------- Deterministic Mode --------------------
+void QueueInput(SimulationContext& Sim, const PendingInput& Input)
+{
+    std::lock_guard<std::mutex> Lock(Sim.InputMutex);
+    Sim.PendingInputs.push_back(Input);
+}
+
+// Called at the top of every step, so objects never appear halfway through a pass
+void ApplyPendingInput(SimulationContext& Sim)
+{
+    std::lock_guard<std::mutex> Lock(Sim.InputMutex);
+    size_t Kept = 0;
+    for (size_t i = 0; i < Sim.PendingInputs.size(); i++)
+    {
+        const PendingInput& Input = Sim.PendingInputs[i];
+
+        // Replayed input waits for the step it was recorded at
+        if (Input.Step > Sim.StepIndex)
+        {
+            Sim.PendingInputs[Kept++] = Input;
+            continue;
+        }
+
+        if (Input.ClearWake) {
+            Sim.Wake.Vortices.Resize(0);
+            Sim.Wake.Clears++;
+        }
+        else if (Input.Clear) {
+            Sim.ObjectList.clear();
+            Sim.Loads.Totals.clear();
+        }
+        else
+            Sim.ObjectList.push_back(Input.Item);
+
+        if (Sim.InputLog.is_open())
+        {
+            char Line[160];
+            if (Input.ClearWake)
+                std::snprintf(Line, sizeof(Line), "%lld clear-wake\n", Sim.StepIndex);
+            else if (Input.Clear)
+                std::snprintf(Line, sizeof(Line), "%lld clear\n", Sim.StepIndex);
+            else
+                std::snprintf(Line, sizeof(Line), "%lld add %d %.9g %.9g %.9g %.9g %.9g %.9g\n", Sim.StepIndex,
+                    (int)Input.Item.ObjectType, Input.Item.X, Input.Item.Y, Input.Item.Size,
+                    Input.Item.color.R, Input.Item.color.G, Input.Item.color.B);
+            Sim.InputLog << Line;
+            Sim.InputLog.flush();
+        }
+    }
+    Sim.PendingInputs.resize(Kept);
+}
+
+// Reads a file written by --record-input back into the pending queue
+bool LoadInputReplay(SimulationContext& Sim, const char* Path)
+{
+    std::ifstream File(Path);
+    if (!File)
+    {
+        std::cerr << "Could not open input replay " << Path << "\n";
+        return false;
+    }
+
+    std::string Line;
+    while (std::getline(File, Line))
+    {
+        std::istringstream Words(Line);
+        PendingInput Input;
+        std::string Action;
+        if (!(Words >> Input.Step >> Action))
+            continue;
+
+        if (Action == "clear")
+        {
+            Input.Clear = true;
+        }
+        else if (Action == "clear-wake")
+        {
+            Input.ClearWake = true;
+        }
+        else
+        {
+            int Type = 0;
+            Object& Item = Input.Item;
+            if (Action != "add" || !(Words >> Type >> Item.X >> Item.Y >> Item.Size >> Item.color.R >> Item.color.G >> Item.color.B))
+            {
+                std::cerr << Path << ": can't parse '" << Line << "'\n";
+                return false;
+            }
+            Item.ObjectType = (ObjectTypes)Type;
+        }
+        QueueInput(Sim, Input);
+    }
+    return true;
+}
+
+// splitmix64 finalizer, cheap and well mixed
+inline uint64_t MixHash(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Hashes values rounded to 1/1024 px instead of raw float bits, so last-bit
+// noise from FMA contraction or a different SIMD path rarely changes the hash.
+// Rarely, not never: a value within an ulp of a rounding boundary can still
+// land on either side. Equal hashes mean the states agree to 1/1024, but a
+// different hash across builds needs the golden's tolerance check to mean anything.
+inline uint64_t HashQuantized(uint64_t Hash, float Value)
+{
+    int64_t Fixed = std::isfinite(Value) ? (int64_t)std::llround((double)Value * 1024.0) : INT64_MIN;
+    return MixHash(Hash ^ (uint64_t)Fixed);
+}
+
+// Per-element hashes are summed, which makes the result independent of the
+// order particles and objects are stored or visited in
+uint64_t ComputeStateHash(const SimulationContext& Sim)
+{
+    return ComputeStateHash(Sim.ParticleList, Sim.ObjectList);
+}
+
+uint64_t ComputeStateHash(const ParticleVector& Particles, const std::vector<Object>& Objects)
+{
+    uint64_t Hash = MixHash(Particles.size()) ^ MixHash(Objects.size() + 0x9E3779B97F4A7C15ull);
+
+    for (const Particle& p : Particles)
+    {
+        uint64_t h = 0x243F6A8885A308D3ull;
+        h = HashQuantized(h, p.X);
+        h = HashQuantized(h, p.Y);
+        h = HashQuantized(h, p.Velocity.x);
+        h = HashQuantized(h, p.Velocity.y);
+        h = HashQuantized(h, p.OringialY);
+        const RGB& Color = ParticlePalette[p.State];
+        h = HashQuantized(h, Color.R + 2.0f * Color.G + 4.0f * Color.B);
+        Hash += MixHash(h);
+    }
+
+    for (const Object& Item : Objects)
+    {
+        uint64_t h = 0x13198A2E03707344ull ^ (uint64_t)Item.ObjectType;
+        h = HashQuantized(h, Item.X);
+        h = HashQuantized(h, Item.Y);
+        h = HashQuantized(h, Item.Size);
+        Hash += MixHash(h);
+    }
+    return Hash;
+}
+
+
+// -------------------- NUMA Placement --------------------
+// Rebinds the particle storage (and the render batches) to Numa. Call before
+// PopulateParticleList so the particles land on their nodes from the start.
+void EnableNumaPlacement(SimulationContext& Sim, NumaPlacement* Numa)
+{
+    Sim.Numa = Numa;
+    ParticleVector Placed{ NumaAllocator<Particle>(Numa) };
+    Placed.assign(Sim.ParticleList.begin(), Sim.ParticleList.end());
+    Sim.ParticleList = std::move(Placed);
+    Sim.CollisionSnapshot = ParticleVector(NumaAllocator<Particle>(Numa));
+    for (FrameSnapshot& Frame : Sim.Frames)
+        Frame.ParticleBatch = BatchVector(NumaAllocator<float>(Numa));
+}
+
+// Asks the kernel where each node's slice of the particles actually lives
+void MeasurePageLocality(SimulationContext& Sim)
+{
+    if (!Sim.Numa) return;
+    const NumaTopology& Topology = Sim.Numa->Layout();
+    int Count = (int)Sim.ParticleList.size();
+    std::vector<int> PageNodes;
+    for (int n = 0; n < Sim.Numa->NodeCount(); n++)
+    {
+        int Begin = Sim.Numa->SliceBegin(Count, n);
+        int End = Sim.Numa->SliceBegin(Count, n + 1);
+        Sim.Profile.NodeLocalPages[n] = -1.0;
+        if (End <= Begin || !QueryPageNodes(Sim.ParticleList.data() + Begin, (size_t)(End - Begin) * sizeof(Particle), PageNodes))
+            continue;
+        int Local = 0;
+        for (int Node : PageNodes)
+            Local += Node == Topology.OsNode[n];
+        Sim.Profile.NodeLocalPages[n] = PageNodes.empty() ? -1.0 : (double)Local / PageNodes.size();
+    }
+}
+
+void PrintNumaReport(const SimulationContext& Sim)
+{
+    if (!Sim.Numa) return;
+    const NumaTopology& Topology = Sim.Numa->Layout();
+    const Profiler& Profile = Sim.Profile;
+    std::printf("NUMA: %d node(s)%s\n", Topology.NodeCount(), Topology.Emulated ? " (emulated)" : "");
+    for (int n = 0; n < Topology.NodeCount(); n++)
+    {
+        char Pages[32] = "n/a";
+        if (Profile.NodeLocalPages[n] >= 0.0)
+            std::snprintf(Pages, sizeof(Pages), "%.1f%%", Profile.NodeLocalPages[n] * 100.0);
+        std::printf("  node %d: %3d cpus  %8.3f GB/s  remote chunks %5.1f%%  local pages %s\n", n,
+            (int)Topology.NodeCpus[n].size(), Profile.NodeGBs[n], Profile.NodeRemoteShare[n] * 100.0, Pages);
+    }
+}
+
+// Where particle storage got its pages from, and how much of it the kernel
+// actually backs with huge pages right now
+void PrintHugePageReport(const SimulationContext& Sim)
+{
+    if (!Sim.Numa || Sim.Numa->PageMode() == HugePagesOff) return;
+    const HugePageCounters& Stats = HugePageStats();
+    std::printf("Huge pages (%s): %.1f MB explicit, %.1f MB transparent, %.1f MB normal pages\n", HugePageModeNames[Sim.Numa->PageMode()],
+        Stats.ExplicitBytes / 1048576.0, Stats.TransparentBytes / 1048576.0, Stats.NormalBytes / 1048576.0);
+    long long Backed = Sim.ParticleList.empty() ? -1 : QueryHugeBackedBytes(Sim.ParticleList.data());
+    if (Backed >= 0)
+        std::printf("  particles: %.1f of %.1f MB in huge pages\n", Backed / 1048576.0,
+            Sim.ParticleList.capacity() * sizeof(Particle) / 1048576.0);
+}
+
+// -------------------- Strip Decomposition --------------------
+// --ranks N splits the screen into N vertical strips, each simulated by its own
+// process on this host (Linux only). Every step runs in stages with a barrier
+// between each:
+//   publish  rank 0 applies input and publishes the parameters and objects
+//   update   every rank advances its own particles and sends the ones that left
+//            its strip to their new owner
+//   halo     particles within one contact distance of a strip edge are copied
+//            to the neighbour as ghosts, the halo cells of its grid
+//   collide  own particles against own + ghosts, against a snapshot like the task graph
+//   view     every rank copies its particles to its view slot, rank 0 draws them all
+// Particles carry their original index as an id and contacts are visited in id
+// order, so the result matches a single deterministic process hash for hash.
+int StripOwner(const StripDomain& Domain, float X)
+{
+    int Rank = (int)std::floor(X / Domain.StripWidth);
+    return std::min(std::max(Rank, 0), Domain.Ranks - 1);
+}
+
+void DrainStripInbox(StripDomain& Domain)
+{
+    StripMessage Message;
+    for (int From = 0; From < Domain.Ranks; From++)
+    {
+        if (From == Domain.Rank) continue;
+        SpscRing<StripMessage>& Ring = Domain.Rings[From * Domain.Ranks + Domain.Rank];
+        while (Ring.TryPop(Message))
+            (Message.Ghost ? Domain.Ghosts : Domain.Migrants).push_back(Message);
+    }
+}
+
+// Keeps draining our inbox while it waits, so a rank stuck sending to us into a
+// full ring always gets through. False once the run is over.
+bool StripBarrier(StripDomain& Domain)
+{
+    bool Ok = Domain.Shared->Barrier.Wait(Domain.Ranks, [&Domain]() {
+        DrainStripInbox(Domain);
+        if (Domain.Shared->Quit.load())
+            return false;
+#ifdef __linux__
+        // A rank that died would leave everyone waiting forever
+        if (Domain.Rank == 0 && waitpid(-1, nullptr, WNOHANG) > 0)
+        {
+            std::cerr << "A strip process exited, stopping\n";
+            Domain.Shared->Quit = 1;
+            return false;
+        }
+#endif
+        return true;
+    });
+    DrainStripInbox(Domain);
+    return Ok;
+}
+
+void SendStrip(StripDomain& Domain, int To, const StripMessage& Message)
+{
+    SpscRing<StripMessage>& Ring = Domain.Rings[Domain.Rank * Domain.Ranks + To];
+    while (!Ring.TryPush(Message))
+    {
+        // Drain our own inbox too, or two ranks filling each other's rings would deadlock
+        DrainStripInbox(Domain);
+        if (Domain.Shared->Quit.load())
+            return;
+        std::this_thread::yield();
+    }
+}
+
+// Every rank builds the same initial list and keeps the part in its strip
+void KeepOwnStrip(SimulationContext& Sim)
+{
+    StripDomain& Domain = *Sim.Domain;
+    Domain.Ids.clear();
+    int Kept = 0;
+    for (int i = 0; i < (int)Sim.ParticleList.size(); i++)
+    {
+        if (StripOwner(Domain, Sim.ParticleList[i].X) != Domain.Rank)
+            continue;
+        Sim.ParticleList[Kept++] = Sim.ParticleList[i];
+        Domain.Ids.push_back(i);
+    }
+    Sim.ParticleList.resize(Kept);
+}
+
+// One step of this rank's strip. False once the run is over.
+bool StepStrip(SimulationContext& Sim)
+{
+    StripDomain& Domain = *Sim.Domain;
+    StripShared& Shared = *Domain.Shared;
+    auto Start = BeginStep(Sim);
+
+    // ---- Publish ----
+    if (Domain.Rank == 0)
+    {
+        ApplyPendingInput(Sim);
+        if (Sim.ObjectList.size() > StripMaxObjects)
+            Sim.ObjectList.resize(StripMaxObjects);
+        Shared.dt = Sim.dt; Shared.f = Sim.f; Shared.k = Sim.k;
+        Shared.dPdx = Sim.dPdx; Shared.dPdy = Sim.dPdy; Shared.u = Sim.u; Shared.v = Sim.v;
+        Shared.Broadphase = Sim.Broadphase;
+        Shared.VerletSkin = Sim.Verlet.Skin;
+        Shared.WindSource = Sim.WindSource;
+        Shared.VortexTheta = Sim.Wake.Theta;
+        Shared.VortexCore = Sim.Wake.Core;
+        Shared.VortexClears = Sim.Wake.Clears;
+        Shared.VortexEvaluator = Sim.Wake.Evaluator;
+        Shared.MultipoleOrder = Sim.Wake.Multipole.Order;
+        Shared.WindIntegrator = Sim.Integrator;
+        Shared.EvolveWind = Sim.EvolveWind;
+        Shared.PressureField = Sim.UsePressureField;
+        Shared.Turbulence = Sim.Turbulence.Enabled;
+        Shared.TurbulenceAmplitude = Sim.Turbulence.Amplitude;
+        Shared.TurbulenceScale = Sim.Turbulence.Scale;
+        Shared.ObjectCount = (int)Sim.ObjectList.size();
+        std::copy(Sim.ObjectList.begin(), Sim.ObjectList.end(), Shared.Objects);
+    }
+    if (!StripBarrier(Domain))
+        return false;
+    if (Domain.Rank != 0)
+    {
+        Sim.dt = Shared.dt; Sim.f = Shared.f; Sim.k = Shared.k;
+        Sim.dPdx = Shared.dPdx; Sim.dPdy = Shared.dPdy; Sim.u = Shared.u; Sim.v = Shared.v;
+        Sim.Broadphase = (BroadphaseModes)Shared.Broadphase;
+        Sim.Verlet.Skin = Shared.VerletSkin;
+        Sim.WindSource = (WindSources)Shared.WindSource;
+        Sim.Wake.Theta = Shared.VortexTheta;
+        Sim.Wake.Core = Shared.VortexCore;
+        if (Sim.Wake.Clears != Shared.VortexClears) {
+            Sim.Wake.Vortices.Resize(0);
+            Sim.Wake.Clears = Shared.VortexClears;
+        }
+        Sim.Wake.Evaluator = (VortexEvaluators)Shared.VortexEvaluator;
+        Sim.Wake.Multipole.Order = Shared.MultipoleOrder;
+        Sim.Integrator = (WindIntegrators)Shared.WindIntegrator;
+        Sim.EvolveWind = Shared.EvolveWind != 0;
+        Sim.UsePressureField = Shared.PressureField != 0;
+        Sim.Turbulence.Enabled = Shared.Turbulence != 0;
+        Sim.Turbulence.Amplitude = Shared.TurbulenceAmplitude;
+        Sim.Turbulence.Scale = Shared.TurbulenceScale;
+        Sim.ObjectList.assign(Shared.Objects, Shared.Objects + Shared.ObjectCount);
+    }
+
+    // ---- Update and migration ----
+    SelectStepKernel(Sim);
+    AdvanceWind(Sim);
+    PrepareWindField(Sim);
+    {
+        ProfileScope Scope(Sim.Profile, PhaseUpdate);
+        RecycleWindParticles(Sim);
+        UpdateWindParticles(Sim);
+    }
+    long long Migrated = 0, GhostsSent = 0;
+    {
+        ProfileScope Scope(Sim.Profile, PhaseExchange);
+        int Kept = 0;
+        for (int i = 0; i < (int)Sim.ParticleList.size(); i++)
+        {
+            const Particle& p = Sim.ParticleList[i];
+            int Owner = StripOwner(Domain, p.X);
+            if (Owner != Domain.Rank)
+            {
+                SendStrip(Domain, Owner, { Domain.Ids[i], 0, p });
+                Migrated++;
+                continue;
+            }
+            Sim.ParticleList[Kept] = p;
+            Domain.Ids[Kept] = Domain.Ids[i];
+            Kept++;
+        }
+        Sim.ParticleList.resize(Kept);
+        Domain.Ids.resize(Kept);
+        if (!StripBarrier(Domain))
+            return false;
+        // Lists are emptied as soon as they're used: a fast rank's messages for
+        // the next stage can already be in our inbox by the time we get here
+        for (const StripMessage& Message : Domain.Migrants)
+        {
+            Sim.ParticleList.push_back(Message.Item);
+            Domain.Ids.push_back(Message.Id);
+        }
+        Domain.Migrants.clear();
+
+        // ---- Halo ----
+        // Wide enough for every candidate a particle near the edge can meet: an
+        // object can push it up to its radius before the particle contacts are
+        // checked, and the grid looks one cell beyond the particle's own
+        float Halo = StripHalo;
+        float Reach = 0.0f;
+        for (const Object& Item : Sim.ObjectList)
+            Reach = std::max(Reach, Item.Size + 5.0f);
+        Halo += Reach;
+        float Begin = Domain.Rank * Domain.StripWidth;
+        float End = Begin + Domain.StripWidth;
+        for (int i = 0; i < (int)Sim.ParticleList.size(); i++)
+        {
+            const Particle& p = Sim.ParticleList[i];
+            if (Domain.Rank > 0 && p.X < Begin + Halo) {
+                SendStrip(Domain, Domain.Rank - 1, { Domain.Ids[i], 1, p });
+                GhostsSent++;
+            }
+            if (Domain.Rank + 1 < Domain.Ranks && p.X >= End - Halo) {
+                SendStrip(Domain, Domain.Rank + 1, { Domain.Ids[i], 1, p });
+                GhostsSent++;
+            }
+        }
+        if (!StripBarrier(Domain))
+            return false;
+    }
+
+    // ---- Collide ----
+    {
+        ProfileScope Scope(Sim.Profile, PhaseCollision);
+        int Own = (int)Sim.ParticleList.size();
+        int Total = Own + (int)Domain.Ghosts.size();
+        auto IdOf = [&Domain, Own](int k) { return k < Own ? Domain.Ids[k] : Domain.Ghosts[k - Own].Id; };
+        Domain.Order.resize(Total);
+        for (int k = 0; k < Total; k++)
+            Domain.Order[k] = k;
+        std::sort(Domain.Order.begin(), Domain.Order.end(), [&IdOf](int a, int b) { return IdOf(a) < IdOf(b); });
+
+        Domain.Local.resize(Total);
+        Domain.SelfInLocal.resize(Own);
+        for (int n = 0; n < Total; n++)
+        {
+            int k = Domain.Order[n];
+            Domain.Local[n] = k < Own ? Sim.ParticleList[k] : Domain.Ghosts[k - Own].Item;
+            if (k < Own)
+                Domain.SelfInLocal[k] = n;
+        }
+        PrepareBroadphase(Sim, Domain.Local);
+        CheckCollisionRange(Sim, 0, Own, Domain.Local, Domain.SelfInLocal.data());
+        Domain.Ghosts.clear();
+    }
+
+    // ---- View ----
+    int Own = std::min((int)Sim.ParticleList.size(), Domain.ViewCapacity);
+    std::copy(Sim.ParticleList.begin(), Sim.ParticleList.begin() + Own, Domain.Views[Domain.Rank]);
+    Shared.ViewCount[Domain.Rank] = Own;
+    Shared.Migrated[Domain.Rank] = Migrated;
+    Shared.GhostsSent[Domain.Rank] = GhostsSent;
+    ReduceObjectLoads(Sim);
+    std::copy(Sim.Loads.Step.begin(), Sim.Loads.Step.end(), Shared.ObjectLoads[Domain.Rank]);
+    if (!StripBarrier(Domain))
+        return false;
+
+    if (Domain.Rank == 0)
+    {
+        for (int Rank = 1; Rank < Domain.Ranks; Rank++)
+            for (size_t j = 0; j < Sim.Loads.Step.size(); j++) {
+                const ObjectLoad& Theirs = Shared.ObjectLoads[Rank][j];
+                Sim.Loads.Step[j].ImpulseX += Theirs.ImpulseX;
+                Sim.Loads.Step[j].ImpulseY += Theirs.ImpulseY;
+                Sim.Loads.Step[j].Contacts += Theirs.Contacts;
+            }
+        Domain.Gathered.assign(Sim.ParticleList.begin(), Sim.ParticleList.end());
+        for (int Rank = 1; Rank < Domain.Ranks; Rank++)
+            Domain.Gathered.insert(Domain.Gathered.end(), Domain.Views[Rank], Domain.Views[Rank] + Shared.ViewCount[Rank]);
+    }
+    FinishStep(Sim, Start);
+    return true;
+}
+
+// Rank 0's frame: step every strip, then draw what they all published
+void RenderStrips(SimulationContext& Sim)
+{
+    if (!StepStrip(Sim) && window)
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+
+    ProfileScope Scope(Sim.Profile, PhaseDraw);
+    const ParticleVector& Particles = Sim.Domain->Gathered;
+    BatchVector& Batch = Sim.Frames[0].ParticleBatch;
+    Batch.resize(Particles.size() * BatchVerticesPerParticle * BatchFloatsPerVertex);
+    PrepareParticleBatch(Particles, Batch, 0, (int)Particles.size());
+    DrawParticleBatch(Batch);
+    DrawObjects(Sim);
+}
+
+// Forks Ranks - 1 strip processes that run until StopStripDomain. Has to happen
+// before any thread, window or log file exists. Only rank 0 returns.
+bool StartStripDomain(SimulationContext& Sim, StripDomain& Domain, int Ranks)
+{
+#ifdef __linux__
+    Ranks = std::min({ Ranks, StripMaxRanks, (int)(Sim.ScreenSize.x / StripHalo) });
+    Domain.Ranks = Ranks;
+    Domain.StripWidth = Sim.ScreenSize.x / Ranks;
+    // No particles are ever created after the start, so any rank can hold them all
+    Domain.ViewCapacity = ((int)std::ceil(Sim.ScreenSize.x / Sim.ParticleDistanceX) + 1) * Sim.ParticleAmount;
+
+    size_t RingHeaders = AlignShared(sizeof(StripShared));
+    size_t RingItems = AlignShared(RingHeaders + sizeof(SpscRingHeader) * Ranks * Ranks);
+    size_t ViewItems = AlignShared(RingItems + sizeof(StripMessage) * StripRingCapacity * Ranks * Ranks);
+    size_t Bytes = ViewItems + sizeof(Particle) * (size_t)Domain.ViewCapacity * Ranks;
+    if (!Domain.Segment.Create(Bytes))
+    {
+        std::cerr << "Could not create a " << Bytes << " byte shared memory segment\n";
+        return false;
+    }
+
+    unsigned char* Base = Domain.Segment.Data();
+    Domain.Shared = new (Base) StripShared();
+    for (int i = 0; i < Ranks * Ranks; i++)
+    {
+        SpscRing<StripMessage> Ring;
+        Ring.Header = new (Base + RingHeaders + sizeof(SpscRingHeader) * i) SpscRingHeader();
+        Ring.Items = reinterpret_cast<StripMessage*>(Base + RingItems) + StripRingCapacity * i;
+        Ring.Capacity = StripRingCapacity;
+        Domain.Rings.push_back(Ring);
+    }
+    for (int Rank = 0; Rank < Ranks; Rank++)
+        Domain.Views.push_back(reinterpret_cast<Particle*>(Base + ViewItems) + (size_t)Domain.ViewCapacity * Rank);
+    Sim.Domain = &Domain;
+
+    std::cout << "Splitting the domain into " << Ranks << " strips of " << Domain.StripWidth << " px, one process each\n";
+    std::cout.flush();
+    pid_t Parent = getpid();
+    for (int Rank = 1; Rank < Ranks; Rank++)
+    {
+        pid_t Child = fork();
+        if (Child < 0)
+        {
+            std::perror("fork");
+            Domain.Shared->Quit = 1;
+            return false;
+        }
+        if (Child == 0)
+        {
+            // Go down with rank 0, and skip its atexit handlers and destructors on the way out
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != Parent)
+                _exit(1);
+            Domain.Rank = Rank;
+            Domain.Children.clear();
+            PopulateParticleList(Sim);
+            while (StepStrip(Sim)) {}
+            _exit(0);
+        }
+        Domain.Children.push_back((int)Child);
+    }
+    Domain.Rank = 0;
+    return true;
+#else
+    (void)Sim; (void)Domain; (void)Ranks;
+    std::cerr << "--ranks needs Linux\n";
+    return false;
+#endif
+}
 
-Vector2D CheckCursorInWindow() {
-    if (!window) return { -1, -1 }; // invalid cursor/window
+void StopStripDomain(SimulationContext& Sim)
+{
+    if (!Sim.Domain) return;
+    Sim.Domain->Shared->Quit = 1;
+#ifdef __linux__
+    for (int Child : Sim.Domain->Children)
+        waitpid(Child, nullptr, 0);
+#endif
+    Sim.Domain = nullptr;
+}
 
-    // Get window size
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
 
-    // Get cursor position relative to window
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
+// -------------------- Parameter Sweep --------------------
+// Spec file, one entry per line ('#' starts a comment):
+//   f     <start> <end> <step>     (same for k, dPdx, dPdy, dt)
+//   steps <count>
+//   circle <x> <y> <size>          obstacle shared by every run
+//   deterministic                  order-independent collisions (final_hash then matches across builds)
+//   integrator euler|exp           how the wind state steps (exp stays stable at any dt)
+//   evolve                         carry the wind state over from step to step
+//   precision float|double|half    scalar policy of the particle kernels
+//   wind uniform|amr|vortex        wind field (vortex: the circles' shed wake)
+//   vortex_fmm <order>             evaluate the wake by fast multipole instead of Barnes-Hut
+// Every combination of the ranges becomes one run.
+struct SweepRange { float Start, End, Step; };
+struct SweepSpec
+{
+    SweepRange f = { 0.0f, 0.0f, 0.0f };
+    SweepRange k = { 0.1f, 0.1f, 0.0f };
+    SweepRange dPdx = { 0.0f, 0.0f, 0.0f };
+    SweepRange dPdy = { 0.0f, 0.0f, 0.0f };
+    SweepRange dt = { 0.1f, 0.1f, 0.0f };
+    int Steps = 500;
+    bool Deterministic = false;
+    WindIntegrators Integrator = EulerIntegrator;
+    bool EvolveWind = false;
+    PrecisionModes Precision = SinglePrecision;
+    WindSources WindSource = UniformWind;
+    int MultipoleOrder = 0;                 // 0 keeps Barnes-Hut
+    std::vector<Object> ObjectList;
+};
+struct SweepRun { float dt, f, k, dPdx, dPdy; };
+struct SweepResult
+{
+    double MeanSpeed = 0.0;
+    long long ObjectCollisions = 0;
+    long long ParticleCollisions = 0;
+    double WallMs = 0.0;
+    uint64_t FinalHash = 0;
+};
 
-    // Flip Y coordinate
-    ypos = height - ypos;
+std::vector<float> ExpandSweepRange(const SweepRange& Range)
+{
+    std::vector<float> Values;
+    if (Range.Step <= 0.0f || Range.End <= Range.Start)
+    {
+        Values.push_back(Range.Start);
+        return Values;
+    }
+    int Count = (int)std::floor((Range.End - Range.Start) / Range.Step + 1e-4f) + 1;
+    for (int i = 0; i < Count; i++)
+        Values.push_back(Range.Start + i * Range.Step);
+    return Values;
+}
 
-    // Check if inside bounds
-    if (xpos < 0 || xpos > width || ypos < 0 || ypos > height)
-        return { -1, -1 }; // cursor is outside
+bool LoadSweepSpec(const char* Path, SweepSpec& Spec)
+{
+    std::ifstream File(Path);
+    if (!File)
+    {
+        std::cerr << "Could not open sweep spec " << Path << "\n";
+        return false;
+    }
 
-    return { xpos, ypos };
+    std::string Line;
+    int LineNumber = 0;
+    while (std::getline(File, Line))
+    {
+        LineNumber++;
+        size_t Comment = Line.find('#');
+        if (Comment != std::string::npos)
+            Line.erase(Comment);
+
+        std::istringstream Words(Line);
+        std::string Key;
+        if (!(Words >> Key))
+            continue;
+
+        bool Ok = true;
+        SweepRange* Range = nullptr;
+        if (Key == "f") Range = &Spec.f;
+        else if (Key == "k") Range = &Spec.k;
+        else if (Key == "dPdx") Range = &Spec.dPdx;
+        else if (Key == "dPdy") Range = &Spec.dPdy;
+        else if (Key == "dt") Range = &Spec.dt;
+
+        if (Range)
+        {
+            Ok = static_cast<bool>(Words >> Range->Start);
+            Range->End = Range->Start;
+            Range->Step = 0.0f;
+            if (Ok && (Words >> Range->End) && !(Words >> Range->Step))
+                Ok = Range->End == Range->Start;
+        }
+        else if (Key == "deterministic")
+        {
+            Spec.Deterministic = true;
+        }
+        else if (Key == "integrator")
+        {
+            std::string Name;
+            Ok = (Words >> Name) && (Name == "euler" || Name == "exp");
+            Spec.Integrator = Name == "exp" ? ExponentialIntegrator : EulerIntegrator;
+        }
+        else if (Key == "evolve")
+        {
+            Spec.EvolveWind = true;
+        }
+        else if (Key == "precision")
+        {
+            std::string Name;
+            Ok = (Words >> Name) && (Name == "float" || Name == "double" || Name == "half");
+            Spec.Precision = Name == "double" ? DoublePrecision : Name == "half" ? HalfStoragePrecision : SinglePrecision;
+        }
+        else if (Key == "wind")
+        {
+            std::string Name;
+            Ok = (Words >> Name) && (Name == "uniform" || Name == "amr" || Name == "vortex");
+            Spec.WindSource = Name == "amr" ? QuadtreeWind : Name == "vortex" ? VortexWind : UniformWind;
+        }
+        else if (Key == "vortex_fmm")
+        {
+            Ok = (Words >> Spec.MultipoleOrder) && Spec.MultipoleOrder >= 1 && Spec.MultipoleOrder <= FastMultipole::MaxOrder;
+        }
+        else if (Key == "steps")
+        {
+            Ok = static_cast<bool>(Words >> Spec.Steps);
+        }
+        else if (Key == "circle")
+        {
+            Object Item;
+            Ok = static_cast<bool>(Words >> Item.X >> Item.Y >> Item.Size);
+            Item.color = { 1.0f, 1.0f, 1.0f };
+            Item.ObjectType = Circle;
+            Spec.ObjectList.push_back(Item);
+        }
+        else
+        {
+            Ok = false;
+        }
+
+        if (!Ok)
+        {
+            std::cerr << Path << ":" << LineNumber << ": can't parse '" << Line << "'\n";
+            return false;
+        }
+    }
+    return true;
 }
 
-void CheckCollision()
+// Pressure, when there is one, overrides every run's dPdx and dPdy
+SweepResult RunSweepInstance(const SweepSpec& Spec, const SweepRun& Run, const std::shared_ptr<const PressureGradient>& Pressure)
 {
-    const float particleRadius = 5.0f;
+    auto Start = std::chrono::steady_clock::now();
 
-    for (int i = 0; i < ParticleList.size(); i++)
+    // Each instance lives entirely on the calling worker thread
+    SimulationContext Context;
+    Context.dt = Run.dt;
+    Context.f = Run.f;
+    Context.k = Run.k;
+    Context.dPdx = Run.dPdx;
+    Context.dPdy = Run.dPdy;
+    Context.Deterministic = Spec.Deterministic;
+    Context.Integrator = Spec.Integrator;
+    Context.EvolveWind = Spec.EvolveWind;
+    Context.Precision = Spec.Precision;
+    Context.WindSource = Spec.WindSource;
+    if (Spec.MultipoleOrder > 0)
     {
-        Particle& p = ParticleList[i];
-        bool collided = false;
+        Context.Wake.Evaluator = MultipoleEvaluator;
+        Context.Wake.Multipole.Order = Spec.MultipoleOrder;
+    }
+    Context.ObjectList = Spec.ObjectList;
+    Context.Pressure = Pressure;
+    Context.UsePressureField = Pressure != nullptr;
+    PopulateParticleList(Context);
 
-        // ---- Collision with Objects ----
-        for (int j = 0; j < ObjectList.size(); j++)
+    double SpeedSum = 0.0;
+    long long SpeedSamples = 0;
+    for (int Step = 0; Step < Spec.Steps; Step++)
+    {
+        StepSimulation(Context);
+        for (const Particle& p : Context.ParticleList)
+            SpeedSum += std::sqrt(p.Velocity.x * p.Velocity.x + p.Velocity.y * p.Velocity.y);
+        SpeedSamples += Context.ParticleList.size();
+    }
+
+    SweepResult Result;
+    Result.MeanSpeed = SpeedSamples > 0 ? SpeedSum / SpeedSamples : 0.0;
+    Result.ObjectCollisions = Context.ObjectCollisions;
+    Result.ParticleCollisions = Context.ParticleCollisions;
+    Result.FinalHash = ComputeStateHash(Context);
+    Result.WallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    return Result;
+}
+
+int RunSweep(const char* SpecPath, const char* OutPath, int ThreadCount, std::shared_ptr<const PressureGradient> Pressure)
+{
+    SweepSpec Spec;
+    if (!LoadSweepSpec(SpecPath, Spec))
+        return 1;
+
+    std::vector<SweepRun> Runs;
+    for (float dtValue : ExpandSweepRange(Spec.dt))
+        for (float fValue : ExpandSweepRange(Spec.f))
+            for (float kValue : ExpandSweepRange(Spec.k))
+                for (float dPdxValue : ExpandSweepRange(Spec.dPdx))
+                    for (float dPdyValue : ExpandSweepRange(Spec.dPdy))
+                        Runs.push_back({ dtValue, fValue, kValue, dPdxValue, dPdyValue });
+
+    if (ThreadCount <= 0)
+        ThreadCount = (int)std::thread::hardware_concurrency();
+    if (ThreadCount <= 0)
+        ThreadCount = 1;
+    if (ThreadCount > (int)Runs.size())
+        ThreadCount = (int)Runs.size();
+
+    std::cout << "Sweep: " << Runs.size() << " runs x " << Spec.Steps << " steps on " << ThreadCount << " threads";
+    if (Pressure)
+        std::cout << ", pressure map " << Pressure->Width << " x " << Pressure->Height << " in place of dPdx and dPdy";
+    std::cout << "\n";
+
+    // Workers pull the next run index until the list is exhausted
+    std::vector<SweepResult> Results(Runs.size());
+    std::atomic<int> NextRun(0);
+    std::atomic<int> Finished(0);
+    auto Worker = [&]() {
+        for (int i = NextRun++; i < (int)Runs.size(); i = NextRun++)
         {
-            Object& obj = ObjectList[j];
-            if (obj.ObjectType != Circle)
-                continue;
+            Results[i] = RunSweepInstance(Spec, Runs[i], Pressure);
+            int Done = ++Finished;
+            if (Done % 10 == 0 || Done == (int)Runs.size())
+                std::cout << "  " << Done << "/" << Runs.size() << " done\n";
+        }
+    };
+
+    auto Start = std::chrono::steady_clock::now();
+    std::vector<std::thread> Workers;
+    for (int t = 0; t < ThreadCount; t++)
+        Workers.emplace_back(Worker);
+    for (std::thread& t : Workers)
+        t.join();
+    double TotalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+
+    std::ofstream Out(OutPath);
+    if (!Out)
+    {
+        std::cerr << "Could not write sweep results to " << OutPath << "\n";
+        return 1;
+    }
+    Out << "run,dt,f,k,dPdx,dPdy,mean_speed,object_collisions,particle_collisions,wall_ms,final_hash\n";
+    for (size_t i = 0; i < Runs.size(); i++)
+    {
+        const SweepRun& Run = Runs[i];
+        const SweepResult& Result = Results[i];
+        Out << i << "," << Run.dt << "," << Run.f << "," << Run.k << "," << Run.dPdx << "," << Run.dPdy << ","
+            << Result.MeanSpeed << "," << Result.ObjectCollisions << "," << Result.ParticleCollisions << ","
+            << Result.WallMs << ",";
+        char Hash[24];
+        std::snprintf(Hash, sizeof(Hash), "%016" PRIx64, Result.FinalHash);
+        Out << Hash << "\n";
+    }
+
+    std::cout << "Sweep finished in " << TotalMs << " ms, results in " << OutPath << "\n";
+    return 0;
+}
+
+
+// -------------------- Headless Capture --------------------
+// Renders straight into the capture framebuffer without showing a window or the
+// ImGui panel. On Linux without a display this runs on GLFW's null platform with
+// an OSMesa context, i.e. Mesa llvmpipe.
+int RunHeadlessCapture(SimulationContext& Sim, const char* Directory, CaptureFormats Format, int Frames)
+{
+    window = StartGLFW(Sim.ScreenSize, true);
+    if (!window) return -1;
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, Sim.ScreenSize.x, 0, Sim.ScreenSize.y, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    PopulateParticleList(Sim);
+
+    FrameCapture Capture;
+    if (!Capture.Init((int)Sim.ScreenSize.x, (int)Sim.ScreenSize.y, Directory, Format))
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return 1;
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    int Rendered = 0;
+    for (; Rendered < Frames && !glfwWindowShouldClose(window); Rendered++)
+    {
+        Capture.BeginFrame();
+        glClear(GL_COLOR_BUFFER_BIT);
+        Render(Sim);
+        Capture.EndFrame();
+    }
+    Capture.Shutdown();
+    double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    std::cout << "Captured " << Capture.FramesWritten() << " frames to " << Directory << " in " << Seconds << " s ("
+              << (Seconds > 0 ? Rendered / Seconds : 0.0) << " fps)\n";
+    std::cout << "Heap allocations: " << Sim.Profile.StepAllocations << " in the last step, none in the last " << Sim.Profile.QuietSteps
+              << " steps, " << Sim.Arenas.GrowthCount() << " arena growths\n";
+    if (Sim.Broadphase == VerletListBroadphase && Sim.Verlet.Steps > 0)
+        std::cout << "Verlet lists: " << Sim.Verlet.Rebuilds << " rebuilds in " << Sim.Verlet.Steps << " steps, "
+                  << (Sim.Verlet.Rows.empty() ? 0.0 : (double)Sim.Verlet.Pairs / Sim.Verlet.Rows.size()) << " pairs per particle\n";
+    if (PositionBasedContacts(Sim))
+        std::cout << "Contacts: " << Sim.Contacts.Pairs.size() << " pairs in " << Sim.Contacts.Colours << " colours, "
+                  << Sim.Contacts.IterationsUsed << " iterations in the last step (" << Sim.Contacts.MeanIterations
+                  << " on average), " << Sim.Contacts.Residual << " px overlap in the last iteration\n";
+    if (Sim.WindSource == QuadtreeWind && Sim.WindField.Builds > 0)
+        std::cout << "Wind quadtree: " << Sim.WindField.Keys.size() << " leaves (" << 100.0 * Sim.WindField.Keys.size() / std::pow(4.0, Sim.WindField.MaxDepth)
+                  << "% of a uniform grid at depth " << Sim.WindField.MaxDepth << "), " << Sim.WindField.Builds << " builds, "
+                  << Sim.WindField.HitRate * 100.0 << "% of lookups hit the cached leaf\n";
+    if (Sim.WindSource == VortexWind && Sim.Wake.Evaluator == MultipoleEvaluator)
+        std::cout << "Vortex wake: " << Sim.Wake.Vortices.Size() << " vortices (" << Sim.Wake.Shed << " shed), order "
+                  << Sim.Wake.Multipole.Order << " multipole over " << Sim.Wake.Multipole.LevelCount() << " levels\n";
+    else if (Sim.WindSource == VortexWind)
+        std::cout << "Vortex wake: " << Sim.Wake.Vortices.Size() << " vortices (" << Sim.Wake.Shed << " shed), "
+                  << Sim.Wake.Tree.NodeCount() << " tree cells at opening angle " << Sim.Wake.Theta << "\n";
+    std::cout << "Step kernel: " << StepKernelName(Sim.KernelFlags) << "\n";
+    if (TurbulenceActive(Sim))
+        std::cout << "Turbulence: " << Sim.Profile.PhaseMs[PhaseTurbulence] * 1e6 / std::max<size_t>(1, Sim.ParticleList.size())
+                  << " ns per particle, " << Sim.Turbulence.Cache.TileCount() << " tiles of " << Sim.Turbulence.Cache.LatticeSpacing()
+                  << " px cells, " << Sim.Turbulence.Cache.Refills() << " refills\n";
+    if (PrecisionKernels(Sim))
+        std::cout << "Precision: " << PrecisionModeNames[Sim.Precision] << " kernels, "
+                  << (Sim.Precision == DoublePrecision ? PrecisionStore<DoublePolicy>::BytesPerParticle() : PrecisionStore<HalfPolicy>::BytesPerParticle())
+                  << " B per particle in their store\n";
+    PrintObjectLoads(Sim);
+    MeasurePageLocality(Sim);
+    PrintNumaReport(Sim);
+    PrintHugePageReport(Sim);
+    if (Sim.CompactFrames)
+        PrintCompactReport(Sim);
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
+
+
+// -------------------- Regression Runner --------------------
+// Runs a fixed set of scenes headlessly through StepSimulation and checks two things:
+//   state: final particles/objects vs <dir>/<scene>.golden, within StateTolerance pixels
+//   speed: step time vs <dir>/timings.baseline, see below
+//   heap:  no heap allocations in any step after the first RegressionWarmupSteps
+// Missing files are written on the first run (or always with --update-golden), so
+// record on a known-good build, then rerun after a change. Exit code is 0 only if
+// every scene passes.
+//
+// Each scene runs RegressionTimingRuns times, taking turns with the other
+// scenes. A run's time is the lower quartile of its steps after the warm-up,
+// and the scene's time is the fastest run, the one least disturbed by the
+// rest of the machine. The baseline keeps
+// that and the slowest run next to it, and a scene is only slower once its
+// fastest run is past both TimeThreshold x baseline and the baseline's
+// slowest run, so a result inside the noise the baseline saw never fails.
+const int RegressionWarmupSteps = 10;
+const int RegressionTimingRuns = 5;
+
+struct TimingBaseline
+{
+    double Ms = 0.0;          // fastest run's median step
+    double SlowestMs = 0.0;   // slowest run's median step
+};
+
+struct RegressionScene
+{
+    std::string Name;
+    float dt = 0.1f, f = 0.0f, k = 0.1f, dPdx = 0.0f, dPdy = 0.0f;
+    int ParticleAmount = 25;
+    int ParticleDistanceX = 20;
+    int Steps = 150;
+    ContactSolvers Contacts = SnapContactSolver;
+    std::vector<Object> ObjectList;
+};
+
+Object MakeCircle(float X, float Y, float Size)
+{
+    Object Item;
+    Item.X = X;
+    Item.Y = Y;
+    Item.Size = Size;
+    Item.color = { 1.0f, 1.0f, 1.0f };
+    Item.ObjectType = Circle;
+    return Item;
+}
+
+std::vector<RegressionScene> CannedScenes()
+{
+    std::vector<RegressionScene> Scenes;
+
+    RegressionScene OpenFlow;
+    OpenFlow.Name = "open_flow";
+    OpenFlow.dt = 1.0f;
+    OpenFlow.dPdx = -10.0f;
+    Scenes.push_back(OpenFlow);
+
+    RegressionScene SingleCircle = OpenFlow;
+    SingleCircle.Name = "single_circle";
+    SingleCircle.ObjectList.push_back(MakeCircle(300, 500, 80));
+    Scenes.push_back(SingleCircle);
+
+    RegressionScene Coriolis;
+    Coriolis.Name = "coriolis_obstacles";
+    Coriolis.dt = 1.0f;
+    Coriolis.f = 0.5f;
+    Coriolis.k = 0.3f;
+    Coriolis.dPdx = -8.0f;
+    Coriolis.dPdy = 3.0f;
+    Coriolis.ObjectList.push_back(MakeCircle(250, 300, 60));
+    Coriolis.ObjectList.push_back(MakeCircle(450, 600, 90));
+    Coriolis.ObjectList.push_back(MakeCircle(700, 400, 40));
+    Scenes.push_back(Coriolis);
+
+    RegressionScene DensePack;
+    DensePack.Name = "dense_pack";
+    DensePack.dt = 1.0f;
+    DensePack.dPdx = -6.0f;
+    DensePack.ParticleAmount = 50;
+    DensePack.ParticleDistanceX = 40;
+    DensePack.Steps = 200;
+    DensePack.ObjectList.push_back(MakeCircle(200, 500, 250));
+    Scenes.push_back(DensePack);
+
+    // Fails if any step ends with more overlap than the solver's tolerance
+    RegressionScene DensePackSolved = DensePack;
+    DensePackSolved.Name = "dense_pack_pbd";
+    DensePackSolved.Contacts = PositionBasedContactSolver;
+    Scenes.push_back(DensePackSolved);
+
+    return Scenes;
+}
 
-            float dx = p.X - obj.X;
-            float dy = p.Y - obj.Y;
-            float distanceSquared = dx * dx + dy * dy;
-            float combinedRadius = obj.Size + particleRadius;
+// Deterministic, so two runs of a scene can be compared by hash
+void LoadScene(SimulationContext& Sim, const RegressionScene& Scene)
+{
+    Sim.Deterministic = true;
+    Sim.dt = Scene.dt;
+    Sim.f = Scene.f;
+    Sim.k = Scene.k;
+    Sim.dPdx = Scene.dPdx;
+    Sim.dPdy = Scene.dPdy;
+    Sim.ParticleAmount = Scene.ParticleAmount;
+    Sim.ParticleDistanceX = Scene.ParticleDistanceX;
+    Sim.ObjectList = Scene.ObjectList;
+    Sim.Contacts.Solver = Scene.Contacts;
+    PopulateParticleList(Sim);
+}
+
+bool WriteGolden(const std::string& Path, const SimulationContext& Sim)
+{
+    std::ofstream Out(Path);
+    if (!Out) return false;
+    Out << std::setprecision(9);
+    Out << "hash " << std::hex << Sim.StateHash << std::dec << "\n";
+    Out << "particles " << Sim.ParticleList.size() << "\n";
+    for (const Particle& p : Sim.ParticleList)
+        Out << p.X << " " << p.Y << " " << p.Velocity.x << " " << p.Velocity.y << "\n";
+    Out << "objects " << Sim.ObjectList.size() << "\n";
+    for (const Object& Item : Sim.ObjectList)
+        Out << (int)Item.ObjectType << " " << Item.X << " " << Item.Y << " " << Item.Size << "\n";
+    return static_cast<bool>(Out);
+}
+
+// Returns an empty string when the state matches, otherwise what went wrong.
+// Objects have to match exactly. Particles may be off by Tolerance, and a
+// state that is only that far off has another hash, so SameHash says whether
+// the run hashed to exactly the recorded state.
+std::string CompareGolden(const std::string& Path, const SimulationContext& Sim, float Tolerance, float& MaxError, bool& SameHash)
+{
+    MaxError = 0.0f;
+    SameHash = false;
+    std::ifstream In(Path);
+    if (!In) return "can't read golden";
+
+    std::string Word;
+    uint64_t Hash = 0;
+    size_t Count = 0;
+    In >> Word >> std::hex >> Hash >> std::dec >> Word >> Count;
+    if (!In) return "bad golden file";
+    if (Count != Sim.ParticleList.size())
+        return "particle count " + std::to_string(Sim.ParticleList.size()) + " != " + std::to_string(Count);
+
+    for (const Particle& p : Sim.ParticleList)
+    {
+        float X, Y, Vx, Vy;
+        In >> X >> Y >> Vx >> Vy;
+        MaxError = std::max({ MaxError, std::fabs(p.X - X), std::fabs(p.Y - Y), std::fabs(p.Velocity.x - Vx), std::fabs(p.Velocity.y - Vy) });
+    }
+
+    In >> Word >> Count;
+    if (!In) return "bad golden file";
+    if (Count != Sim.ObjectList.size())
+        return "object count " + std::to_string(Sim.ObjectList.size()) + " != " + std::to_string(Count);
+    for (size_t i = 0; i < Count; i++)
+    {
+        const Object& Item = Sim.ObjectList[i];
+        int Type;
+        float X, Y, Size;
+        if (!(In >> Type >> X >> Y >> Size))
+            return "bad golden file";
+        if (Type != (int)Item.ObjectType || X != Item.X || Y != Item.Y || Size != Item.Size)
+            return "object " + std::to_string(i) + " differs";
+    }
+
+    if (!(MaxError <= Tolerance))
+        return "state differs";
+    SameHash = Hash == Sim.StateHash;
+    return "";
+}
+
+// "scene fastest slowest" per line. Older files only have the fastest.
+std::map<std::string, TimingBaseline> LoadTimingBaseline(const std::string& Path)
+{
+    std::map<std::string, TimingBaseline> Baseline;
+    std::ifstream In(Path);
+    std::string Line;
+    while (std::getline(In, Line))
+    {
+        std::istringstream Words(Line);
+        std::string Name;
+        TimingBaseline Entry;
+        if (!(Words >> Name >> Entry.Ms))
+            continue;
+        if (!(Words >> Entry.SlowestMs))
+            Entry.SlowestMs = Entry.Ms;
+        Baseline[Name] = Entry;
+    }
+    return Baseline;
+}
+
+// One run's step time: the lower quartile of its steps after the warm-up.
+// Load on the machine only ever adds time, so the fast end is what measures
+// the code; a quartile rather than the minimum so one lucky step can't set it.
+double RegressionRunMs(std::vector<double>& StepMs)
+{
+    std::vector<double>::iterator Timed = StepMs.begin() + std::min<size_t>(RegressionWarmupSteps, StepMs.size() - 1);
+    std::vector<double>::iterator Quartile = Timed + (StepMs.end() - Timed) / 4;
+    std::nth_element(Timed, Quartile, StepMs.end());
+    return *Quartile;
+}
+
+int RunRegression(const char* Directory, bool UpdateGolden, double TimeThreshold, float StateTolerance, JobSystem* Jobs, NumaPlacement* Numa)
+{
+    std::error_code Error;
+    std::filesystem::create_directories(Directory, Error);
+    std::string BaselinePath = (std::filesystem::path(Directory) / "timings.baseline").string();
+    std::map<std::string, TimingBaseline> Baseline = LoadTimingBaseline(BaselinePath);
+    bool BaselineChanged = false;
+
+    struct SceneResult
+    {
+        std::string StateResult = "ok";
+        float MaxError = 0.0f;
+        bool StateOk = true;
+        long long SteadyAllocations = 0;
+        int OverlappedSteps = 0;
+        double FastestMs = 0.0, SlowestMs = 0.0;
+    };
+    std::vector<RegressionScene> Scenes = CannedScenes();
+    std::vector<SceneResult> Results(Scenes.size());
+    std::vector<double> StepMs;
+
+    int Wrong = 0, Slower = 0, Allocating = 0, HashChanged = 0, Unsettled = 0;
+    for (size_t n = 0; n < Scenes.size(); n++)
+    {
+        const RegressionScene& Scene = Scenes[n];
+        SceneResult& Result = Results[n];
+        SimulationContext Sim;
+        Sim.Jobs = Jobs;
+        if (Numa)
+            EnableNumaPlacement(Sim, Numa);
+        LoadScene(Sim, Scene);
+
+        StepMs.clear();
+        StepMs.reserve(Scene.Steps);
+        for (int Step = 0; Step < Scene.Steps; Step++)
+        {
+            auto Start = std::chrono::steady_clock::now();
+            StepSimulation(Sim);
+            StepMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+            // The first steps size every buffer and arena, after that there should be none
+            if (Step >= RegressionWarmupSteps)
+                Result.SteadyAllocations += Sim.Profile.StepAllocations;
+            // Position based contacts have to settle within their iteration budget
+            if (PositionBasedContacts(Sim) && Sim.Contacts.Residual > Sim.Contacts.Tolerance)
+                Result.OverlappedSteps++;
+        }
+        Result.FastestMs = Result.SlowestMs = RegressionRunMs(StepMs);
 
-            if (distanceSquared <= combinedRadius * combinedRadius)
+        // ---- State ----
+        std::string GoldenPath = (std::filesystem::path(Directory) / (Scene.Name + ".golden")).string();
+        if (UpdateGolden || !std::filesystem::exists(GoldenPath))
+        {
+            Result.StateResult = WriteGolden(GoldenPath, Sim) ? "recorded" : "write failed";
+        }
+        else
+        {
+            bool SameHash = false;
+            std::string Problem = CompareGolden(GoldenPath, Sim, StateTolerance, Result.MaxError, SameHash);
+            if (!Problem.empty())
             {
-                float dist = std::sqrt(distanceSquared);
-                if (dist > 0)
-                {
-                    float nx = dx / dist;
-                    float ny = dy / dist;
+                Result.StateResult = Problem;
+                Result.StateOk = false;
+                Wrong++;
+            }
+            else if (!SameHash)
+            {
+                // Within tolerance, so it passes, but not bit for bit any more
+                Result.StateResult = "hash differs";
+                HashChanged++;
+            }
+        }
+    }
 
-                    // Move particle just outside the object’s edge
-                    p.X = obj.X + nx * combinedRadius;
-                    p.Y = obj.Y + ny * combinedRadius;
+    // ---- Timing runs ----
+    // The checked run above was the first. The rest go round the scenes in
+    // turn, so a busy spell on the machine lands on different scenes in
+    // different rounds instead of on every run of one scene.
+    for (int Run = 1; Run < RegressionTimingRuns; Run++)
+        for (size_t n = 0; n < Scenes.size(); n++)
+        {
+            SimulationContext Sim;
+            Sim.Jobs = Jobs;
+            if (Numa)
+                EnableNumaPlacement(Sim, Numa);
+            LoadScene(Sim, Scenes[n]);
+            StepMs.clear();
+            for (int Step = 0; Step < Scenes[n].Steps; Step++)
+            {
+                auto Start = std::chrono::steady_clock::now();
+                StepSimulation(Sim);
+                StepMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+            }
+            double RunMs = RegressionRunMs(StepMs);
+            Results[n].FastestMs = std::min(Results[n].FastestMs, RunMs);
+            Results[n].SlowestMs = std::max(Results[n].SlowestMs, RunMs);
+        }
 
-                    p.Velocity.x = 0;
-                    p.Velocity.y = 0;
-                    p.color = { 255, 0, 0 };
-                    collided = true;
-                }
+    std::printf("%-20s %-14s %10s %10s %10s %10s %7s %7s  %s\n", "scene", "state", "max err", "step ms", "slowest", "baseline", "ratio",
+        "allocs", "result");
+    for (size_t n = 0; n < Scenes.size(); n++)
+    {
+        const RegressionScene& Scene = Scenes[n];
+        SceneResult& Result = Results[n];
+
+        // ---- Timing ----
+        double BaselineMs = 0.0;
+        bool TimeOk = true;
+        auto Found = Baseline.find(Scene.Name);
+        if (UpdateGolden || Found == Baseline.end())
+        {
+            Baseline[Scene.Name] = { Result.FastestMs, Result.SlowestMs };
+            BaselineChanged = true;
+            BaselineMs = Result.FastestMs;
+        }
+        else
+        {
+            BaselineMs = Found->second.Ms;
+            if (Result.FastestMs > BaselineMs * TimeThreshold && Result.FastestMs > Found->second.SlowestMs)
+            {
+                TimeOk = false;
+                Slower++;
             }
         }
 
-        // ---- Collision with Other Particles ----
-        for (int j = 0; j < ParticleList.size(); j++)
+        if (Result.SteadyAllocations > 0)
+            Allocating++;
+        if (Result.OverlappedSteps > 0) {
+            if (Result.StateOk)
+                Result.StateResult = std::to_string(Result.OverlappedSteps) + " unsettled";
+            Unsettled++;
+        }
+
+        const char* Verdict = !Result.StateOk ? "WRONG" : Result.OverlappedSteps > 0 ? "UNSETTLED"
+            : (!TimeOk ? "SLOWER" : (Result.SteadyAllocations > 0 ? "ALLOCATES" : "PASS"));
+        std::printf("%-20s %-14s %10.4g %10.4f %10.4f %10.4f %7.3f %7lld  %s\n", Scene.Name.c_str(), Result.StateResult.c_str(),
+            Result.MaxError, Result.FastestMs, Result.SlowestMs, BaselineMs, BaselineMs > 0 ? Result.FastestMs / BaselineMs : 1.0,
+            Result.SteadyAllocations, Verdict);
+    }
+
+    if (BaselineChanged)
+    {
+        std::ofstream Out(BaselinePath);
+        for (const auto& Entry : Baseline)
+            Out << Entry.first << " " << Entry.second.Ms << " " << Entry.second.SlowestMs << "\n";
+    }
+
+    if (Wrong || Slower || Allocating || Unsettled)
+    {
+        std::printf("FAILED: %d scene(s) wrong, %d scene(s) slower than %.2fx baseline and its slowest run, %d scene(s) allocating after warm-up, "
+            "%d scene(s) with contacts left over the tolerance\n", Wrong, Slower, TimeThreshold, Allocating, Unsettled);
+        return 1;
+    }
+    if (HashChanged)
+        std::printf("%d scene(s) within tolerance but with a different state hash than the golden\n", HashChanged);
+    std::printf("All scenes passed\n");
+    return 0;
+}
+
+// -------------------- Broadphase Benchmark --------------------
+// Every broadphase on the regression scenes, particle count scaled by Scale.
+// Reports median step time, speedup over brute force, contacts found and
+// whether the final state hash matches the brute force run. The scenes are
+// deterministic, so every shortcut should report "same": they gather again
+// after each push and visit candidates in the brute force loop's order.
+int RunBroadphaseBenchmark(int Scale, JobSystem* Jobs, NumaPlacement* Numa)
+{
+    std::printf("%-20s %-16s %9s %10s %8s %12s  %s\n", "scene", "broadphase", "particles", "step ms", "speedup", "contacts", "state");
+    for (RegressionScene Scene : CannedScenes())
+    {
+        Scene.ParticleAmount *= Scale;
+        double BruteMs = 0.0;
+        uint64_t BruteHash = 0;
+        for (int Mode = 0; Mode < (int)BroadphaseModeString.size(); Mode++)
         {
-            if (i == j)
-                continue;
+            SimulationContext Sim;
+            Sim.Jobs = Jobs;
+            if (Numa)
+                EnableNumaPlacement(Sim, Numa);
+            Sim.Broadphase = (BroadphaseModes)Mode;
+            LoadScene(Sim, Scene);
+
+            std::vector<double> StepMs;
+            StepMs.reserve(Scene.Steps);
+            for (int Step = 0; Step < Scene.Steps; Step++)
+            {
+                auto Start = std::chrono::steady_clock::now();
+                StepSimulation(Sim);
+                StepMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+            }
+            std::nth_element(StepMs.begin(), StepMs.begin() + StepMs.size() / 2, StepMs.end());
+            double MedianMs = StepMs[StepMs.size() / 2];
+            if (Mode == BruteForceBroadphase) {
+                BruteMs = MedianMs;
+                BruteHash = Sim.StateHash;
+            }
+
+            std::printf("%-20s %-16s %9zu %10.4f %7.2fx %12lld  %s\n", Scene.Name.c_str(), BroadphaseModeString[Mode].c_str(),
+                Sim.ParticleList.size(), MedianMs, MedianMs > 0 ? BruteMs / MedianMs : 0.0, Sim.ParticleCollisions.load(),
+                Sim.StateHash == BruteHash ? "same" : "differs");
+        }
+    }
+    return 0;
+}
 
-            Particle& other = ParticleList[j];
-            float dx = p.X - other.X;
-            float dy = p.Y - other.Y;
-            float distanceSquared = dx * dx + dy * dy;
-            float combinedRadius = particleRadius * 2.0f;
+// -------------------- Page Benchmark --------------------
+// The regression scenes once per page mode, on this thread only, so one
+// thread's TLB counter sees every access. Reports median step time, data TLB
+// load misses per step and how much of the particle storage got huge pages.
+// Needs enough particles to outgrow the TLB, a --bench-scale of 50 or so.
+int RunPageBenchmark(int Scale)
+{
+    TlbMissCounter Tlb;
+    if (!Tlb.Open())
+        std::printf("No data TLB counter here (perf_event_open failed), TLB misses show as n/a\n");
+    std::printf("%-20s %-12s %9s %10s %14s %10s\n", "scene", "pages", "particles", "step ms", "dTLB miss/step", "huge MB");
+    for (RegressionScene Scene : CannedScenes())
+    {
+        Scene.ParticleAmount *= Scale;
+        for (int Mode = HugePagesOff; Mode <= HugePagesExplicit; Mode++)
+        {
+            NumaPlacement Placement(SingleNodeTopology(), nullptr, (HugePageModes)Mode);
+            SimulationContext Sim;
+            Sim.Broadphase = UniformGridBroadphase;
+            EnableNumaPlacement(Sim, &Placement);
+            LoadScene(Sim, Scene);
 
-            if (distanceSquared <= combinedRadius * combinedRadius)
+            std::vector<double> StepMs;
+            StepMs.reserve(Scene.Steps);
+            long long Misses = 0;
+            for (int Step = 0; Step < Scene.Steps; Step++)
             {
-                float dist = std::sqrt(distanceSquared);
-                if (dist > 0)
-                {
-                    float nx = dx / dist;
-                    float ny = dy / dist;
+                auto Start = std::chrono::steady_clock::now();
+                Tlb.Start();
+                StepSimulation(Sim);
+                Misses += Tlb.Stop();
+                StepMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+            }
+            std::nth_element(StepMs.begin(), StepMs.begin() + StepMs.size() / 2, StepMs.end());
+
+            char MissText[32] = "n/a";
+            if (Tlb.Valid())
+                std::snprintf(MissText, sizeof(MissText), "%.0f", (double)Misses / Scene.Steps);
+            long long Backed = QueryHugeBackedBytes(Sim.ParticleList.data());
+            char BackedText[32] = "n/a";
+            if (Backed >= 0)
+                std::snprintf(BackedText, sizeof(BackedText), "%.1f", Backed / 1048576.0);
+            std::printf("%-20s %-12s %9zu %10.4f %14s %10s\n", Scene.Name.c_str(), HugePageModeNames[Mode], Sim.ParticleList.size(),
+                StepMs[StepMs.size() / 2], MissText, BackedText);
+        }
+    }
+    return 0;
+}
 
-                    // Push this particle away so edges just touch
-                    p.X = other.X + nx * combinedRadius;
-                    p.Y = other.Y + ny * combinedRadius;
+// -------------------- Precision Benchmark --------------------
+// The regression scenes once per precision policy. Reports median step time,
+// bytes of particle state the kernels stream, and how far the final positions
+// are from the double run's. Contacts make the scenes chaotic, so after a few
+// hundred steps any rounding grows into whole-pixel differences. Compare the
+// policies with each other, not with zero.
+int RunPrecisionBenchmark(int Scale, JobSystem* Jobs)
+{
+    std::printf("%-20s %-8s %9s %8s %10s %12s %12s\n", "scene", "policy", "particles", "B/part", "step ms", "mean err px", "max err px");
+    const PrecisionModes Order[] = { DoublePrecision, SinglePrecision, HalfStoragePrecision };
+    const size_t StoreBytes[] = { 4 * sizeof(float), PrecisionStore<DoublePolicy>::BytesPerParticle(), PrecisionStore<HalfPolicy>::BytesPerParticle() };
+    for (RegressionScene Scene : CannedScenes())
+    {
+        Scene.ParticleAmount *= Scale;
+        std::vector<Vector2D> Reference;
+        for (PrecisionModes Mode : Order)
+        {
+            SimulationContext Sim;
+            Sim.Jobs = Jobs;
+            Sim.Broadphase = UniformGridBroadphase;
+            Sim.Precision = Mode;
+            LoadScene(Sim, Scene);
 
-                    p.Velocity.x = 0;
-                    p.Velocity.y = 0;
-                    p.color = { 255, 255, 0 };
-                    collided = true;
-                }
+            std::vector<double> StepMs;
+            StepMs.reserve(Scene.Steps);
+            for (int Step = 0; Step < Scene.Steps; Step++)
+            {
+                auto Start = std::chrono::steady_clock::now();
+                StepSimulation(Sim);
+                StepMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+            }
+            std::nth_element(StepMs.begin(), StepMs.begin() + StepMs.size() / 2, StepMs.end());
+
+            int Count = (int)Sim.ParticleList.size();
+            if (Mode == DoublePrecision) {
+                const PrecisionStore<DoublePolicy>& Live = Sim.DoubleState.Live;
+                Reference.resize(Count);
+                for (int i = 0; i < Count; i++)
+                    Reference[i] = { Live.X[i], Live.Y[i] };
+            }
+            double Sum = 0.0, Worst = 0.0;
+            for (int i = 0; i < Count && i < (int)Reference.size(); i++) {
+                double Error = std::hypot(Sim.ParticleList[i].X - Reference[i].x, Sim.ParticleList[i].Y - Reference[i].y);
+                Sum += Error;
+                Worst = std::max(Worst, Error);
             }
+            std::printf("%-20s %-8s %9d %8zu %10.4f %12.4f %12.4f\n", Scene.Name.c_str(), PrecisionModeNames[Mode], Count,
+                StoreBytes[Mode], StepMs[StepMs.size() / 2], Count ? Sum / Count : 0.0, Worst);
         }
+    }
+    return 0;
+}
 
-        // ---- Default Color if No Collision ----
-        if (!collided)
-            p.color = { 0.0745f, 0.2745f, 0.0667f };
+// Three tables over a synthetic street: two rows of opposite sign scattered
+// about y = 440 and y = 560. Everything is split over the job system by
+// target, and tree and multipole times include their builds.
+//
+//   1. direct summation against Barnes-Hut at a few opening angles, every
+//      vortex a target, and where the tree starts to win. Past DirectLimit
+//      vortices the reference only takes every Stride-th target.
+//   2. multipole error per expansion order, at particles spread over the
+//      band, against a double direct sum
+//   3. Barnes-Hut against the multipole per target up to a million
+//      vortices, at similar error, against a sampled direct sum. Streets get
+//      longer and more of them run side by side 400 px apart as the count
+//      grows, so the density stays that of 65536 vortices in one street.
+int RunVortexBenchmark(int Scale, JobSystem* Jobs)
+{
+    const float Thetas[] = { 0.3f, 0.5f, 0.8f };
+    const int DirectLimit = 32768;
+    int Crossover[3] = { 0, 0, 0 };
+    TaskGraph Graph;
+
+    auto Street = [](int Count, float Length, int Rows) {
+        std::mt19937 Random(Count);
+        std::uniform_real_distribution<float> Along(0.0f, Length);
+        std::normal_distribution<float> Across(0.0f, 30.0f);
+        std::uniform_real_distribution<float> Magnitude(0.5f, 1.5f);
+        VortexSet Set;
+        for (int i = 0; i < Count; i++) {
+            bool Top = i % 2 == 0;
+            float Offset = 400.0f * (i / 2 % Rows);
+            Set.Add(Along(Random), Offset + (Top ? 560.0f : 440.0f) + Across(Random), (Top ? -1.0f : 1.0f) * Magnitude(Random));
+        }
+        return Set;
+    };
+    // Particles over the bands the streets run through, (0, 300) to (Length, 400 (Rows - 1) + 700)
+    auto Band = [](int Count, float Length, int Rows, std::vector<float>& X, std::vector<float>& Y) {
+        std::mt19937 Random(Count + 1);
+        std::uniform_real_distribution<float> Along(0.0f, Length);
+        std::uniform_real_distribution<float> Across(300.0f, 700.0f);
+        X.resize(Count);
+        Y.resize(Count);
+        for (int i = 0; i < Count; i++) {
+            X[i] = Along(Random);
+            Y[i] = 400.0f * (i % Rows) + Across(Random);
+        }
+    };
+    // Repeats short runs until they add up to 50 ms, returns ms per run
+    auto Time = [](const auto& Run) {
+        int Runs = 0;
+        auto Start = std::chrono::steady_clock::now();
+        double Elapsed = 0.0;
+        do {
+            Run();
+            Runs++;
+            Elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        } while (Elapsed < 50.0);
+        return Elapsed / Runs;
+    };
+    // Every Stride-th target of (X, Y), summed directly in double
+    auto Reference = [&Graph, Jobs](const VortexSet& Set, float Core, const std::vector<float>& X, const std::vector<float>& Y, int Stride,
+                         std::vector<float>& U, std::vector<float>& V) {
+        int Targets = (int)X.size() / Stride;
+        U.resize(Targets);
+        V.resize(Targets);
+        ParallelFor(Jobs, Graph, Targets, 16, [&](int Begin, int End) {
+            for (int t = Begin; t < End; t++) {
+                double Sr = 0.0, Si = 0.0;
+                AccumulateVortices(Set.X.data(), Set.Y.data(), Set.Strength.data(), 0, (int)Set.Size(), (double)X[t * Stride],
+                    (double)Y[t * Stride], (double)Core * Core, Sr, Si);
+                VelocityFromSum(Sr, Si, U[t], V[t]);
+            }
+        });
+    };
+    auto RelativeError = [](const std::vector<float>& U, const std::vector<float>& V, int Stride, const std::vector<float>& RefU,
+                             const std::vector<float>& RefV) {
+        double ErrorSquared = 0.0, NormSquared = 0.0;
+        for (size_t t = 0; t < RefU.size(); t++) {
+            double du = U[t * Stride] - RefU[t], dv = V[t * Stride] - RefV[t];
+            ErrorSquared += du * du + dv * dv;
+            NormSquared += (double)RefU[t] * RefU[t] + (double)RefV[t] * RefV[t];
+        }
+        return NormSquared > 0 ? std::sqrt(ErrorSquared / NormSquared) : 0.0;
+    };
+
+    // ---- Barnes-Hut crossover ----
+    const float Core = 6.0f;
+    std::printf("%9s %6s %11s %11s %9s %13s %8s\n", "vortices", "theta", "direct ms", "tree ms", "speedup", "rms rel error", "cells");
+    for (int Count = 16; Count <= 131072 * Scale; Count *= 2)
+    {
+        VortexSet Set = Street(Count, 1400.0f, 1);
+        int Stride = Count > DirectLimit ? Count / DirectLimit : 1;
+        int Targets = Count / Stride;
+        std::vector<float> DirectU(Targets), DirectV(Targets);
+        double DirectMs = Time([&]() {
+            ParallelFor(Jobs, Graph, Targets, 64, [&](int Begin, int End) {
+                for (int t = Begin; t < End; t++)
+                    DirectVortexVelocity(Set, Core, Set.X[t * Stride], Set.Y[t * Stride], DirectU[t], DirectV[t]);
+            });
+        }) * Stride;
+
+        for (int n = 0; n < 3; n++)
+        {
+            BarnesHutTree Tree;
+            Tree.Theta = Thetas[n];
+            std::vector<float> TreeU(Count), TreeV(Count);
+            double TreeMs = Time([&]() {
+                Tree.Build(Set, Core, Jobs, Graph);
+                ParallelFor(Jobs, Graph, Count, 512, [&](int Begin, int End) {
+                    for (int i = Begin; i < End; i++)
+                        Tree.Velocity(Set.X[i], Set.Y[i], TreeU[i], TreeV[i]);
+                });
+            });
+            if (!Crossover[n] && TreeMs < DirectMs)
+                Crossover[n] = Count;
+            std::printf("%9d %6.2f %11.3f %11.3f %9.2f %13.2e %8d\n", Count, Thetas[n], DirectMs, TreeMs, DirectMs / TreeMs,
+                RelativeError(TreeU, TreeV, Stride, DirectU, DirectV), Tree.NodeCount());
+        }
+    }
+    for (int n = 0; n < 3; n++) {
+        if (Crossover[n])
+            std::printf("theta %.2f: the tree wins from %d vortices\n", Thetas[n], Crossover[n]);
+        else
+            std::printf("theta %.2f: the tree never won\n", Thetas[n]);
+    }
+
+    // ---- Multipole error per order ----
+    // No core here, so the far field the expansions approximate is the
+    // whole difference from the reference
+    {
+        int Count = 32768 * Scale;
+        VortexSet Set = Street(Count, 1400.0f, 1);
+        std::vector<float> X, Y, RefU, RefV, U(Count), V(Count);
+        Band(Count, 1400.0f, 1, X, Y);
+        Reference(Set, 0.0f, X, Y, 1, RefU, RefV);
+        std::printf("\n%9s %9s %6s %7s %11s %13s\n", "vortices", "particles", "order", "levels", "fmm ms", "rms rel error");
+        FastMultipole Multipole;
+        for (int Order : { 1, 2, 4, 6, 8, 10, 12, 16, 20, 24 })
+        {
+            Multipole.Order = Order;
+            double Ms = Time([&]() {
+                Multipole.Build(Set, 0.0f, 0.0f, 300.0f, 1400.0f, 700.0f, Jobs, Graph);
+                Multipole.Evaluate(X.data(), Y.data(), Count, U.data(), V.data(), Jobs, Graph);
+            });
+            std::printf("%9d %9d %6d %7d %11.3f %13.2e\n", Count, Count, Order, Multipole.LevelCount(), Ms, RelativeError(U, V, 1, RefU, RefV));
+        }
     }
+
+    // ---- Barnes-Hut against the multipole ----
+    // Theta 0.5 and order 4 land at about the same error
+    {
+        const int Samples = 2048;
+        std::printf("\n%9s %15s %12s %15s %12s\n", "vortices", "tree ns/target", "tree error", "fmm ns/target", "fmm error");
+        for (int Count = 65536; Count <= 1048576 * Scale; Count *= 4)
+        {
+            int Rows = (int)std::lround(std::sqrt(Count / 65536.0));
+            float Length = 1400.0f * Rows;
+            VortexSet Set = Street(Count, Length, Rows);
+            std::vector<float> X, Y, RefU, RefV, U(Count), V(Count);
+            Band(Count, Length, Rows, X, Y);
+            int Stride = std::max(1, Count / Samples);
+            Reference(Set, Core, X, Y, Stride, RefU, RefV);
+
+            BarnesHutTree Tree;
+            double TreeMs = Time([&]() {
+                Tree.Build(Set, Core, Jobs, Graph);
+                ParallelFor(Jobs, Graph, Count, 512, [&](int Begin, int End) {
+                    for (int i = Begin; i < End; i++)
+                        Tree.Velocity(X[i], Y[i], U[i], V[i]);
+                });
+            });
+            double TreeError = RelativeError(U, V, Stride, RefU, RefV);
+
+            FastMultipole Multipole;
+            Multipole.Order = 4;
+            double MultipoleMs = Time([&]() {
+                Multipole.Build(Set, Core, 0.0f, 300.0f, Length, 400.0f * (Rows - 1) + 700.0f, Jobs, Graph);
+                Multipole.Evaluate(X.data(), Y.data(), Count, U.data(), V.data(), Jobs, Graph);
+            });
+            std::printf("%9d %15.1f %12.2e %15.1f %12.2e\n", Count, TreeMs * 1e6 / Count, TreeError, MultipoleMs * 1e6 / Count,
+                RelativeError(U, V, Stride, RefU, RefV));
+        }
+    }
+    return 0;
 }